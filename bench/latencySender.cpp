@@ -0,0 +1,110 @@
+#include "latencyStamp.h"
+#include "syntheticMedia.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+using std::string;
+#include <thread>
+
+extern "C"
+{
+#include <libavutil/opt.h>
+};
+
+// player_latency_sender: local live source for measuring glass-to-glass latency.
+//
+// Encodes a test pattern in real time, paints the wall clock into every frame with LatencyStamp
+// right before encoding it, and sends it as MPEG-TS to a UDP loopback address or a pipe:
+//
+//   player_latency_sender udp://127.0.0.1:5000?pkt_size=1316 &
+//   player -lowlatency -latency-probe -an udp://127.0.0.1:5000
+//
+//   player_latency_sender pipe:1 | player -lowlatency -latency-probe -an pipe:0
+//
+// usage: player_latency_sender [-fps n] [-size WxH] [-seconds n] [output url]
+
+int main(int argc, char *argv[])
+{
+    string output = "udp://127.0.0.1:5000?pkt_size=1316";
+    int fps = 25;
+    int width = 640;
+    int height = 360;
+    int seconds = 30;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "-fps" && i + 1 < argc)
+        {
+            fps = std::stoi(argv[++i]);
+        }
+        else if (arg == "-size" && i + 1 < argc && std::sscanf(argv[i + 1], "%dx%d", &width, &height) == 2)
+        {
+            i++;
+        }
+        else if (arg == "-seconds" && i + 1 < argc)
+        {
+            seconds = std::stoi(argv[++i]);
+        }
+        else
+        {
+            output = arg;
+        }
+    }
+    if (!ffmpegUtil::LatencyStamp::fits(width, height))
+    {
+        std::cerr << "picture too small for the latency stamp" << std::endl;
+        return 1;
+    }
+
+    avformat_network_init();
+
+    AVFormatContext *oc = nullptr;
+    if (avformat_alloc_output_context2(&oc, nullptr, "mpegts", output.c_str()) < 0)
+    {
+        std::cerr << "can not create output: " << output << std::endl;
+        return 1;
+    }
+    // no mux delay and a flush per packet, every frame leaves as soon as it is encoded.
+    av_opt_set_int(oc, "max_delay", 0, 0);
+    oc->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+
+    AVCodecContext *enc = synthetic::openEncoder(AV_CODEC_ID_MPEG4, oc, [&](AVCodecContext *c) {
+        c->width = width;
+        c->height = height;
+        c->pix_fmt = AV_PIX_FMT_YUV420P;
+        c->time_base = AVRational{1, fps};
+        c->framerate = AVRational{fps, 1};
+        c->gop_size = fps;
+        c->max_b_frames = 0;
+        c->bit_rate = 4000000;
+    });
+    AVStream *st = avformat_new_stream(oc, nullptr);
+    avcodec_parameters_from_context(st->codecpar, enc);
+    st->time_base = enc->time_base;
+
+    if (avio_open(&oc->pb, output.c_str(), AVIO_FLAG_WRITE) < 0 || avformat_write_header(oc, nullptr) < 0)
+    {
+        std::cerr << "can not open output: " << output << std::endl;
+        return 1;
+    }
+
+    std::cerr << "sending " << width << "x" << height << "@" << fps << " to " << output << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < seconds * fps; i++)
+    {
+        std::this_thread::sleep_until(start + std::chrono::microseconds((int64_t)i * 1000000 / fps));
+        AVFrame *frame = synthetic::makeTestPattern(width, height, i);
+        ffmpegUtil::LatencyStamp::write(frame, ffmpegUtil::LatencyStamp::wallClockUs());
+        synthetic::encodeAndWrite(oc, enc, st, frame);
+        av_frame_free(&frame);
+    }
+    synthetic::encodeAndWrite(oc, enc, st, nullptr);
+
+    av_write_trailer(oc);
+    avio_closep(&oc->pb);
+    avcodec_free_context(&enc);
+    avformat_free_context(oc);
+    return 0;
+}
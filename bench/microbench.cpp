@@ -0,0 +1,853 @@
+#include "audioDsp.h"
+#include "clipExtractor.h"
+#include "ffmpegUtil.h"
+#include "logger.h"
+#include "mediaProcessor.hpp"
+#include "pixelConvert.h"
+#include "sceneDetector.h"
+#include "shmFrameRing.h"
+#include "tensorConvert.h"
+#include "syntheticMedia.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C"
+{
+#include <libavutil/opt.h>
+};
+
+// player_microbench: repeatable micro benchmarks of the pipeline building blocks.
+//
+// All inputs are synthesized at startup (a testsrc-like pattern and a sine tone, encoded with
+// libavcodec into a temporary file), nothing is read from or downloaded to the tree.
+// Every case prints one JSON object per line, so two runs can be diffed or loaded as JSONL.
+//
+// usage: player_microbench [-filter text] [-repeats n] [-o results.jsonl] [-tmp dir]
+
+namespace
+{
+
+using namespace ffmpegUtil;
+using namespace synthetic;
+
+using std::string;
+using std::vector;
+
+using Clock = std::chrono::steady_clock;
+
+FILE *resultOut = stdout;
+string benchFilter{};
+int benchRepeats = 7;
+
+// removes the synthesized media when main returns or a bench throws.
+struct TempFile
+{
+    string path;
+    explicit TempFile(const string &p) : path(p) {}
+    TempFile(const TempFile &) = delete;
+    TempFile &operator=(const TempFile &) = delete;
+    ~TempFile() { std::remove(path.c_str()); }
+};
+
+// run fn (which performs opsPerRun operations) repeats times and report the median and the best run.
+void runBench(const string &bench, const string &caseName, int opsPerRun, const std::function<void()> &fn,
+              double bytesPerOp = 0)
+{
+    string fullName = bench + "/" + caseName;
+    if (!benchFilter.empty() && fullName.find(benchFilter) == string::npos)
+    {
+        return;
+    }
+
+    fn(); // warm up: caches, lazy tables, first allocations.
+
+    vector<double> nsPerOp{};
+    for (int r = 0; r < benchRepeats; r++)
+    {
+        auto t0 = Clock::now();
+        fn();
+        auto t1 = Clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+        nsPerOp.push_back(ns / opsPerRun);
+    }
+    std::sort(nsPerOp.begin(), nsPerOp.end());
+    double median = nsPerOp[nsPerOp.size() / 2];
+
+    std::fprintf(resultOut,
+                 "{\"bench\":\"%s\",\"case\":\"%s\",\"ops\":%d,\"repeats\":%d,"
+                 "\"ns_per_op_median\":%.1f,\"ns_per_op_min\":%.1f",
+                 bench.c_str(), caseName.c_str(), opsPerRun, benchRepeats, median, nsPerOp.front());
+    if (bytesPerOp > 0)
+    {
+        std::fprintf(resultOut, ",\"mb_per_s\":%.1f", bytesPerOp / median * 1e9 / (1024 * 1024));
+    }
+    std::fprintf(resultOut, "}\n");
+    std::fflush(resultOut);
+}
+
+//--------------------------------------------------------------------------
+// benchmarks
+//--------------------------------------------------------------------------
+
+void benchReSample()
+{
+    struct Case
+    {
+        AVSampleFormat fmt;
+        uint64_t layout;
+        int rate;
+    };
+    const Case cases[] = {
+        {AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO, 48000}, {AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO, 44100},
+        {AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO, 96000}, {AV_SAMPLE_FMT_S16, AV_CH_LAYOUT_STEREO, 48000},
+        {AV_SAMPLE_FMT_S16, AV_CH_LAYOUT_STEREO, 44100},  {AV_SAMPLE_FMT_S32P, AV_CH_LAYOUT_STEREO, 48000},
+        {AV_SAMPLE_FMT_DBL, AV_CH_LAYOUT_STEREO, 48000},  {AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_5POINT1, 48000},
+    };
+    const int frameSamples = 1024;
+    const int framesPerRun = 200;
+
+    for (auto &c : cases)
+    {
+        int channels = av_get_channel_layout_nb_channels(c.layout);
+        AudioInfo in(c.layout, c.rate, channels, c.fmt);
+        ReSampler reSampler(in, ReSampler::getDefaultAudioInfo(48000));
+
+        AVFrame *frame = makeSineFrame(c.fmt, c.layout, c.rate, frameSamples, 0);
+        uint8_t *outBuffer = nullptr;
+        int outBufferSize = reSampler.allocDataBuf(&outBuffer, frameSamples);
+
+        string caseName = string(av_get_sample_fmt_name(c.fmt)) + "_" + std::to_string(channels) + "ch_" +
+                          std::to_string(c.rate) + "_to_s16_2ch_48000";
+        runBench("resample", caseName, framesPerRun, [&]() {
+            for (int i = 0; i < framesPerRun; i++)
+            {
+                reSampler.reSample(outBuffer, outBufferSize, frame);
+            }
+        });
+
+        av_freep(&outBuffer);
+        av_frame_free(&frame);
+    }
+}
+
+// process() against processScalar() on the same buffers, the largest difference in S16 LSB (float
+// output is scaled back). Buffer lengths that are no multiple of the chunk or of the vector width
+// run the scalar tails, full scale noise at a gain above 1 saturates and drives the limiter, the
+// volume changes ramp.
+int audioDspMaxDiff(int channels, bool limiter, AudioDsp::OutFormat format)
+{
+    const int lengths[] = {1024, 1021, 67, 3, 2048};
+    const float volumes[] = {0.5f, 2.0f, 4.0f, 1.0f};
+    AudioDsp simd{48000};
+    AudioDsp scalar{48000};
+    simd.setLimiterEnabled(limiter);
+    scalar.setLimiterEnabled(limiter);
+    simd.setOutput(format, 2);
+    scalar.setOutput(format, 2);
+    uint32_t seed = 12345;
+    int maxDiff = 0;
+    for (int pass = 0; pass < 4; pass++)
+    {
+        simd.setVolume(volumes[pass]);
+        scalar.setVolume(volumes[pass]);
+        for (int frames : lengths)
+        {
+            vector<int16_t> a(frames * channels);
+            for (auto &v : a)
+            {
+                seed = seed * 1664525 + 1013904223;
+                v = (seed >> 24) < 32 ? (seed & 1 ? 32767 : -32768) : (int16_t)(seed >> 16);
+            }
+            vector<uint8_t> outSimd(frames * simd.getOutFrameBytes());
+            vector<uint8_t> outScalar(outSimd.size());
+            simd.process(a.data(), channels, frames, outSimd.data());
+            scalar.processScalar(a.data(), channels, frames, outScalar.data());
+            for (int i = 0; i < frames * 2; i++)
+            {
+                int diff;
+                if (format == AudioDsp::OUT_F32)
+                {
+                    float d = ((const float *)outSimd.data())[i] - ((const float *)outScalar.data())[i];
+                    diff = (int)std::lrint(std::fabs(d) * 32768);
+                }
+                else
+                {
+                    diff = std::abs(((const int16_t *)outSimd.data())[i] - ((const int16_t *)outScalar.data())[i]);
+                }
+                maxDiff = std::max(maxDiff, diff);
+            }
+        }
+    }
+    return maxDiff;
+}
+
+// AudioDsp against doing the same with extra swr passes, as it would be done without it.
+// The S16 AudioDsp cases include copying the input back (they work in place), the swr ones do not.
+// The SIMD path is compared with the scalar one first, the exit status is 1 when it is off by
+// more than 1 LSB.
+bool benchAudioDsp()
+{
+    const int frameSamples = 1024;
+    const int buffersPerRun = 200;
+    const uint64_t layouts[] = {AV_CH_LAYOUT_STEREO, AV_CH_LAYOUT_5POINT1};
+    bool ok = true;
+
+    for (auto layout : layouts)
+    {
+        int channels = av_get_channel_layout_nb_channels(layout);
+        for (bool limiter : {true, false})
+        {
+            for (auto format : {AudioDsp::OUT_S16, AudioDsp::OUT_F32})
+            {
+                string caseName = "simd_" + std::to_string(channels) + "ch" + (limiter ? "_limiter" : "") +
+                                  (format == AudioDsp::OUT_F32 ? "_f32" : "");
+                int maxDiff = audioDspMaxDiff(channels, limiter, format);
+                bool pass = maxDiff <= 1;
+                ok = ok && pass;
+                std::fprintf(resultOut,
+                             "{\"bench\":\"audio_dsp\",\"case\":\"%s\",\"check\":\"scalar\","
+                             "\"max_abs_diff\":%d,\"tolerance\":1,\"pass\":%s}\n",
+                             caseName.c_str(), maxDiff, pass ? "true" : "false");
+            }
+        }
+        AVFrame *frame = makeSineFrame(AV_SAMPLE_FMT_S16, layout, 48000, frameSamples, 0);
+        int inBytes = frameSamples * channels * 2;
+        vector<uint8_t> work(inBytes);
+        vector<uint8_t> mixed(frameSamples * 2 * 2);
+        vector<uint8_t> out(frameSamples * 2 * 2);
+        string suffix = "_" + std::to_string(channels) + "ch_s16_48000";
+
+        AudioDsp dsp{48000};
+        dsp.setVolume(0.5f);
+        runBench("audio_dsp", "fused_simd" + suffix, buffersPerRun,
+                 [&]() {
+                     for (int i = 0; i < buffersPerRun; i++)
+                     {
+                         std::memcpy(work.data(), frame->data[0], inBytes);
+                         dsp.process((const int16_t *)work.data(), channels, frameSamples, work.data());
+                     }
+                 },
+                 inBytes);
+        runBench("audio_dsp", "fused_scalar" + suffix, buffersPerRun,
+                 [&]() {
+                     for (int i = 0; i < buffersPerRun; i++)
+                     {
+                         std::memcpy(work.data(), frame->data[0], inBytes);
+                         dsp.processScalar((const int16_t *)work.data(), channels, frameSamples, work.data());
+                     }
+                 },
+                 inBytes);
+
+        // the float device case: written to its own buffer, twice the size of the S16 output.
+        AudioDsp dspF32{48000};
+        dspF32.setVolume(0.5f);
+        dspF32.setOutput(AudioDsp::OUT_F32, 2);
+        vector<uint8_t> outF32(frameSamples * dspF32.getOutFrameBytes());
+        runBench("audio_dsp", "fused_simd_f32out" + suffix, buffersPerRun,
+                 [&]() {
+                     for (int i = 0; i < buffersPerRun; i++)
+                     {
+                         dspF32.process((const int16_t *)frame->data[0], channels, frameSamples, outF32.data());
+                     }
+                 },
+                 inBytes);
+
+        // downmix (5.1 only) then gain through rematrix_volume, one swr_convert per step.
+        SwrContext *downmix = nullptr;
+        if (channels != 2)
+        {
+            downmix = swr_alloc_set_opts(nullptr, AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_S16, 48000, layout,
+                                         AV_SAMPLE_FMT_S16, 48000, 0, nullptr);
+            swr_init(downmix);
+        }
+        SwrContext *gain = swr_alloc_set_opts(nullptr, AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_S16, 48000,
+                                              AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_S16, 48000, 0, nullptr);
+        av_opt_set_double(gain, "rmvol", 0.5, 0);
+        swr_init(gain);
+
+        runBench("audio_dsp", string(downmix != nullptr ? "swr_downmix_gain" : "swr_gain") + suffix, buffersPerRun,
+                 [&]() {
+                     for (int i = 0; i < buffersPerRun; i++)
+                     {
+                         const uint8_t *src = frame->data[0];
+                         uint8_t *dst = mixed.data();
+                         if (downmix != nullptr)
+                         {
+                             swr_convert(downmix, &dst, frameSamples, &src, frameSamples);
+                             src = mixed.data();
+                         }
+                         dst = out.data();
+                         swr_convert(gain, &dst, frameSamples, &src, frameSamples);
+                     }
+                 },
+                 inBytes);
+
+        swr_free(&gain);
+        swr_free(&downmix);
+        av_frame_free(&frame);
+    }
+    return ok;
+}
+
+void benchSwsScale()
+{
+    const AVPixelFormat formats[] = {AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12,  AV_PIX_FMT_YUV420P10LE,
+                                     AV_PIX_FMT_YUV422P, AV_PIX_FMT_RGB24, AV_PIX_FMT_BGRA};
+    const int sizes[][2] = {{1280, 720}, {1920, 1080}};
+    const int framesPerRun = 10;
+
+    for (auto &size : sizes)
+    {
+        int w = size[0];
+        int h = size[1];
+        AVFrame *pattern = makeTestPattern(w, h, 0);
+        AVFrame *outPic = av_frame_alloc();
+        outPic->format = AV_PIX_FMT_YUV420P;
+        outPic->width = w;
+        outPic->height = h;
+        av_frame_get_buffer(outPic, 32);
+
+        for (auto fmt : formats)
+        {
+            AVFrame *src = convertFrame(pattern, fmt);
+            // same flags as VideoProcessor.
+            auto sws = sws_getContext(w, h, fmt, w, h, AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr, nullptr, nullptr);
+
+            string caseName = string(av_get_pix_fmt_name(fmt)) + "_to_yuv420p_" + std::to_string(w) + "x" +
+                              std::to_string(h);
+            runBench("sws_scale", caseName, framesPerRun,
+                     [&]() {
+                         for (int i = 0; i < framesPerRun; i++)
+                         {
+                             sws_scale(sws, src->data, src->linesize, 0, h, outPic->data, outPic->linesize);
+                         }
+                     },
+                     av_image_get_buffer_size(AV_PIX_FMT_YUV420P, w, h, 1));
+
+            sws_freeContext(sws);
+            av_frame_free(&src);
+        }
+        av_frame_free(&outPic);
+        av_frame_free(&pattern);
+    }
+}
+
+// PixelConvert kernels against the swscale call VideoProcessor would make otherwise. Every kernel
+// output is compared with swscale first: a result line with max_abs_diff per case, and the exit
+// status is 1 when a kernel is off by more than the tolerance.
+bool benchPixelConvert()
+{
+    struct Case
+    {
+        AVPixelFormat format;
+        int tolerance; // swscale dithers high bit depths down, we round
+    };
+    const Case cases[] = {{AV_PIX_FMT_NV12, 0}, {AV_PIX_FMT_NV21, 0}, {AV_PIX_FMT_YUV420P10LE, 1},
+                          {AV_PIX_FMT_YUV420P12LE, 1}};
+    const int sizes[][2] = {{1280, 720}, {1920, 1080}, {1366, 767}}; // odd size: the scalar tails
+    const PixelConvert::Isa isas[] = {PixelConvert::SCALAR, PixelConvert::SSE2, PixelConvert::AVX2};
+    const char *isaNames[] = {"scalar", "sse2", "avx2"};
+    const int framesPerRun = 10;
+    bool ok = true;
+
+    for (auto &size : sizes)
+    {
+        int w = size[0];
+        int h = size[1];
+        AVFrame *pattern = makeTestPattern(w, h, 0);
+        AVFrame *expected = av_frame_alloc();
+        AVFrame *outPic = av_frame_alloc();
+        for (AVFrame *f : {expected, outPic})
+        {
+            f->format = AV_PIX_FMT_YUV420P;
+            f->width = w;
+            f->height = h;
+            av_frame_get_buffer(f, 32);
+        }
+        string sizeName = std::to_string(w) + "x" + std::to_string(h);
+
+        for (auto &c : cases)
+        {
+            AVFrame *src = convertFrame(pattern, c.format);
+            auto sws = sws_getContext(w, h, c.format, w, h, AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr, nullptr,
+                                      nullptr);
+            sws_scale(sws, src->data, src->linesize, 0, h, expected->data, expected->linesize);
+            string prefix = string(av_get_pix_fmt_name(c.format)) + "_to_yuv420p_" + sizeName;
+            double bytes = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, w, h, 1);
+
+            runBench("pixel_convert", prefix + "_swscale", framesPerRun,
+                     [&]() {
+                         for (int i = 0; i < framesPerRun; i++)
+                         {
+                             sws_scale(sws, src->data, src->linesize, 0, h, outPic->data, outPic->linesize);
+                         }
+                     },
+                     bytes);
+
+            for (int k = 0; k < 3; k++)
+            {
+                PixelConvert::Fn fn = PixelConvert::find(c.format, isas[k]);
+                if (fn == nullptr)
+                {
+                    continue; // not built for / not supported by this CPU
+                }
+                string caseName = prefix + "_" + isaNames[k];
+
+                fn(src, outPic, w, h);
+                int maxDiff = 0;
+                for (int p = 0; p < 3; p++)
+                {
+                    int pw = p == 0 ? w : (w + 1) / 2;
+                    int ph = p == 0 ? h : (h + 1) / 2;
+                    for (int y = 0; y < ph; y++)
+                    {
+                        const uint8_t *a = expected->data[p] + y * expected->linesize[p];
+                        const uint8_t *b = outPic->data[p] + y * outPic->linesize[p];
+                        for (int x = 0; x < pw; x++)
+                        {
+                            maxDiff = std::max(maxDiff, std::abs(a[x] - b[x]));
+                        }
+                    }
+                }
+                bool pass = maxDiff <= c.tolerance;
+                ok = ok && pass;
+                std::fprintf(resultOut,
+                             "{\"bench\":\"pixel_convert\",\"case\":\"%s\",\"check\":\"swscale\","
+                             "\"max_abs_diff\":%d,\"tolerance\":%d,\"pass\":%s}\n",
+                             caseName.c_str(), maxDiff, c.tolerance, pass ? "true" : "false");
+
+                runBench("pixel_convert", caseName, framesPerRun,
+                         [&]() {
+                             for (int i = 0; i < framesPerRun; i++)
+                             {
+                                 fn(src, outPic, w, h);
+                             }
+                         },
+                         bytes);
+            }
+
+            sws_freeContext(sws);
+            av_frame_free(&src);
+        }
+        av_frame_free(&outPic);
+        av_frame_free(&expected);
+        av_frame_free(&pattern);
+    }
+    return ok;
+}
+
+// YUV420P -> model input tensors (-tensor), scalar reference vs SIMD, at typical model input sizes.
+// swscale to RGB24 is the baseline: it only gets the packed bytes, no planes, no normalization.
+bool benchTensorConvert()
+{
+    const int sizes[][2] = {{224, 224}, {640, 640}, {333, 201}}; // odd size: the scalar tails
+    const TensorConvert::Isa isas[] = {TensorConvert::SCALAR, TensorConvert::SSE2};
+    const char *isaNames[] = {"scalar", "sse2"};
+    const int framesPerRun = 50;
+    TensorConvert::Norm norm{};
+    const float mean[3] = {0.485f, 0.456f, 0.406f}, stdDev[3] = {0.229f, 0.224f, 0.225f};
+    for (int c = 0; c < 3; c++)
+    {
+        norm.mean[c] = mean[c];
+        norm.std[c] = stdDev[c];
+    }
+    bool ok = true;
+
+    for (auto &size : sizes)
+    {
+        int w = size[0];
+        int h = size[1];
+        AVFrame *src = makeTestPattern(w, h, 0);
+        string sizeName = std::to_string(w) + "x" + std::to_string(h);
+
+        AVFrame *rgb = av_frame_alloc();
+        rgb->format = AV_PIX_FMT_RGB24;
+        rgb->width = w;
+        rgb->height = h;
+        av_frame_get_buffer(rgb, 32);
+        auto sws = sws_getContext(w, h, AV_PIX_FMT_YUV420P, w, h, AV_PIX_FMT_RGB24, SWS_BILINEAR, nullptr, nullptr,
+                                  nullptr);
+        runBench("tensor_convert", "rgb24_" + sizeName + "_swscale", framesPerRun,
+                 [&]() {
+                     for (int i = 0; i < framesPerRun; i++)
+                     {
+                         sws_scale(sws, src->data, src->linesize, 0, h, rgb->data, rgb->linesize);
+                     }
+                 },
+                 (double)w * h * 3);
+        sws_freeContext(sws);
+        av_frame_free(&rgb);
+
+        for (auto layout : {TensorConvert::PLANAR_F32, TensorConvert::NHWC_U8})
+        {
+            bool f32 = layout == TensorConvert::PLANAR_F32;
+            size_t bytes = TensorConvert::frameBytes(layout, w, h);
+            std::vector<uint8_t> expected(bytes), out(bytes);
+            TensorConvert::find(layout, TensorConvert::SCALAR)(src, expected.data(), norm);
+            string prefix = string(f32 ? "f32_nchw_" : "u8_nhwc_") + sizeName;
+
+            for (int k = 0; k < 2; k++)
+            {
+                TensorConvert::Fn fn = TensorConvert::find(layout, isas[k]);
+                if (fn == nullptr)
+                {
+                    continue;
+                }
+                string caseName = prefix + "_" + isaNames[k];
+                std::fill(out.begin(), out.end(), 0);
+                fn(src, out.data(), norm);
+                double maxDiff = 0;
+                for (size_t i = 0; i < (f32 ? bytes / 4 : bytes); i++)
+                {
+                    double d = f32 ? std::fabs(((const float *)expected.data())[i] - ((const float *)out.data())[i])
+                                   : std::abs(expected[i] - out[i]);
+                    maxDiff = std::max(maxDiff, d);
+                }
+                double tolerance = f32 ? 1e-5 : 1; // U8: round half even vs half up
+                bool pass = maxDiff <= tolerance;
+                ok = ok && pass;
+                std::fprintf(resultOut,
+                             "{\"bench\":\"tensor_convert\",\"case\":\"%s\",\"check\":\"scalar\","
+                             "\"max_abs_diff\":%g,\"tolerance\":%g,\"pass\":%s}\n",
+                             caseName.c_str(), maxDiff, tolerance, pass ? "true" : "false");
+
+                runBench("tensor_convert", caseName, framesPerRun,
+                         [&]() {
+                             for (int i = 0; i < framesPerRun; i++)
+                             {
+                                 fn(src, out.data(), norm);
+                             }
+                         },
+                         (double)bytes);
+            }
+        }
+        av_frame_free(&src);
+    }
+    return ok;
+}
+
+// SceneDetector's per frame work: the 8x8 luma downsample and the SAD against the previous grid.
+// The SSE2 kernels must give exactly the scalar results (integer sums).
+bool benchSceneDetect()
+{
+    const int sizes[][2] = {{1920, 1080}, {1280, 720}, {1000, 562}}; // 1000 / 8: odd grid width, the tails
+    const char *isaNames[] = {"scalar", "sse2"};
+    const int framesPerRun = 50;
+    bool ok = true;
+
+    for (auto &size : sizes)
+    {
+        int w = size[0];
+        int h = size[1];
+        int gridW = w / 8;
+        int gridH = h / 8;
+        int n = gridW * gridH;
+        AVFrame *a = makeTestPattern(w, h, 0);
+        AVFrame *b = makeTestPattern(w, h, 12);
+        string sizeName = std::to_string(w) + "x" + std::to_string(h);
+
+        vector<uint8_t> expectedA(n), expectedB(n), gridA(n), gridB(n);
+        SceneDetector::downsample<false>(a->data[0], a->linesize[0], gridW, gridH, expectedA.data());
+        SceneDetector::downsample<false>(b->data[0], b->linesize[0], gridW, gridH, expectedB.data());
+        uint64_t expectedSad = SceneDetector::sad<false>(expectedA.data(), expectedB.data(), n);
+
+        for (int k = 0; k < 2; k++)
+        {
+            bool simd = k == 1;
+            auto downsample = simd ? SceneDetector::downsample<true> : SceneDetector::downsample<false>;
+            auto sad = simd ? SceneDetector::sad<true> : SceneDetector::sad<false>;
+            string caseName = sizeName + "_" + isaNames[k];
+
+            downsample(a->data[0], a->linesize[0], gridW, gridH, gridA.data());
+            downsample(b->data[0], b->linesize[0], gridW, gridH, gridB.data());
+            uint64_t got = sad(gridA.data(), gridB.data(), n);
+            bool pass = gridA == expectedA && gridB == expectedB && got == expectedSad;
+            ok = ok && pass;
+            std::fprintf(resultOut,
+                         "{\"bench\":\"scene_detect\",\"case\":\"%s\",\"check\":\"scalar\","
+                         "\"sad\":%llu,\"expected_sad\":%llu,\"pass\":%s}\n",
+                         caseName.c_str(), (unsigned long long)got, (unsigned long long)expectedSad,
+                         pass ? "true" : "false");
+
+            runBench("scene_detect", "downsample_" + caseName, framesPerRun,
+                     [&]() {
+                         for (int i = 0; i < framesPerRun; i++)
+                         {
+                             downsample(a->data[0], a->linesize[0], gridW, gridH, gridA.data());
+                         }
+                     },
+                     (double)w * h);
+            volatile uint64_t sink = 0;
+            runBench("scene_detect", "sad_" + caseName, framesPerRun, [&]() {
+                for (int i = 0; i < framesPerRun; i++)
+                {
+                    sink = sink + sad(gridA.data(), gridB.data(), n);
+                }
+            });
+        }
+        av_frame_free(&a);
+        av_frame_free(&b);
+    }
+    return ok;
+}
+
+// ShmFrameWriter::publish alone, then with a reader in another thread that follows the newest frame
+// and reads its luma in place, like player_shm_reader. The writer must not slow down with the reader.
+void benchShmRing()
+{
+#ifndef _WIN32
+    const int sizes[][2] = {{1280, 720}, {1920, 1080}};
+    const int framesPerRun = 50;
+
+    for (auto &size : sizes)
+    {
+        int w = size[0];
+        int h = size[1];
+        AVFrame *frame = makeTestPattern(w, h, 0);
+        string shmName = "/player_microbench_" + std::to_string(getpid());
+        ShmFrameWriter writer{shmName, 8, w, h};
+        string sizeName = std::to_string(w) + "x" + std::to_string(h);
+        double bytes = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, w, h, 1);
+
+        runBench("shm_ring", "publish_" + sizeName, framesPerRun,
+                 [&]() {
+                     for (int i = 0; i < framesPerRun; i++)
+                     {
+                         writer.publish(frame, i);
+                     }
+                 },
+                 bytes);
+
+        std::atomic<bool> stop{false};
+        uint64_t read = 0, torn = 0;
+        std::thread readerThread([&]() {
+            ShmFrameReader reader{shmName};
+            int64_t last = -1;
+            volatile uint64_t sink = 0;
+            while (!stop.load())
+            {
+                ShmFrameView view{};
+                if (!reader.acquire(last, view))
+                {
+                    continue;
+                }
+                uint64_t sum = 0;
+                for (int y = 0; y < view.height; y++)
+                {
+                    const uint8_t *row = view.data[0] + y * view.linesize[0];
+                    for (int x = 0; x < view.width; x++)
+                    {
+                        sum += row[x];
+                    }
+                }
+                sink = sum;
+                reader.validate(view) ? read++ : torn++;
+                last = (int64_t)view.frameNumber;
+            }
+            (void)sink;
+        });
+        uint64_t publishedBefore = writer.getPublished();
+        runBench("shm_ring", "publish_" + sizeName + "_with_reader", framesPerRun,
+                 [&]() {
+                     for (int i = 0; i < framesPerRun; i++)
+                     {
+                         writer.publish(frame, i);
+                     }
+                 },
+                 bytes);
+        stop = true;
+        readerThread.join();
+        std::fprintf(resultOut,
+                     "{\"bench\":\"shm_ring\",\"case\":\"reader_%s\",\"published\":%llu,\"read\":%llu,"
+                     "\"torn\":%llu}\n",
+                     sizeName.c_str(), (unsigned long long)(writer.getPublished() - publishedBefore),
+                     (unsigned long long)read, (unsigned long long)torn);
+        av_frame_free(&frame);
+    }
+#endif
+}
+
+void benchPacketQueue()
+{
+    const int count = 10000;
+
+    vector<AVPacket *> packets{};
+    for (int i = 0; i < count; i++)
+    {
+        packets.push_back(av_packet_alloc());
+    }
+
+    PacketQueue queue{};
+    runBench("packet_queue", "push_pop_single_thread", count, [&]() {
+        for (auto p : packets)
+        {
+            queue.push(PacketPtr(p));
+        }
+        PacketPtr pkt{};
+        for (int i = 0; i < count; i++)
+        {
+            queue.pop(pkt);
+            pkt.release();
+        }
+    });
+
+    runBench("packet_queue", "push_pop_two_threads", count, [&]() {
+        std::thread consumer{[&]() {
+            PacketPtr pkt{};
+            int received = 0;
+            while (received < count)
+            {
+                if (queue.pop(pkt))
+                {
+                    pkt.release();
+                    received++;
+                }
+                else
+                {
+                    std::this_thread::yield(); // empty, let the producer run
+                }
+            }
+        }};
+        for (auto p : packets)
+        {
+            queue.push(PacketPtr(p));
+        }
+        consumer.join();
+    });
+
+    for (auto p : packets)
+    {
+        av_packet_free(&p);
+    }
+}
+
+void benchInitCodec(const string &mediaPath)
+{
+    PacketGrabber grabber{mediaPath};
+    auto formatCtx = grabber.getFormatCtx();
+    const int opensPerRun = 20;
+
+    const int indexes[] = {grabber.getVideoIndex(), grabber.getAudioIndex()};
+    for (int index : indexes)
+    {
+        string caseName = avcodec_get_name(formatCtx->streams[index]->codecpar->codec_id);
+        runBench("init_codec", caseName, opensPerRun, [&]() {
+            for (int i = 0; i < opensPerRun; i++)
+            {
+                AVCodecContext *ctx = nullptr;
+                ffutils::initCodec(formatCtx, index, &ctx);
+                avcodec_free_context(&ctx);
+            }
+        });
+    }
+}
+
+// 0.5s to 1.5s of the test file: plain stream copy, and with the partial GOP encoded again.
+// mb_per_s is of the input read, open and seek included.
+void benchClipExtract(const string &mediaPath)
+{
+    TempFile clipFile{mediaPath + ".clip.mkv"};
+    const string &clipPath = clipFile.path;
+    for (bool reencode : {false, true})
+    {
+        uint64_t readBytes = 0;
+        auto cut = [&]() {
+            PacketGrabber grabber{mediaPath};
+            ClipExtractor clip{grabber, clipPath, 500, 1500, reencode};
+            readBytes = clip.run().readBytes;
+        };
+        cut();
+        runBench("clip_extract", reencode ? "reencode_head" : "stream_copy", 1, cut, (double)readBytes);
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    string tmpDir = "/tmp";
+    string outPath{};
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "-filter" && i + 1 < argc)
+        {
+            benchFilter = argv[++i];
+        }
+        else if (arg == "-repeats" && i + 1 < argc)
+        {
+            benchRepeats = std::max(1, std::stoi(argv[++i]));
+        }
+        else if (arg == "-o" && i + 1 < argc)
+        {
+            outPath = argv[++i];
+        }
+        else if (arg == "-tmp" && i + 1 < argc)
+        {
+            tmpDir = argv[++i];
+        }
+        else
+        {
+            std::cerr << "usage: player_microbench [-filter text] [-repeats n] [-o results.jsonl] [-tmp dir]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    if (!outPath.empty())
+    {
+        resultOut = std::fopen(outPath.c_str(), "w");
+        if (resultOut == nullptr)
+        {
+            std::cerr << "can not open " << outPath << std::endl;
+            return 1;
+        }
+    }
+
+    // keep stdout clean for the results.
+    Logger::instance().setLevel(Logger::LEVEL_OFF);
+    av_log_set_level(AV_LOG_ERROR);
+
+    auto stamp = std::chrono::system_clock::now().time_since_epoch().count();
+    TempFile media{tmpDir + "/player_microbench_" + std::to_string(stamp) + ".mkv"};
+    const string &mediaPath = media.path;
+    bool ok = false;
+    try
+    {
+        writeSyntheticMedia(mediaPath, 640, 360, 2);
+
+        benchReSample();
+        bool dspOk = benchAudioDsp();
+        benchSwsScale();
+        bool convertOk = benchPixelConvert();
+        bool tensorOk = benchTensorConvert();
+        bool sceneOk = benchSceneDetect();
+        benchShmRing();
+        benchPacketQueue();
+        benchInitCodec(mediaPath);
+        benchClipExtract(mediaPath);
+        ok = dspOk && convertOk && tensorOk && sceneOk;
+    }
+    catch (const std::exception &e)
+    {
+        // the log is off, say it here. The temp files are removed on the way out.
+        std::cerr << "microbench failed: " << e.what() << std::endl;
+    }
+
+    if (resultOut != stdout)
+    {
+        std::fclose(resultOut);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+#include "shmFrameRing.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+using std::string;
+#include <thread>
+
+// player_shm_reader: example consumer of the frames a player exports with -export-shm.
+//
+//   player -export-shm player_frames input.mp4 &
+//   player_shm_reader player_frames
+//
+// It follows the newest frame, reads its luma in place (the mean of the Y plane stands in for real
+// analytics) and checks the sequence lock afterwards. Once a second it prints what it got:
+// frames read, frames it was too slow for (missed), frames overwritten while it read them (torn).
+//
+// usage: player_shm_reader [-seconds n] [-work-us n] name
+//   -work-us: extra time spent per frame, to see a slow reader lose frames while the player does not care.
+
+int main(int argc, char *argv[])
+{
+    string name{};
+    int seconds = 0; // until the player exits
+    int workUs = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "-seconds" && i + 1 < argc)
+        {
+            seconds = std::stoi(argv[++i]);
+        }
+        else if (arg == "-work-us" && i + 1 < argc)
+        {
+            workUs = std::stoi(argv[++i]);
+        }
+        else if (name.empty() && arg[0] != '-')
+        {
+            name = arg;
+        }
+        else
+        {
+            std::cerr << "usage: player_shm_reader [-seconds n] [-work-us n] name" << std::endl;
+            return 1;
+        }
+    }
+    if (name.empty())
+    {
+        std::cerr << "usage: player_shm_reader [-seconds n] [-work-us n] name" << std::endl;
+        return 1;
+    }
+
+    ffmpegUtil::ShmFrameReader reader{name};
+
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    auto lastReport = start;
+    int64_t last = -1;
+    uint64_t read = 0, missed = 0, torn = 0, bytes = 0;
+    uint64_t totalRead = 0, totalMissed = 0, totalTorn = 0;
+    double meanLuma = 0;
+    int64_t ptsMs = 0;
+
+    while (seconds <= 0 || Clock::now() - start < std::chrono::seconds(seconds))
+    {
+        ffmpegUtil::ShmFrameView view{};
+        if (!reader.acquire(last, view))
+        {
+            if (!reader.isWriterAlive())
+            {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        uint64_t sum = 0;
+        for (int y = 0; y < view.height; y++)
+        {
+            const uint8_t *row = view.data[0] + y * view.linesize[0];
+            for (int x = 0; x < view.width; x++)
+            {
+                sum += row[x];
+            }
+        }
+        if (workUs > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(workUs));
+        }
+
+        if (!reader.validate(view))
+        {
+            torn++; // overwritten meanwhile, the result is thrown away
+        }
+        else
+        {
+            read++;
+            missed += last < 0 ? 0 : view.frameNumber - last - 1;
+            bytes += (uint64_t)view.width * view.height;
+            meanLuma = (double)sum / ((double)view.width * view.height);
+            ptsMs = view.ptsMs;
+        }
+        last = (int64_t)view.frameNumber;
+
+        auto now = Clock::now();
+        double sec = std::chrono::duration<double>(now - lastReport).count();
+        if (sec >= 1)
+        {
+            std::printf("shm reader: %.1f fps, %.1f MB/s, missed %llu, torn %llu, pts %lldms, mean luma %.1f\n",
+                        read / sec, bytes / sec / (1024 * 1024), (unsigned long long)missed,
+                        (unsigned long long)torn, (long long)ptsMs, meanLuma);
+            totalRead += read;
+            totalMissed += missed;
+            totalTorn += torn;
+            read = missed = torn = bytes = 0;
+            lastReport = now;
+        }
+    }
+
+    totalRead += read;
+    totalMissed += missed;
+    totalTorn += torn;
+    std::printf("shm reader: done, read %llu, missed %llu, torn %llu (player published %llu)\n",
+                (unsigned long long)totalRead, (unsigned long long)totalMissed, (unsigned long long)totalTorn,
+                (unsigned long long)reader.getPublished());
+    return 0;
+}
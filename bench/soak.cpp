@@ -0,0 +1,296 @@
+#include "playOptions.h"
+#include "playbackStats.h"
+#include "playerClock.h"
+#include "syntheticMedia.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+// player_soak: long-run A/V sync drift and memory growth check.
+//
+// Plays a file through the real play() pipeline with the SDL dummy video driver and a ScaledClock,
+// so an hour of content takes a few minutes. Every sample period (virtual time) it records the A/V
+// offset, dropped frames, audio underruns and RSS, and it fails (exit code 1) when the drift or the
+// memory growth after warm-up goes over the thresholds.
+//
+// Contention: -hog N runs N busy threads (nice 0, any core) next to the playback, to see what
+// other tenants do to the underruns and the drift, and whether -affinity / -rt-audio help.
+// Compare a run at -speed 1 with and without them.
+//
+// usage: player_soak [-speed x] [-generate seconds] [-size WxH] [-sample-ms ms] [-max-drift-ms ms]
+//                    [-max-growth-mb mb] [-max-underruns n] [-hog threads] [-affinity role=cpus:...]
+//                    [-rt-audio] [-csv file] [-tmp dir] [input]
+
+extern void playVideoWithAudio(const std::string &inputfile, const PlayOptions &opts);
+
+namespace
+{
+
+using std::string;
+using ffmpegUtil::PlaybackStats;
+using ffmpegUtil::PlayerClock;
+
+struct Sample
+{
+    double virtualSec;
+    int64_t videoPtsMs;
+    int64_t audioPtsMs;
+    int64_t avOffsetMs;
+    uint64_t presented;
+    uint64_t skipped;
+    uint64_t notReady;
+    uint64_t underruns;
+    long rssKb;
+};
+
+long currentRssKb()
+{
+#ifdef __linux__
+    long pages = 0;
+    long resident = 0;
+    FILE *f = std::fopen("/proc/self/statm", "r");
+    if (f != nullptr)
+    {
+        if (std::fscanf(f, "%ld %ld", &pages, &resident) != 2)
+        {
+            resident = 0;
+        }
+        std::fclose(f);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+    // no cheap current RSS on every platform, the peak is good enough to catch growth.
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024; // bytes on macOS
+#endif
+}
+
+Sample takeSample(PlayerClock &clock)
+{
+    auto &stats = PlaybackStats::instance();
+    Sample s{};
+    s.virtualSec = clock.nowUs() / 1e6;
+    s.videoPtsMs = stats.videoPtsMs.load();
+    s.audioPtsMs = stats.audioPtsMs.load();
+    s.avOffsetMs = stats.avOffsetMs.load();
+    s.presented = stats.framesPresented.load();
+    s.skipped = stats.framesSkipped.load();
+    s.notReady = stats.framesNotReady.load();
+    s.underruns = stats.audioUnderruns.load();
+    s.rssKb = currentRssKb();
+    return s;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    double speed = 20;
+    int generateSeconds = 0;
+    int width = 320;
+    int height = 180;
+    int sampleMs = 1000;
+    int64_t maxDriftMs = 100;
+    long maxGrowthMb = 32;
+    long maxUnderruns = -1;
+    int hogThreads = 0;
+    PlayOptions opts{};
+    string csvPath{};
+    string tmpDir = "/tmp";
+    string input{};
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-speed" && hasValue)
+        {
+            speed = std::stod(argv[++i]);
+        }
+        else if (arg == "-generate" && hasValue)
+        {
+            generateSeconds = std::stoi(argv[++i]);
+        }
+        else if (arg == "-size" && hasValue && std::sscanf(argv[i + 1], "%dx%d", &width, &height) == 2)
+        {
+            i++;
+        }
+        else if (arg == "-sample-ms" && hasValue)
+        {
+            sampleMs = std::max(10, std::stoi(argv[++i]));
+        }
+        else if (arg == "-max-drift-ms" && hasValue)
+        {
+            maxDriftMs = std::stoll(argv[++i]);
+        }
+        else if (arg == "-max-growth-mb" && hasValue)
+        {
+            maxGrowthMb = std::stol(argv[++i]);
+        }
+        else if (arg == "-max-underruns" && hasValue)
+        {
+            maxUnderruns = std::stol(argv[++i]);
+        }
+        else if (arg == "-hog" && hasValue)
+        {
+            hogThreads = std::stoi(argv[++i]);
+        }
+        else if (arg == "-affinity" && hasValue)
+        {
+            opts.affinity = argv[++i];
+        }
+        else if (arg == "-rt-audio")
+        {
+            opts.realtimeAudio = true;
+        }
+        else if (arg == "-csv" && hasValue)
+        {
+            csvPath = argv[++i];
+        }
+        else if (arg == "-tmp" && hasValue)
+        {
+            tmpDir = argv[++i];
+        }
+        else if (arg[0] != '-')
+        {
+            input = arg;
+        }
+        else
+        {
+            std::cerr << "unknown option: " << arg << std::endl;
+            return 2;
+        }
+    }
+
+    bool generated = input.empty();
+    if (generated)
+    {
+        if (generateSeconds <= 0)
+        {
+            generateSeconds = 3600;
+        }
+        input = tmpDir + "/player_soak_" + std::to_string(getpid()) + ".mkv";
+        std::cerr << "generating " << generateSeconds << "s of synthetic media: " << input << std::endl;
+        synthetic::writeSyntheticMedia(input, width, height, generateSeconds);
+    }
+
+    // the real pipeline, only without a screen and a sound card.
+    setenv("SDL_VIDEODRIVER", "dummy", 1);
+    setenv("SDL_AUDIODRIVER", "dummy", 1);
+
+    ffmpegUtil::ScaledClock clock{speed};
+    PlayerClock::install(&clock);
+    PlaybackStats::instance().reset();
+
+    std::vector<Sample> samples{};
+    std::atomic<bool> finished{false};
+    std::thread monitor{[&]() {
+        while (!finished.load())
+        {
+            clock.sleepForMs(sampleMs);
+            samples.push_back(takeSample(clock));
+        }
+    }};
+
+    // the hogs only compute, no memory traffic to speak of: this is about CPU time and scheduling.
+    std::vector<std::thread> hogs{};
+    for (int i = 0; i < hogThreads; i++)
+    {
+        hogs.emplace_back([&finished, i]() {
+            volatile double x = i + 1;
+            while (!finished.load(std::memory_order_relaxed))
+            {
+                for (int k = 0; k < 100000; k++)
+                {
+                    x = x * 1.0000001 + 1e-9;
+                }
+            }
+        });
+    }
+
+    auto realStart = std::chrono::steady_clock::now();
+    playVideoWithAudio(input, opts);
+    finished = true;
+    monitor.join();
+    for (auto &hog : hogs)
+    {
+        hog.join();
+    }
+    double realSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - realStart).count();
+
+    PlayerClock::install(nullptr);
+    if (generated)
+    {
+        std::remove(input.c_str());
+    }
+
+    FILE *csv = csvPath.empty() ? nullptr : std::fopen(csvPath.c_str(), "w");
+    if (csv != nullptr)
+    {
+        std::fprintf(csv, "virtual_s,video_pts_ms,audio_pts_ms,av_offset_ms,presented,skipped,not_ready,"
+                          "audio_underruns,rss_kb\n");
+        for (auto &s : samples)
+        {
+            std::fprintf(csv, "%.3f,%lld,%lld,%lld,%llu,%llu,%llu,%llu,%ld\n", s.virtualSec,
+                         (long long)s.videoPtsMs, (long long)s.audioPtsMs, (long long)s.avOffsetMs,
+                         (unsigned long long)s.presented, (unsigned long long)s.skipped,
+                         (unsigned long long)s.notReady, (unsigned long long)s.underruns, s.rssKb);
+        }
+        std::fclose(csv);
+    }
+
+    if (samples.size() < 2)
+    {
+        std::cerr << "SOAK FAIL: playback too short to sample" << std::endl;
+        return 1;
+    }
+
+    // the first 10% is warm-up: decoder start, first buffers, allocator high water marks.
+    size_t warmup = samples.size() / 10;
+    int64_t maxDrift = 0;
+    for (size_t i = warmup; i < samples.size(); i++)
+    {
+        maxDrift = std::max(maxDrift, std::abs(samples[i].avOffsetMs));
+    }
+    long growthKb = samples.back().rssKb - samples[warmup].rssKb;
+    const Sample &last = samples.back();
+
+    std::printf("soak: virtual %.1fs in %.1fs real (x%.1f), max |A/V offset| %lldms, RSS growth %ldKB, "
+                "presented %llu, skipped %llu, not ready %llu, audio underruns %llu, hog threads %d\n",
+                last.virtualSec, realSec, last.virtualSec / realSec, (long long)maxDrift, growthKb,
+                (unsigned long long)last.presented, (unsigned long long)last.skipped,
+                (unsigned long long)last.notReady, (unsigned long long)last.underruns, hogThreads);
+
+    bool ok = true;
+    if (maxDrift > maxDriftMs)
+    {
+        std::printf("SOAK FAIL: A/V drift %lldms > %lldms\n", (long long)maxDrift, (long long)maxDriftMs);
+        ok = false;
+    }
+    if (growthKb > maxGrowthMb * 1024)
+    {
+        std::printf("SOAK FAIL: memory growth %ldKB > %ldMB\n", growthKb, maxGrowthMb);
+        ok = false;
+    }
+    if (maxUnderruns >= 0 && (long)last.underruns > maxUnderruns)
+    {
+        std::printf("SOAK FAIL: audio underruns %llu > %ld\n", (unsigned long long)last.underruns, maxUnderruns);
+        ok = false;
+    }
+    if (ok)
+    {
+        std::printf("SOAK PASS\n");
+    }
+    return ok ? 0 : 1;
+}
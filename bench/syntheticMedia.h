@@ -0,0 +1,226 @@
+#pragma once
+
+#include "ffmpegUtil.h"
+
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+// Synthetic test media for the benchmarks and the soak harness: a testsrc-like pattern
+// and a sine tone, encoded with encoders built into every libavcodec. Nothing is checked in.
+namespace synthetic
+{
+
+using std::string;
+
+
+// moving diagonal gradient on luma with vertical color bars on chroma, like lavfi testsrc.
+inline AVFrame *makeTestPattern(int w, int h, int index)
+{
+    AVFrame *frame = av_frame_alloc();
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = w;
+    frame->height = h;
+    if (av_frame_get_buffer(frame, 32) < 0)
+    {
+        throw std::runtime_error("makeTestPattern: av_frame_get_buffer failed");
+    }
+    for (int y = 0; y < h; y++)
+    {
+        uint8_t *row = frame->data[0] + y * frame->linesize[0];
+        for (int x = 0; x < w; x++)
+        {
+            row[x] = (uint8_t)(x + y + index * 3);
+        }
+    }
+    for (int y = 0; y < h / 2; y++)
+    {
+        uint8_t *u = frame->data[1] + y * frame->linesize[1];
+        uint8_t *v = frame->data[2] + y * frame->linesize[2];
+        for (int x = 0; x < w / 2; x++)
+        {
+            int bar = x * 8 / (w / 2);
+            u[x] = (uint8_t)(bar * 32);
+            v[x] = (uint8_t)(255 - bar * 32);
+        }
+    }
+    frame->pts = index;
+    return frame;
+}
+
+inline AVFrame *convertFrame(const AVFrame *src, AVPixelFormat fmt)
+{
+    AVFrame *dst = av_frame_alloc();
+    dst->format = fmt;
+    dst->width = src->width;
+    dst->height = src->height;
+    if (av_frame_get_buffer(dst, 32) < 0)
+    {
+        throw std::runtime_error("convertFrame: av_frame_get_buffer failed");
+    }
+    auto sws = sws_getContext(src->width, src->height, (AVPixelFormat)src->format, dst->width, dst->height, fmt,
+                              SWS_POINT, nullptr, nullptr, nullptr);
+    sws_scale(sws, src->data, src->linesize, 0, src->height, dst->data, dst->linesize);
+    sws_freeContext(sws);
+    return dst;
+}
+
+// 440Hz sine, the same tone on every channel.
+inline AVFrame *makeSineFrame(AVSampleFormat fmt, uint64_t layout, int sampleRate, int nbSamples,
+                              int64_t firstSample)
+{
+    AVFrame *frame = av_frame_alloc();
+    frame->format = fmt;
+    frame->channel_layout = layout;
+    frame->channels = av_get_channel_layout_nb_channels(layout);
+    frame->sample_rate = sampleRate;
+    frame->nb_samples = nbSamples;
+    if (av_frame_get_buffer(frame, 0) < 0)
+    {
+        throw std::runtime_error("makeSineFrame: av_frame_get_buffer failed");
+    }
+
+    bool planar = av_sample_fmt_is_planar(fmt);
+    AVSampleFormat packedFmt = av_get_packed_sample_fmt(fmt);
+    int channels = frame->channels;
+    for (int i = 0; i < nbSamples; i++)
+    {
+        double v = 0.5 * std::sin(2 * M_PI * 440.0 * (firstSample + i) / sampleRate);
+        for (int ch = 0; ch < channels; ch++)
+        {
+            int plane = planar ? ch : 0;
+            int pos = planar ? i : i * channels + ch;
+            uint8_t *base = frame->extended_data[plane];
+            switch (packedFmt)
+            {
+            case AV_SAMPLE_FMT_U8:
+                base[pos] = (uint8_t)(128 + v * 127);
+                break;
+            case AV_SAMPLE_FMT_S16:
+                ((int16_t *)base)[pos] = (int16_t)(v * 32767);
+                break;
+            case AV_SAMPLE_FMT_S32:
+                ((int32_t *)base)[pos] = (int32_t)(v * 2147483647.0);
+                break;
+            case AV_SAMPLE_FMT_FLT:
+                ((float *)base)[pos] = (float)v;
+                break;
+            case AV_SAMPLE_FMT_DBL:
+                ((double *)base)[pos] = v;
+                break;
+            default:
+                throw std::runtime_error("makeSineFrame: unsupported sample format");
+            }
+        }
+    }
+    frame->pts = firstSample;
+    return frame;
+}
+
+inline void encodeAndWrite(AVFormatContext *oc, AVCodecContext *enc, AVStream *st, AVFrame *frame)
+{
+    if (avcodec_send_frame(enc, frame) < 0)
+    {
+        throw std::runtime_error("encodeAndWrite: avcodec_send_frame failed");
+    }
+    AVPacket *pkt = av_packet_alloc();
+    while (avcodec_receive_packet(enc, pkt) == 0)
+    {
+        av_packet_rescale_ts(pkt, enc->time_base, st->time_base);
+        pkt->stream_index = st->index;
+        av_interleaved_write_frame(oc, pkt);
+    }
+    av_packet_free(&pkt);
+}
+
+inline AVCodecContext *openEncoder(AVCodecID id, AVFormatContext *oc,
+                                   const std::function<void(AVCodecContext *)> &setup)
+{
+    AVCodec *codec = avcodec_find_encoder(id);
+    if (codec == nullptr)
+    {
+        throw std::runtime_error("openEncoder: encoder not found");
+    }
+    AVCodecContext *enc = avcodec_alloc_context3(codec);
+    setup(enc);
+    if (oc->oformat->flags & AVFMT_GLOBALHEADER)
+    {
+        enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    if (avcodec_open2(enc, codec, nullptr) < 0)
+    {
+        throw std::runtime_error(string("openEncoder: can not open ") + codec->name);
+    }
+    return enc;
+}
+
+// mpeg4 video + aac audio in matroska, both encoders are built into every libavcodec.
+inline void writeSyntheticMedia(const string &path, int w, int h, int seconds)
+{
+    const int fps = 25;
+    const int sampleRate = 48000;
+
+    AVFormatContext *oc = nullptr;
+    if (avformat_alloc_output_context2(&oc, nullptr, "matroska", path.c_str()) < 0)
+    {
+        throw std::runtime_error("writeSyntheticMedia: can not create output " + path);
+    }
+
+    AVCodecContext *venc = openEncoder(AV_CODEC_ID_MPEG4, oc, [&](AVCodecContext *c) {
+        c->width = w;
+        c->height = h;
+        c->pix_fmt = AV_PIX_FMT_YUV420P;
+        c->time_base = AVRational{1, fps};
+        c->framerate = AVRational{fps, 1};
+        c->gop_size = 12;
+        c->bit_rate = 2000000;
+    });
+    AVCodecContext *aenc = openEncoder(AV_CODEC_ID_AAC, oc, [&](AVCodecContext *c) {
+        c->sample_fmt = AV_SAMPLE_FMT_FLTP;
+        c->sample_rate = sampleRate;
+        c->channel_layout = AV_CH_LAYOUT_STEREO;
+        c->channels = 2;
+        c->time_base = AVRational{1, sampleRate};
+        c->bit_rate = 128000;
+    });
+
+    AVStream *vst = avformat_new_stream(oc, nullptr);
+    AVStream *ast = avformat_new_stream(oc, nullptr);
+    avcodec_parameters_from_context(vst->codecpar, venc);
+    avcodec_parameters_from_context(ast->codecpar, aenc);
+    vst->time_base = venc->time_base;
+    ast->time_base = aenc->time_base;
+
+    if (avio_open(&oc->pb, path.c_str(), AVIO_FLAG_WRITE) < 0 || avformat_write_header(oc, nullptr) < 0)
+    {
+        throw std::runtime_error("writeSyntheticMedia: can not write " + path);
+    }
+
+    int64_t samplesWritten = 0;
+    for (int i = 0; i < seconds * fps; i++)
+    {
+        AVFrame *v = makeTestPattern(w, h, i);
+        encodeAndWrite(oc, venc, vst, v);
+        av_frame_free(&v);
+
+        while (samplesWritten * fps < (int64_t)(i + 1) * sampleRate)
+        {
+            AVFrame *a = makeSineFrame(AV_SAMPLE_FMT_FLTP, AV_CH_LAYOUT_STEREO, sampleRate, aenc->frame_size,
+                                       samplesWritten);
+            encodeAndWrite(oc, aenc, ast, a);
+            samplesWritten += a->nb_samples;
+            av_frame_free(&a);
+        }
+    }
+    encodeAndWrite(oc, venc, vst, nullptr);
+    encodeAndWrite(oc, aenc, ast, nullptr);
+
+    av_write_trailer(oc);
+    avio_closep(&oc->pb);
+    avcodec_free_context(&venc);
+    avcodec_free_context(&aenc);
+    avformat_free_context(oc);
+}
+
+} // namespace synthetic
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define AUDIO_DSP_SSE2 1
+#endif
+
+namespace ffmpegUtil
+{
+
+// Last stage of the AudioProcessor: interleaved S16 (stereo or 5.1) in, interleaved out in the
+// device's sample format (S16 or float) and channel count. Downmix, volume (smoothed, no zipper
+// noise) and a peak limiter are fused: the buffer is walked in CHUNK frame blocks, each block is
+// mixed and scaled into stereo floats that stay in L1, its peak sets the limiter gain, then it is
+// written out saturated in the output format. So every sample is read and written once,
+// whatever is enabled, and SDL gets exactly what the device plays.
+class AudioDsp
+{
+public:
+    static const int CHUNK = 64; // frames
+
+    enum OutFormat
+    {
+        OUT_S16,
+        OUT_F32 // -1.0 .. 1.0
+    };
+
+private:
+    std::atomic<float> targetVolume{1.0f};
+    float volume = 1.0f;      // moves to targetVolume by at most volumeStep per chunk
+    float volumeStep = 1.0f;
+    float limiterGain = 1.0f; // attack within the chunk, release over releaseCoeff
+    float releaseCoeff = 1.0f;
+    bool limiterEnabled = true;
+    OutFormat outFormat = OUT_S16;
+    int outChannels = 2;
+
+    // 5.1 -> stereo, ITU coefficients normalised so a full scale input can not clip.
+    static constexpr float kFront = 1.0f / (1.0f + 2 * 0.7071f);
+    static constexpr float kCenter = 0.7071f * kFront;
+    static constexpr float kSurround = 0.7071f * kFront;
+
+    // -0.3 dBFS
+    static constexpr float CEILING = 32767.0f * 0.966f;
+
+    // frames -> stereo floats scaled by the volume ramp, returns the peak.
+    static float mixScalar(const int16_t *in, int channels, int frames, float *out, float v0, float dv)
+    {
+        float peak = 0;
+        for (int i = 0; i < frames; i++)
+        {
+            float l, r;
+            if (channels == 6)
+            {
+                const int16_t *s = in + i * 6; // FL FR FC LFE BL BR, LFE is dropped
+                l = s[0] * kFront + s[2] * kCenter + s[4] * kSurround;
+                r = s[1] * kFront + s[2] * kCenter + s[5] * kSurround;
+            }
+            else
+            {
+                l = in[i * 2];
+                r = in[i * 2 + 1];
+            }
+            float g = v0 + dv * i;
+            out[i * 2] = l * g;
+            out[i * 2 + 1] = r * g;
+            peak = std::max(peak, std::max(std::fabs(l * g), std::fabs(r * g)));
+        }
+        return peak;
+    }
+
+    // stereo floats -> channels of format. Mono gets the mid, more channels get the pair on front
+    // left / right and silence on the others.
+    static void writeScalar(const float *in, int frames, void *out, OutFormat format, int channels, float g0,
+                            float dg)
+    {
+        for (int i = 0; i < frames; i++)
+        {
+            float g = g0 + dg * i;
+            float l = in[i * 2] * g;
+            float r = in[i * 2 + 1] * g;
+            for (int c = 0; c < channels; c++)
+            {
+                float v = channels == 1 ? (l + r) * 0.5f : c == 0 ? l : c == 1 ? r : 0.0f;
+                if (format == OUT_F32)
+                {
+                    ((float *)out)[i * channels + c] = std::min(1.0f, std::max(-1.0f, v * (1.0f / 32768)));
+                }
+                else
+                {
+                    long s = std::lrint(v);
+                    ((int16_t *)out)[i * channels + c] = (int16_t)std::min(32767L, std::max(-32768L, s));
+                }
+            }
+        }
+    }
+
+#ifdef AUDIO_DSP_SSE2
+    static inline __m128 lowToFloat(__m128i v) { return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)); }
+    static inline __m128 highToFloat(__m128i v) { return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)); }
+
+    // [FL0 FR0 FC0 LFE0] [BL0 BR0 FL1 FR1] [FC1 LFE1 BL1 BR1] -> [L0 R0 L1 R1]
+    static inline __m128 downmixTwoFrames(__m128 a, __m128 b, __m128 c)
+    {
+        __m128 front = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 2, 1, 0));
+        __m128 center = _mm_shuffle_ps(a, c, _MM_SHUFFLE(0, 0, 2, 2));
+        __m128 back = _mm_shuffle_ps(b, c, _MM_SHUFFLE(3, 2, 1, 0));
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(front, _mm_set1_ps(kFront)), _mm_mul_ps(center, _mm_set1_ps(kCenter))),
+                          _mm_mul_ps(back, _mm_set1_ps(kSurround)));
+    }
+
+    static float mixSse2(const int16_t *in, int channels, int frames, float *out, float v0, float dv)
+    {
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        // per lane frame offset: frames (0, 0, 1, 1), the two frames of one vector.
+        const __m128 laneFrame = _mm_set_ps(1, 1, 0, 0);
+        __m128 peak = _mm_setzero_ps();
+        int i = 0;
+        for (; i + 4 <= frames; i += 4)
+        {
+            __m128 lo, hi; // frames i, i+1 and i+2, i+3 as L R L R
+            if (channels == 6)
+            {
+                const __m128i *src = (const __m128i *)(in + i * 6);
+                __m128i x0 = _mm_loadu_si128(src);
+                __m128i x1 = _mm_loadu_si128(src + 1);
+                __m128i x2 = _mm_loadu_si128(src + 2);
+                lo = downmixTwoFrames(lowToFloat(x0), highToFloat(x0), lowToFloat(x1));
+                hi = downmixTwoFrames(highToFloat(x1), lowToFloat(x2), highToFloat(x2));
+            }
+            else
+            {
+                __m128i x = _mm_loadu_si128((const __m128i *)(in + i * 2));
+                lo = lowToFloat(x);
+                hi = highToFloat(x);
+            }
+            __m128 gLo = _mm_add_ps(_mm_set1_ps(v0 + dv * i), _mm_mul_ps(laneFrame, _mm_set1_ps(dv)));
+            __m128 gHi = _mm_add_ps(gLo, _mm_set1_ps(2 * dv));
+            lo = _mm_mul_ps(lo, gLo);
+            hi = _mm_mul_ps(hi, gHi);
+            _mm_storeu_ps(out + i * 2, lo);
+            _mm_storeu_ps(out + i * 2 + 4, hi);
+            peak = _mm_max_ps(peak, _mm_max_ps(_mm_and_ps(lo, absMask), _mm_and_ps(hi, absMask)));
+        }
+        peak = _mm_max_ps(peak, _mm_shuffle_ps(peak, peak, _MM_SHUFFLE(1, 0, 3, 2)));
+        peak = _mm_max_ps(peak, _mm_shuffle_ps(peak, peak, _MM_SHUFFLE(2, 3, 0, 1)));
+        float result = _mm_cvtss_f32(peak);
+        if (i < frames)
+        {
+            result = std::max(result, mixScalar(in + i * channels, channels, frames - i, out + i * 2, v0 + dv * i, dv));
+        }
+        return result;
+    }
+
+    static void writeS16Sse2(const float *in, int frames, int16_t *out, float g0, float dg)
+    {
+        const __m128 laneFrame = _mm_set_ps(1, 1, 0, 0);
+        int i = 0;
+        for (; i + 4 <= frames; i += 4)
+        {
+            __m128 gLo = _mm_add_ps(_mm_set1_ps(g0 + dg * i), _mm_mul_ps(laneFrame, _mm_set1_ps(dg)));
+            __m128 gHi = _mm_add_ps(gLo, _mm_set1_ps(2 * dg));
+            __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i * 2), gLo));
+            __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i * 2 + 4), gHi));
+            _mm_storeu_si128((__m128i *)(out + i * 2), _mm_packs_epi32(lo, hi)); // saturates
+        }
+        if (i < frames)
+        {
+            writeScalar(in + i * 2, frames - i, out + i * 2, OUT_S16, 2, g0 + dg * i, dg);
+        }
+    }
+
+    static void writeF32Sse2(const float *in, int frames, float *out, float g0, float dg)
+    {
+        const __m128 laneFrame = _mm_set_ps(1, 1, 0, 0);
+        const __m128 scale = _mm_set1_ps(1.0f / 32768);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 minusOne = _mm_set1_ps(-1.0f);
+        int i = 0;
+        for (; i + 4 <= frames; i += 4)
+        {
+            __m128 gLo = _mm_add_ps(_mm_set1_ps(g0 + dg * i), _mm_mul_ps(laneFrame, _mm_set1_ps(dg)));
+            __m128 gHi = _mm_add_ps(gLo, _mm_set1_ps(2 * dg));
+            __m128 lo = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(in + i * 2), gLo), scale);
+            __m128 hi = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(in + i * 2 + 4), gHi), scale);
+            _mm_storeu_ps(out + i * 2, _mm_min_ps(one, _mm_max_ps(minusOne, lo)));
+            _mm_storeu_ps(out + i * 2 + 4, _mm_min_ps(one, _mm_max_ps(minusOne, hi)));
+        }
+        if (i < frames)
+        {
+            writeScalar(in + i * 2, frames - i, out + i * 2, OUT_F32, 2, g0 + dg * i, dg);
+        }
+    }
+#endif
+
+    template <bool SIMD> int run(const int16_t *data, int channels, int frames, void *out)
+    {
+        alignas(16) float mixed[CHUNK * 2];
+        float target = targetVolume.load(std::memory_order_relaxed);
+        for (int done = 0; done < frames; done += CHUNK)
+        {
+            int n = frames - done < CHUNK ? frames - done : CHUNK;
+
+            float v1 = volume < target ? std::min(target, volume + volumeStep) : std::max(target, volume - volumeStep);
+            float dv = (v1 - volume) / n;
+#ifdef AUDIO_DSP_SSE2
+            float peak = SIMD ? mixSse2(data + done * channels, channels, n, mixed, volume, dv)
+                              : mixScalar(data + done * channels, channels, n, mixed, volume, dv);
+#else
+            float peak = mixScalar(data + done * channels, channels, n, mixed, volume, dv);
+#endif
+            volume = v1;
+
+            // attack: the whole chunk at the gain that keeps its peak under the ceiling (the peak is
+            // known before anything is written, a chunk of lookahead). release: ramp up, never above it.
+            float g0 = 1.0f;
+            float g1 = 1.0f;
+            if (limiterEnabled)
+            {
+                float allowed = peak > CEILING ? CEILING / peak : 1.0f;
+                if (allowed < limiterGain)
+                {
+                    g0 = g1 = allowed;
+                }
+                else
+                {
+                    g0 = limiterGain;
+                    g1 = std::min(allowed, limiterGain + (1.0f - limiterGain) * releaseCoeff);
+                }
+                limiterGain = g1;
+            }
+
+            // in place: an output frame that is not larger than an input frame only overwrites
+            // data already read.
+            uint8_t *dst = (uint8_t *)out + (size_t)done * getOutFrameBytes();
+#ifdef AUDIO_DSP_SSE2
+            if (SIMD && outChannels == 2)
+            {
+                if (outFormat == OUT_F32)
+                {
+                    writeF32Sse2(mixed, n, (float *)dst, g0, (g1 - g0) / n);
+                }
+                else
+                {
+                    writeS16Sse2(mixed, n, (int16_t *)dst, g0, (g1 - g0) / n);
+                }
+                continue;
+            }
+#endif
+            writeScalar(mixed, n, dst, outFormat, outChannels, g0, (g1 - g0) / n);
+        }
+        return frames * getOutFrameBytes();
+    }
+
+public:
+    explicit AudioDsp(int sampleRate)
+    {
+        // volume: 0 -> 1 in 20ms, limiter release: 100ms time constant.
+        volumeStep = CHUNK / (0.02f * sampleRate);
+        releaseCoeff = 1.0f - std::exp(-CHUNK / (0.1f * sampleRate));
+    }
+
+    // 1.0 is unity gain, applied smoothly from the next buffer on. Any thread.
+    void setVolume(float v) { targetVolume.store(std::max(0.0f, v), std::memory_order_relaxed); }
+    float getVolume() const { return targetVolume.load(std::memory_order_relaxed); }
+
+    void setLimiterEnabled(bool enabled) { limiterEnabled = enabled; }
+
+    // what process() writes, S16 stereo by default. Not while process() runs.
+    void setOutput(OutFormat format, int channels)
+    {
+        outFormat = format;
+        outChannels = std::max(1, channels);
+    }
+
+    int getOutFrameBytes() const { return outChannels * (outFormat == OUT_F32 ? 4 : 2); }
+
+    // channels: 2 or 6 (5.1). out may be data when an output frame is not larger than an input
+    // frame (S16, at most as many channels). Returns the output size in bytes.
+    int process(const int16_t *data, int channels, int frames, void *out)
+    {
+#ifdef AUDIO_DSP_SSE2
+        return run<true>(data, channels, frames, out);
+#else
+        return run<false>(data, channels, frames, out);
+#endif
+    }
+
+    // same result without SIMD, the reference for the benchmark.
+    int processScalar(const int16_t *data, int channels, int frames, void *out)
+    {
+        return run<false>(data, channels, frames, out);
+    }
+};
+
+} // namespace ffmpegUtil
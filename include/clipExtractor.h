@@ -0,0 +1,462 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+#include <libavutil/pixdesc.h>
+#ifdef __cplusplus
+};
+#endif
+
+#include "ffmpegUtil.h"
+#include "traceRecorder.h"
+
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace ffmpegUtil
+{
+
+// Cuts [startMs, endMs) out of a file into a new container without decoding it (-clip out.mkv).
+// The packets of the streams selected on the PacketGrabber are copied, with their timestamps
+// rebased so the clip starts at 0. Times are relative to the start of the file.
+//
+// Stream copy can only start at a keyframe, so the clip starts at the last keyframe at or before
+// startMs: up to one GOP early, but the speed is the speed of the disk. With reencodeHead the clip
+// starts exactly at startMs. The frames from startMs up to the next keyframe (the partial GOP) are
+// decoded and encoded again with the stream's codec, and everything from that keyframe on is
+// copied. The encoded pictures carry their own parameter sets in band (no global header), which
+// only mixes with copied packets that are in band as well: H.264 / HEVC from MPEG-TS style input,
+// or codecs without parameter sets in the extradata. For length prefixed (MP4 / Matroska) H.264 /
+// HEVC input the head is not encoded, and the clip starts at the keyframe.
+//
+// The end is cut in decode order: packets with dts < endMs are kept. Every kept picture then has
+// its references, and a few frames past endMs may remain.
+class ClipExtractor
+{
+public:
+    struct Result
+    {
+        int64_t startMs = 0;       // where the clip really starts in the input
+        uint64_t packets = 0;      // written, copied and encoded
+        uint64_t headFrames = 0;   // encoded again
+        uint64_t readBytes = 0;    // of the input, from the seek on
+        uint64_t writtenBytes = 0;
+        double headSec = 0;        // decoding and encoding the partial GOP
+        double wallSec = 0;
+    };
+
+private:
+    struct OutStream
+    {
+        AVStream *in = nullptr;
+        AVStream *out = nullptr;        // nullptr: not in the clip
+        int64_t offset = 0;             // clip start, input time base
+        int64_t endTs = INT64_MAX;      // input time base
+        int64_t lastDts = INT64_MIN;    // output time base
+        bool done = false;
+    };
+
+    PacketGrabber &grabber;
+    const string outPath;
+    const int64_t startMs;
+    const int64_t endMs;
+    bool reencodeHead;
+    int anchor; // the seek and the clip start go by this stream: video, audio when there is none
+    std::vector<OutStream> streams{}; // by input stream index
+    AVFormatContext *outCtx = nullptr;
+    AVCodecContext *decoder = nullptr;
+    AVCodecContext *encoder = nullptr;
+    Result result{};
+
+    static int64_t packetPts(const AVPacket *pkt) { return pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts; }
+
+    static void fail(const string &errMsg)
+    {
+        logError("%s", errMsg.c_str());
+        throw std::runtime_error(errMsg);
+    }
+
+    // ms from the start of the file -> timestamp of the stream.
+    int64_t toStreamTs(int64_t ms, const AVStream *stream) const
+    {
+        int64_t fileStart = grabber.getFormatCtx()->start_time;
+        int64_t us = ms * 1000 + (fileStart != AV_NOPTS_VALUE ? fileStart : 0);
+        return av_rescale_q(us, AVRational{1, AV_TIME_BASE}, stream->time_base);
+    }
+
+    int64_t toMs(int64_t ts, const AVStream *stream) const
+    {
+        int64_t fileStart = grabber.getFormatCtx()->start_time;
+        int64_t us = av_rescale_q(ts, stream->time_base, AVRational{1, AV_TIME_BASE});
+        return (us - (fileStart != AV_NOPTS_VALUE ? fileStart : 0)) / 1000;
+    }
+
+    // decoder and encoder of the partial GOP, false when the codec can not be encoded here.
+    bool openHeadCodecs()
+    {
+        auto formatCtx = grabber.getFormatCtx();
+        int videoIndex = grabber.getVideoIndex();
+        AVStream *in = formatCtx->streams[videoIndex];
+        AVCodec *codec = avcodec_find_encoder(in->codecpar->codec_id);
+        if (codec == nullptr)
+        {
+            logWarn("clip: no %s encoder, the clip starts at the keyframe", avcodec_get_name(in->codecpar->codec_id));
+            return false;
+        }
+        const AVCodecParameters *par = in->codecpar;
+        if ((par->codec_id == AV_CODEC_ID_H264 || par->codec_id == AV_CODEC_ID_HEVC) && par->extradata_size > 0 &&
+            par->extradata[0] == 1)
+        {
+            logWarn("clip: %s packets are length prefixed, encoded ones would not fit, the clip starts at the keyframe",
+                    avcodec_get_name(par->codec_id));
+            return false;
+        }
+        ffutils::initCodec(formatCtx, videoIndex, &decoder);
+
+        encoder = avcodec_alloc_context3(codec);
+        encoder->width = decoder->width;
+        encoder->height = decoder->height;
+        encoder->pix_fmt = decoder->pix_fmt;
+        encoder->sample_aspect_ratio = decoder->sample_aspect_ratio;
+        encoder->color_range = decoder->color_range;
+        encoder->colorspace = decoder->colorspace;
+        encoder->color_primaries = decoder->color_primaries;
+        encoder->color_trc = decoder->color_trc;
+        encoder->time_base = in->time_base; // the frames keep their input timestamps
+        encoder->framerate = in->avg_frame_rate;
+        encoder->bit_rate = in->codecpar->bit_rate > 0 ? in->codecpar->bit_rate : formatCtx->bit_rate;
+        encoder->max_b_frames = 0; // dts == pts, the copied keyframe follows the last one directly
+        if (avcodec_open2(encoder, codec, nullptr) < 0)
+        {
+            logWarn("clip: can not open the %s encoder for %dx%d %s, the clip starts at the keyframe", codec->name,
+                    decoder->width, decoder->height, av_get_pix_fmt_name(decoder->pix_fmt));
+            avcodec_free_context(&encoder);
+            avcodec_free_context(&decoder);
+            return false;
+        }
+        return true;
+    }
+
+    void openOutput()
+    {
+        if (avformat_alloc_output_context2(&outCtx, nullptr, nullptr, outPath.c_str()) < 0 || outCtx == nullptr)
+        {
+            fail("clip: can not create output " + outPath);
+        }
+        auto formatCtx = grabber.getFormatCtx();
+        streams.resize(formatCtx->nb_streams);
+        for (int index : {grabber.getVideoIndex(), grabber.getAudioIndex()})
+        {
+            if (index < 0)
+            {
+                continue;
+            }
+            OutStream &s = streams[index];
+            s.in = formatCtx->streams[index];
+            s.out = avformat_new_stream(outCtx, nullptr);
+            if (s.out == nullptr || avcodec_parameters_copy(s.out->codecpar, s.in->codecpar) < 0)
+            {
+                fail("clip: can not add stream " + std::to_string(index) + " to " + outPath);
+            }
+            s.out->codecpar->codec_tag = 0; // the output container picks its own
+            s.out->time_base = s.in->time_base;
+            s.out->sample_aspect_ratio = s.in->sample_aspect_ratio;
+            if (endMs > 0)
+            {
+                s.endTs = toStreamTs(endMs, s.in);
+            }
+        }
+        if (!(outCtx->oformat->flags & AVFMT_NOFILE) && avio_open(&outCtx->pb, outPath.c_str(), AVIO_FLAG_WRITE) < 0)
+        {
+            fail("clip: can not open " + outPath);
+        }
+        // copied B-frames start with a dts before 0.
+        outCtx->avoid_negative_ts = AVFMT_AVOID_NEG_TS_MAKE_ZERO;
+        if (avformat_write_header(outCtx, nullptr) < 0)
+        {
+            fail("clip: can not write the header of " + outPath);
+        }
+    }
+
+    // leaves the demuxer before the anchor's last keyframe at or before ts, returns that keyframe's pts.
+    int64_t seekToKeyframe(int64_t ts)
+    {
+        auto formatCtx = grabber.getFormatCtx();
+        AVStream *stream = formatCtx->streams[anchor];
+        int64_t fiveSec = av_rescale_q(5000, AVRational{1, 1000}, stream->time_base);
+        int64_t first = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+        PacketPtr pkt{av_packet_alloc()};
+        // some demuxers land after the target, go further back and finally to the start.
+        for (int64_t target : {ts, ts - fiveSec, first})
+        {
+            if (av_seek_frame(formatCtx, anchor, target, AVSEEK_FLAG_BACKWARD) < 0)
+            {
+                continue;
+            }
+            int64_t keyPts = AV_NOPTS_VALUE;
+            while (keyPts == AV_NOPTS_VALUE && av_read_frame(formatCtx, pkt.get()) >= 0)
+            {
+                if (pkt->stream_index == anchor && (pkt->flags & AV_PKT_FLAG_KEY))
+                {
+                    keyPts = packetPts(pkt.get());
+                }
+                av_packet_unref(pkt.get());
+            }
+            av_seek_frame(formatCtx, anchor, target, AVSEEK_FLAG_BACKWARD);
+            if (keyPts != AV_NOPTS_VALUE && (keyPts <= ts || target == first))
+            {
+                return keyPts;
+            }
+        }
+        fail("clip: can not seek to " + std::to_string(startMs) + "ms in the input");
+        return AV_NOPTS_VALUE;
+    }
+
+    // rebases a packet of the input (or of the encoder, same time base) and hands it to the muxer.
+    void writePacket(AVPacket *pkt, int inIndex)
+    {
+        OutStream &s = streams[inIndex];
+        if (pkt->pts != AV_NOPTS_VALUE)
+        {
+            pkt->pts -= s.offset;
+        }
+        if (pkt->dts != AV_NOPTS_VALUE)
+        {
+            pkt->dts -= s.offset;
+        }
+        pkt->pos = -1;
+        pkt->stream_index = s.out->index;
+        av_packet_rescale_ts(pkt, s.in->time_base, s.out->time_base);
+        // where the encoded head meets the copied keyframe, a reordering delay can put the
+        // keyframe's dts on the head's last one.
+        if (pkt->dts != AV_NOPTS_VALUE && s.lastDts != INT64_MIN && pkt->dts <= s.lastDts)
+        {
+            pkt->dts = s.lastDts + 1;
+            if (pkt->pts != AV_NOPTS_VALUE && pkt->pts < pkt->dts)
+            {
+                pkt->pts = pkt->dts;
+            }
+        }
+        if (pkt->dts != AV_NOPTS_VALUE)
+        {
+            s.lastDts = pkt->dts;
+        }
+        result.packets++;
+        if (av_interleaved_write_frame(outCtx, pkt) < 0)
+        {
+            fail("clip: can not write to " + outPath);
+        }
+    }
+
+    void drainEncoder(AVPacket *pkt)
+    {
+        while (avcodec_receive_packet(encoder, pkt) == 0)
+        {
+            writePacket(pkt, grabber.getVideoIndex());
+        }
+    }
+
+    // decodes a packet of the partial GOP (nullptr: the end of it), the frames in
+    // [startTs, headEnd) are encoded again.
+    void decodeHead(const AVPacket *in, AVFrame *frame, AVPacket *out, int64_t startTs, int64_t headEnd)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        TraceScope trace("clip head");
+        // the frames are drained after every packet, EAGAIN can not happen.
+        avcodec_send_packet(decoder, in);
+        const OutStream &s = streams[grabber.getVideoIndex()];
+        while (avcodec_receive_frame(decoder, frame) == 0)
+        {
+            int64_t pts = frame->pts != AV_NOPTS_VALUE ? frame->pts : frame->best_effort_timestamp;
+            if (pts >= startTs && pts < headEnd && pts < s.endTs)
+            {
+                frame->pts = pts;
+                frame->pict_type = AV_PICTURE_TYPE_NONE; // the encoder decides, its first one is a keyframe
+                if (avcodec_send_frame(encoder, frame) < 0)
+                {
+                    fail("clip: can not encode the frames before the first keyframe");
+                }
+                result.headFrames++;
+                drainEncoder(out);
+            }
+            av_frame_unref(frame);
+        }
+        if (in == nullptr)
+        {
+            avcodec_send_frame(encoder, nullptr);
+            drainEncoder(out);
+        }
+        result.headSec += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+public:
+    // grabber: the input, with the streams to copy selected (selectStreams).
+    // endMs <= 0: to the end of the file.
+    ClipExtractor(PacketGrabber &input, const string &outputPath, int64_t clipStartMs, int64_t clipEndMs,
+                  bool reencode)
+        : grabber(input), outPath(outputPath), startMs(clipStartMs), endMs(clipEndMs),
+          reencodeHead(reencode && input.getVideoIndex() >= 0 && clipStartMs > 0),
+          anchor(input.getVideoIndex() >= 0 ? input.getVideoIndex() : input.getAudioIndex())
+    {
+        if (anchor < 0)
+        {
+            fail("clip: no stream selected");
+        }
+        if (endMs > 0 && endMs <= startMs)
+        {
+            fail("clip: the end " + std::to_string(endMs) + "ms is not after the start " + std::to_string(startMs) +
+                 "ms");
+        }
+    }
+
+    ClipExtractor(const ClipExtractor &) = delete;
+    ClipExtractor &operator=(const ClipExtractor &) = delete;
+
+    ~ClipExtractor()
+    {
+        if (outCtx != nullptr)
+        {
+            if (!(outCtx->oformat->flags & AVFMT_NOFILE))
+            {
+                avio_closep(&outCtx->pb);
+            }
+            avformat_free_context(outCtx);
+        }
+        avcodec_free_context(&encoder);
+        avcodec_free_context(&decoder);
+        logDebug("~ClipExtractor called.");
+    }
+
+    Result run()
+    {
+        auto begin = std::chrono::steady_clock::now();
+        auto formatCtx = grabber.getFormatCtx();
+        if (reencodeHead)
+        {
+            reencodeHead = openHeadCodecs();
+        }
+        openOutput();
+
+        const int videoIndex = grabber.getVideoIndex();
+        const int64_t startTs = toStreamTs(startMs, formatCtx->streams[anchor]);
+        int64_t floorPts = startMs > 0 ? seekToKeyframe(startTs) : INT64_MIN;
+        int64_t readStart = formatCtx->pb != nullptr ? avio_tell(formatCtx->pb) : 0;
+
+        PacketPtr pkt{av_packet_alloc()};
+        PacketPtr encoded{av_packet_alloc()};
+        FramePtr frame{av_frame_alloc()};
+        int64_t keyPts = AV_NOPTS_VALUE;     // where the copy starts
+        int64_t nextKeyPts = AV_NOPTS_VALUE; // where the partial GOP ends
+        bool head = false;
+        PacketPtr nextKey{}; // copied, but written after the encoded head
+        int open = (videoIndex >= 0) + (grabber.getAudioIndex() >= 0);
+        uint64_t packetBytes = 0;
+        while (open > 0 && grabber.grabPacket(pkt.get()) >= 0)
+        {
+            packetBytes += pkt->size;
+            OutStream &s = streams[pkt->stream_index];
+            int64_t pts = packetPts(pkt.get());
+            bool key = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+            if (s.out == nullptr || s.done)
+            {
+                av_packet_unref(pkt.get());
+                continue;
+            }
+            if (keyPts == AV_NOPTS_VALUE)
+            {
+                if (pkt->stream_index != anchor || !key || pts < floorPts)
+                {
+                    av_packet_unref(pkt.get()); // before the keyframe the seek found
+                    continue;
+                }
+                keyPts = pts;
+                head = reencodeHead && keyPts < startTs;
+                int64_t clipStart = head ? startTs : keyPts;
+                for (OutStream &o : streams)
+                {
+                    if (o.out != nullptr)
+                    {
+                        o.offset = av_rescale_q(clipStart, formatCtx->streams[anchor]->time_base, o.in->time_base);
+                    }
+                }
+                result.startMs = toMs(clipStart, formatCtx->streams[anchor]);
+            }
+            if (pkt->dts != AV_NOPTS_VALUE && pkt->dts >= s.endTs)
+            {
+                s.done = true;
+                open--;
+                av_packet_unref(pkt.get());
+                continue;
+            }
+
+            if (head && pkt->stream_index == videoIndex)
+            {
+                if (nextKeyPts == AV_NOPTS_VALUE && key && pts > keyPts)
+                {
+                    nextKeyPts = pts;
+                }
+                // the next keyframe and its leading pictures are decoded as well: those are
+                // before it, they belong to the head.
+                if (nextKeyPts == AV_NOPTS_VALUE || pts <= nextKeyPts)
+                {
+                    if (pts == nextKeyPts)
+                    {
+                        nextKey.reset(av_packet_clone(pkt.get()));
+                    }
+                    decodeHead(pkt.get(), frame.get(), encoded.get(), startTs,
+                               nextKeyPts != AV_NOPTS_VALUE ? nextKeyPts : INT64_MAX);
+                    av_packet_unref(pkt.get());
+                    continue;
+                }
+                decodeHead(nullptr, frame.get(), encoded.get(), startTs, nextKeyPts);
+                head = false;
+                if (nextKey != nullptr)
+                {
+                    writePacket(nextKey.get(), videoIndex);
+                }
+            }
+
+            if (pts != AV_NOPTS_VALUE && pts < s.offset)
+            {
+                av_packet_unref(pkt.get()); // before the clip, or a leading picture of the first keyframe
+                continue;
+            }
+            writePacket(pkt.get(), pkt->stream_index);
+        }
+        if (head)
+        {
+            decodeHead(nullptr, frame.get(), encoded.get(), startTs,
+                       nextKeyPts != AV_NOPTS_VALUE ? nextKeyPts : INT64_MAX);
+            if (nextKey != nullptr)
+            {
+                writePacket(nextKey.get(), videoIndex);
+            }
+        }
+        if (keyPts == AV_NOPTS_VALUE)
+        {
+            fail("clip: no keyframe after " + std::to_string(startMs) + "ms");
+        }
+
+        if (av_write_trailer(outCtx) < 0)
+        {
+            fail("clip: can not finish " + outPath);
+        }
+        result.readBytes = formatCtx->pb != nullptr ? (uint64_t)(avio_tell(formatCtx->pb) - readStart) : packetBytes;
+        result.writtenBytes = outCtx->pb != nullptr ? (uint64_t)avio_tell(outCtx->pb) : 0;
+        if (!(outCtx->oformat->flags & AVFMT_NOFILE))
+        {
+            avio_closep(&outCtx->pb);
+        }
+        result.wallSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        return result;
+    }
+};
+
+} // namespace ffmpegUtil
@@ -26,7 +26,11 @@ extern "C"
 #endif
 #endif
 
+#include "framePool.h"
+#include "logger.h"
+
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <tuple>
@@ -38,9 +42,25 @@ using std::endl;
 using std::string;
 using std::stringstream;
 
+// packets are allocated with av_packet_alloc() and always released with av_packet_free().
+struct AVPacketDeleter
+{
+    void operator()(AVPacket *pkt) const { av_packet_free(&pkt); }
+};
+using PacketPtr = std::unique_ptr<AVPacket, AVPacketDeleter>;
+
+struct AVFrameDeleter
+{
+    void operator()(AVFrame *frame) const { av_frame_free(&frame); }
+};
+using FramePtr = std::unique_ptr<AVFrame, AVFrameDeleter>;
+
 struct ffutils
 {
-    static void initCodec(AVFormatContext *formatCtx, int streamIndex, AVCodecContext **avCodecContext)
+    // lowDelay: live sources, output every frame as soon as it is decoded (no frame threading delay).
+    // threads: decoder threads, 0 lets libavcodec decide.
+    static void initCodec(AVFormatContext *formatCtx, int streamIndex, AVCodecContext **avCodecContext,
+                          bool lowDelay = false, int threads = 0)
     {
         string codecType{};
         switch (formatCtx->streams[streamIndex]->codec->codec_type)
@@ -62,7 +82,7 @@ struct ffutils
         {
             string errMsg = "Could not find codec";
             errMsg += (*avCodecContext)->codec_id;
-            cout << errMsg << endl;
+            logError("%s", errMsg.c_str());
             throw std::runtime_error(errMsg);
         }
 
@@ -74,19 +94,38 @@ struct ffutils
         {
             string errorMsg = "Could not copy codec context";
             errorMsg += codec->name;
-            cout << errorMsg << endl;
+            logError("%s", errorMsg.c_str());
             throw std::runtime_error(errorMsg);
         }
 
+        if (lowDelay)
+        {
+            codecCtx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+            codecCtx->thread_type = FF_THREAD_SLICE;
+        }
+
+        if (threads > 0)
+        {
+            codecCtx->thread_count = threads;
+        }
+
+        if (codecCtx->codec_type == AVMEDIA_TYPE_VIDEO && FramePool::instance().isEnabled())
+        {
+            codecCtx->get_buffer2 = FramePool::getBuffer2;
+#if LIBAVCODEC_VERSION_MAJOR < 59
+            codecCtx->thread_safe_callbacks = 1; // FramePool locks itself
+#endif
+        }
+
         if (avcodec_open2(codecCtx, codec, nullptr) < 0)
         {
             string errorMsg = "Could not open codec: ";
             errorMsg += codec->name;
-            cout << errorMsg << endl;
+            logError("%s", errorMsg.c_str());
             throw std::runtime_error(errorMsg);
         }
 
-        cout << codecType << "[" << codecCtx->codec->name << "] codec context initialize success" << endl;
+        logInfo("%s[%s] codec context initialize success", codecType.c_str(), codecCtx->codec->name);
     }
 };
 
@@ -104,20 +143,29 @@ public:
     {
         if (formatCtx != nullptr)
         {
-            avformat_free_context(formatCtx);
-            formatCtx = nullptr;
+            // opened by avformat_open_input, the io context must be closed as well.
+            avformat_close_input(&formatCtx);
         }
-        cout << "~PacketGrabber called." << endl;
+        logDebug("~PacketGrabber called.");
     }
-    PacketGrabber(const string &url) : inputUrl(url)
+    // lowLatency: live input, probe as little as possible and let the demuxer hand out
+    // packets without buffering them.
+    PacketGrabber(const string &url, bool lowLatency = false) : inputUrl(url)
     {
         formatCtx = avformat_alloc_context();
 
+        if (lowLatency)
+        {
+            formatCtx->probesize = 32 * 1024;
+            formatCtx->max_analyze_duration = AV_TIME_BASE / 10;
+            formatCtx->flags |= AVFMT_FLAG_NOBUFFER;
+        }
+
         if (avformat_open_input(&formatCtx, inputUrl.c_str(), NULL, NULL) != 0)
         {
             string errorMsg = "Can not open input file:";
             errorMsg += inputUrl;
-            cout << errorMsg << endl;
+            logError("%s", errorMsg.c_str());
             throw std::runtime_error(errorMsg);
         }
 
@@ -125,7 +173,7 @@ public:
         {
             string errorMsg = "Can not find stream information in input file:";
             errorMsg += inputUrl;
-            cout << errorMsg << endl;
+            logError("%s", errorMsg.c_str());
             throw std::runtime_error(errorMsg);
         }
 
@@ -134,15 +182,56 @@ public:
             if (formatCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO && videoIndex == -1)
             {
                 videoIndex = i;
-                cout << "video stream index = : [" << i << "]" << endl;
+                logInfo("video stream index = : [%d]", i);
             }
 
             if (formatCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO && audioIndex == -1)
             {
                 audioIndex = i;
-                cout << "audio stream index = : [" << i << "]" << endl;
+                logInfo("audio stream index = : [%d]", i);
+            }
+        }
+    }
+
+    // keep only the given video / audio streams (-1 means none), every other stream
+    // is set to AVDISCARD_ALL so the demuxer drops its packets before we ever see them.
+    void selectStreams(int wantedVideo, int wantedAudio)
+    {
+        if (wantedVideo >= 0 &&
+            (wantedVideo >= (int)formatCtx->nb_streams ||
+             formatCtx->streams[wantedVideo]->codecpar->codec_type != AVMEDIA_TYPE_VIDEO))
+        {
+            string errorMsg = "Not a video stream: ";
+            errorMsg += std::to_string(wantedVideo);
+            logError("%s", errorMsg.c_str());
+            throw std::runtime_error(errorMsg);
+        }
+
+        if (wantedAudio >= 0 &&
+            (wantedAudio >= (int)formatCtx->nb_streams ||
+             formatCtx->streams[wantedAudio]->codecpar->codec_type != AVMEDIA_TYPE_AUDIO))
+        {
+            string errorMsg = "Not an audio stream: ";
+            errorMsg += std::to_string(wantedAudio);
+            logError("%s", errorMsg.c_str());
+            throw std::runtime_error(errorMsg);
+        }
+
+        videoIndex = wantedVideo;
+        audioIndex = wantedAudio;
+
+        for (int i = 0; i < formatCtx->nb_streams; i++)
+        {
+            if (i == videoIndex || i == audioIndex)
+            {
+                formatCtx->streams[i]->discard = AVDISCARD_DEFAULT;
+            }
+            else
+            {
+                formatCtx->streams[i]->discard = AVDISCARD_ALL;
             }
         }
+        logInfo("selected streams: video = [%d], audio = [%d]", videoIndex, audioIndex);
     }
 
     int grabPacket(AVPacket *pkt)
@@ -204,7 +293,7 @@ public:
     ReSampler operator=(const ReSampler &) = delete;
     ~ReSampler()
     {
-        cout << "~ReSampler called" << endl;
+        logDebug("~ReSampler called");
         if (swr != nullptr)
         {
             swr_free(&swr);
@@ -269,8 +358,8 @@ public:
 
         int outSize = outSamplesPerChannel * out.channels * bytePerOutSample;
 
-        std::cout << "GuessOutSamplesPerChannel: " << outSamplesPerChannel << std::endl;
-        std::cout << "GuessOutSize: " << outSize << std::endl;
+        logDebug("GuessOutSamplesPerChannel: %d", outSamplesPerChannel);
+        logDebug("GuessOutSize: %d", outSize);
 
         // Allocate a memory block with alignment suitable for all memory accesses.
         outSize *= 1.2;
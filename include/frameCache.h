@@ -0,0 +1,489 @@
+#pragma once
+
+#include "ffmpegUtil.h"
+#include "logger.h"
+#include "playbackStats.h"
+#include "threadPolicy.h"
+#include "traceRecorder.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ffmpegUtil
+{
+
+// Decoded frames (YUV420P, pts in ms) behind the playback position, for frame stepping and
+// reverse playback.
+//
+// The cache has its own demuxer and decoder, the playback pipeline is forward only and is never
+// disturbed. A miss seeks to the keyframe before the wanted time and decodes the whole GOP, so
+// every other frame of that GOP is a hit afterwards. The decoding runs on the prefetch thread,
+// never on the caller's (the render loop): a miss returns at once and the decoded callback says
+// when to ask again. Memory is bounded by maxBytes, the least recently used GOP is dropped first.
+//
+// GOPs are decoded one after the other without flushing the decoder at keyframes, so the leading
+// pictures of an open GOP (after the keyframe in decode order, before it in display order) get
+// their references and are kept with the GOP they are shown in, the one before the keyframe.
+class FrameCache
+{
+    static const int64_t NO_PTS = INT64_MIN;
+    static const int64_t STREAM_END = INT64_MAX;
+
+    struct Gop
+    {
+        int64_t endMs;   // pts of the next keyframe, STREAM_END for the last GOP
+        size_t bytes;
+        uint64_t lastUse;
+    };
+
+    PacketGrabber grabber;
+    AVCodecContext *codecCtx = nullptr;
+    struct SwsContext *sws = nullptr;
+    int streamIndex = -1;
+    AVRational timeBase{1, 1000};
+    int64_t streamStartMs = 0;
+    const size_t maxBytes;
+
+    // guarded by cacheMutex
+    std::map<int64_t, Gop> gops{}; // by keyframe pts
+    std::map<int64_t, FramePtr> frames{};
+    size_t bytes = 0;
+    uint64_t useTick = 0;
+    std::mutex cacheMutex{};
+
+    // grabber and codecCtx, one GOP decode at a time.
+    std::mutex decodeMutex{};
+
+    std::thread prefetchThread{};
+    std::mutex prefetchMutex{};
+    std::condition_variable prefetchCv{};
+    int64_t prefetchTarget = NO_PTS;
+    int64_t failedTarget = NO_PTS; // not decodable, not asked for again
+    bool stopping = false;
+    std::function<void()> decodedCallback{};
+
+    int64_t toMs(int64_t ts) const { return (int64_t)(ts * av_q2d(timeBase) * 1000); }
+
+    // cacheMutex held.
+    std::map<int64_t, Gop>::iterator locate(int64_t t)
+    {
+        auto it = gops.upper_bound(t);
+        if (it == gops.begin())
+        {
+            return gops.end();
+        }
+        --it;
+        return t < it->second.endMs ? it : gops.end();
+    }
+
+    FramePtr use(std::map<int64_t, Gop>::iterator gop, const AVFrame *frame)
+    {
+        gop->second.lastUse = ++useTick;
+        return FramePtr{av_frame_clone(frame)};
+    }
+
+    // last frame at or before t, or the time that has to be decoded first (missing).
+    FramePtr findAtOrBefore(int64_t t, int64_t &missing)
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        while (t >= streamStartMs)
+        {
+            auto gop = locate(t);
+            if (gop == gops.end())
+            {
+                missing = t;
+                return nullptr;
+            }
+            auto it = frames.upper_bound(t);
+            if (it != frames.begin() && (--it)->first >= gop->first)
+            {
+                return use(gop, it->second.get());
+            }
+            // nothing of this GOP at or before t: the frame is in the previous GOP.
+            t = gop->first - 1;
+        }
+        return nullptr;
+    }
+
+    // first frame after t (at or after t when inclusive).
+    FramePtr findAfter(int64_t t, bool inclusive, int64_t &missing)
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        while (true)
+        {
+            auto gop = locate(t);
+            if (gop == gops.end())
+            {
+                missing = t;
+                return nullptr;
+            }
+            auto it = inclusive ? frames.lower_bound(t) : frames.upper_bound(t);
+            if (it != frames.end() && it->first < gop->second.endMs)
+            {
+                return use(gop, it->second.get());
+            }
+            if (gop->second.endMs == STREAM_END)
+            {
+                return nullptr;
+            }
+            t = gop->second.endMs;
+            inclusive = true;
+        }
+    }
+
+    // never blocks: a miss queues the decode, decoding is then true.
+    template <typename Find> FramePtr lookup(Find find, bool &decoding)
+    {
+        auto &stats = PlaybackStats::instance();
+        decoding = false;
+        int64_t missing = NO_PTS;
+        FramePtr frame = find(missing);
+        if (frame != nullptr)
+        {
+            stats.cacheHits.fetch_add(1, std::memory_order_relaxed);
+            return frame;
+        }
+        if (missing == NO_PTS)
+        {
+            return nullptr; // before the first / after the last frame
+        }
+        stats.cacheMisses.fetch_add(1, std::memory_order_relaxed);
+        decoding = requestDecode(missing);
+        return nullptr;
+    }
+
+    // false when t could not be decoded before.
+    bool requestDecode(int64_t t)
+    {
+        {
+            std::lock_guard<std::mutex> lk{prefetchMutex};
+            if (t == failedTarget)
+            {
+                return false;
+            }
+            prefetchTarget = t;
+        }
+        prefetchCv.notify_one();
+        return true;
+    }
+
+    bool isCached(int64_t t)
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        return locate(t) != gops.end();
+    }
+
+    void store(int64_t startMs, int64_t endMs, std::vector<FramePtr> &gopFrames, int64_t keep)
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if (gops.count(startMs) == 0)
+        {
+            Gop gop{endMs, 0, ++useTick};
+            for (auto &f : gopFrames)
+            {
+                // leading pictures of the first GOP after a seek, decoded without their references.
+                if (f->pts < startMs || f->pts >= endMs || frames.count(f->pts) != 0)
+                {
+                    continue;
+                }
+                for (int i = 0; i < AV_NUM_DATA_POINTERS && f->buf[i] != nullptr; i++)
+                {
+                    gop.bytes += f->buf[i]->size;
+                }
+                int64_t pts = f->pts;
+                frames[pts] = std::move(f);
+            }
+            bytes += gop.bytes;
+            gops[startMs] = gop;
+        }
+        gopFrames.clear();
+
+        // least recently used first, never the GOP just asked for.
+        while (bytes > maxBytes && gops.size() > 1)
+        {
+            auto victim = gops.end();
+            for (auto it = gops.begin(); it != gops.end(); ++it)
+            {
+                if ((keep < it->first || keep >= it->second.endMs) &&
+                    (victim == gops.end() || it->second.lastUse < victim->second.lastUse))
+                {
+                    victim = it;
+                }
+            }
+            if (victim == gops.end())
+            {
+                break;
+            }
+            frames.erase(frames.lower_bound(victim->first), frames.lower_bound(victim->second.endMs));
+            bytes -= victim->second.bytes;
+            gops.erase(victim);
+        }
+
+        auto &stats = PlaybackStats::instance();
+        stats.cacheBytes.store(bytes, std::memory_order_relaxed);
+        stats.cacheFrames.store(frames.size(), std::memory_order_relaxed);
+    }
+
+    void receiveFrames(std::vector<FramePtr> &gopFrames, AVFrame *decoded)
+    {
+        while (avcodec_receive_frame(codecCtx, decoded) == 0)
+        {
+            // the frames keep their size, also when the stream changes it (the sink follows).
+            sws = sws_getCachedContext(sws, decoded->width, decoded->height, (AVPixelFormat)decoded->format,
+                                       decoded->width, decoded->height, AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr,
+                                       nullptr, nullptr);
+            FramePtr out{av_frame_alloc()};
+            FramePool::instance().allocPicture(out.get(), AV_PIX_FMT_YUV420P, decoded->width, decoded->height);
+            sws_scale(sws, (uint8_t const *const *)decoded->data, decoded->linesize, 0, decoded->height, out->data,
+                      out->linesize);
+            int64_t pts = decoded->pts != AV_NOPTS_VALUE ? decoded->pts : decoded->best_effort_timestamp;
+            out->pts = toMs(pts);
+            gopFrames.push_back(std::move(out));
+            av_frame_unref(decoded);
+        }
+    }
+
+    // Decodes GOP after GOP from the current demuxer position until the one holding t is stored.
+    // A GOP is stored once a frame at or after the next keyframe came out of the decoder: the
+    // leading pictures of that keyframe, shown before it, are then out too.
+    // false when the position was already past t, landedMs is then the dts of the keyframe it
+    // landed on (demuxers seek by dts, the leading pictures are shown before the keyframe's pts).
+    bool decodeFromSeekPoint(int64_t t, int64_t &landedMs)
+    {
+        PacketPtr pkt{av_packet_alloc()};
+        FramePtr decoded{av_frame_alloc()};
+        std::vector<FramePtr> decodedFrames{};
+        std::vector<int64_t> keys{}; // keyframe pts of the GOPs not stored yet
+        bool found = false;
+        auto formatCtx = grabber.getFormatCtx();
+
+        auto storeComplete = [&](bool end) {
+            while (keys.size() > 1 || (end && !keys.empty()))
+            {
+                int64_t startMs = keys[0];
+                int64_t endMs = keys.size() > 1 ? keys[1] : STREAM_END;
+                bool complete = end;
+                for (auto &f : decodedFrames)
+                {
+                    complete = complete || f->pts >= endMs;
+                }
+                if (!complete)
+                {
+                    return;
+                }
+                // the pictures before startMs are the first GOP's leading ones, without their references.
+                std::vector<FramePtr> gopFrames{};
+                std::vector<FramePtr> later{};
+                for (auto &f : decodedFrames)
+                {
+                    (f->pts < endMs ? gopFrames : later).push_back(std::move(f));
+                }
+                decodedFrames.swap(later);
+                store(startMs, endMs, gopFrames, t);
+                found = found || (startMs <= t && t < endMs);
+                keys.erase(keys.begin());
+            }
+        };
+
+        while (!found)
+        {
+            if (av_read_frame(formatCtx, pkt.get()) < 0)
+            {
+                // the end, drain the decoder.
+                avcodec_send_packet(codecCtx, nullptr);
+                receiveFrames(decodedFrames, decoded.get());
+                storeComplete(true);
+                return found;
+            }
+            if (pkt->stream_index != streamIndex)
+            {
+                av_packet_unref(pkt.get());
+                continue;
+            }
+
+            if (pkt->flags & AV_PKT_FLAG_KEY)
+            {
+                int64_t keyMs = toMs(pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts);
+                if (keys.empty() && keyMs > t)
+                {
+                    landedMs = toMs(pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts);
+                    av_packet_unref(pkt.get());
+                    return false;
+                }
+                keys.push_back(keyMs);
+            }
+
+            if (!keys.empty())
+            {
+                // receiveFrames takes everything the decoder has, so EAGAIN can not happen here.
+                avcodec_send_packet(codecCtx, pkt.get());
+                receiveFrames(decodedFrames, decoded.get());
+                storeComplete(false);
+            }
+            av_packet_unref(pkt.get());
+        }
+        return true;
+    }
+
+    bool decodeGopAt(int64_t t)
+    {
+        std::lock_guard<std::mutex> decodeLock(decodeMutex);
+        if (isCached(t))
+        {
+            return true;
+        }
+        TraceScope trace("gop decode");
+        auto formatCtx = grabber.getFormatCtx();
+        // A t shown before the keyframe the seek lands on (an open GOP leading picture, or a
+        // demuxer that lands after t) needs the keyframe before that one: seek just before it,
+        // then further back and finally to the start.
+        int64_t landedMs = NO_PTS;
+        const int64_t seekBackMs[] = {0, 0, 5000, -1};
+        for (size_t i = 0; i < sizeof(seekBackMs) / sizeof(seekBackMs[0]); i++)
+        {
+            int64_t back = seekBackMs[i];
+            int64_t target = back < 0 ? streamStartMs : t - back;
+            if (i == 1)
+            {
+                // one keyframe earlier than the one the first seek landed on.
+                if (landedMs == NO_PTS || landedMs - 1 >= t)
+                {
+                    continue;
+                }
+                target = landedMs - 1;
+            }
+            int64_t ts = av_rescale_q(target, AVRational{1, 1000}, timeBase);
+            if (av_seek_frame(formatCtx, streamIndex, ts, AVSEEK_FLAG_BACKWARD) < 0)
+            {
+                continue;
+            }
+            avcodec_flush_buffers(codecCtx);
+            landedMs = NO_PTS;
+            if (decodeFromSeekPoint(t, landedMs))
+            {
+                return true;
+            }
+        }
+        logWarn("frame cache can not decode around %lldms", (long long)t);
+        return false;
+    }
+
+    void prefetchLoop()
+    {
+        ThreadPolicy::instance().apply(ThreadPolicy::PREFETCH, "frame cache prefetch");
+        while (true)
+        {
+            int64_t target;
+            {
+                std::unique_lock<std::mutex> lk{prefetchMutex};
+                prefetchCv.wait(lk, [this] { return stopping || prefetchTarget != NO_PTS; });
+                if (stopping)
+                {
+                    break;
+                }
+                target = prefetchTarget;
+                prefetchTarget = NO_PTS;
+            }
+            if (!decodeGopAt(target))
+            {
+                std::lock_guard<std::mutex> lk{prefetchMutex};
+                failedTarget = target;
+            }
+            if (decodedCallback)
+            {
+                decodedCallback();
+            }
+        }
+    }
+
+public:
+    FrameCache(const FrameCache &) = delete;
+    FrameCache &operator=(const FrameCache &) = delete;
+
+    // opens url a second time, live inputs can not be cached.
+    FrameCache(const string &url, int videoIndex, size_t maxCacheBytes)
+        : grabber(url), streamIndex(videoIndex), maxBytes(maxCacheBytes)
+    {
+        auto formatCtx = grabber.getFormatCtx();
+        grabber.selectStreams(videoIndex, -1);
+        auto stream = formatCtx->streams[videoIndex];
+        timeBase = stream->time_base;
+        streamStartMs = stream->start_time != AV_NOPTS_VALUE ? toMs(stream->start_time) : 0;
+
+        ffutils::initCodec(formatCtx, videoIndex, &codecCtx);
+        sws = sws_getContext(codecCtx->width, codecCtx->height, codecCtx->pix_fmt, codecCtx->width,
+                             codecCtx->height, AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr, nullptr, nullptr);
+
+        prefetchThread = std::thread(&FrameCache::prefetchLoop, this);
+    }
+
+    ~FrameCache()
+    {
+        {
+            std::lock_guard<std::mutex> lk{prefetchMutex};
+            stopping = true;
+        }
+        prefetchCv.notify_one();
+        prefetchThread.join();
+
+        auto &stats = PlaybackStats::instance();
+        uint64_t hits = stats.cacheHits;
+        uint64_t misses = stats.cacheMisses;
+        logInfo("frame cache: hits = %llu, misses = %llu, hit rate = %llu%%, gops = %zu, memory = %zuMB of %zuMB",
+                (unsigned long long)hits, (unsigned long long)misses,
+                (unsigned long long)(hits + misses > 0 ? 100 * hits / (hits + misses) : 0), gops.size(),
+                (size_t)(bytes / (1024 * 1024)), (size_t)(maxBytes / (1024 * 1024)));
+
+        frames.clear();
+        sws_freeContext(sws);
+        avcodec_free_context(&codecCtx);
+    }
+
+    // called on the prefetch thread after every GOP decode (also a failed one). Set it before
+    // the first lookup.
+    void setDecodedCallback(std::function<void()> callback) { decodedCallback = std::move(callback); }
+
+    // The returned frames are references, they stay valid after the cache dropped them.
+    // nullptr with decoding set: not cached yet, ask again after the decoded callback.
+    FramePtr frameBefore(int64_t ptsMs, bool &decoding)
+    {
+        return lookup([&](int64_t &missing) { return findAtOrBefore(ptsMs - 1, missing); }, decoding);
+    }
+
+    FramePtr frameAfter(int64_t ptsMs, bool &decoding)
+    {
+        return lookup([&](int64_t &missing) { return findAfter(ptsMs, false, missing); }, decoding);
+    }
+
+    // decode the GOP holding ptsMs in the background.
+    void prefetch(int64_t ptsMs)
+    {
+        if (ptsMs < streamStartMs || isCached(ptsMs))
+        {
+            return;
+        }
+        requestDecode(ptsMs);
+    }
+
+    // reverse playback: the GOP before the one holding ptsMs is decoded before we step into it.
+    void prefetchBefore(int64_t ptsMs)
+    {
+        int64_t gopStart = ptsMs;
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            auto gop = locate(ptsMs);
+            if (gop != gops.end())
+            {
+                gopStart = gop->first;
+            }
+        }
+        prefetch(gopStart - 1);
+    }
+};
+
+} // namespace ffmpegUtil
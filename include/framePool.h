@@ -0,0 +1,273 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#ifdef __cplusplus
+};
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace ffmpegUtil
+{
+
+// Picture buffers for the decoders (get_buffer2) and for our own conversion output (outPic,
+// FrameCache), from one AVBufferPool per (width, height, format).
+//
+// After the first frames every buffer is recycled: steady state decoding does no large
+// allocation, so no page faults on fresh memory either. Buffers are 64 byte aligned, with
+// setHugePages(true) the big ones are mmap'ed and madvise'd for transparent huge pages, which
+// cuts the TLB misses of 4K frames (one 2MB page instead of 512 4K pages).
+class FramePool
+{
+public:
+    static const int ALIGN = 64;
+
+    struct Stats
+    {
+        uint64_t requests;    // buffers handed out
+        uint64_t allocations; // of them, newly allocated (pool misses)
+        uint64_t bytes;       // allocated so far
+        uint64_t hugePageBytes;
+        int pools;
+    };
+
+private:
+    static const size_t HUGE_PAGE = 2 * 1024 * 1024;
+
+    struct Layout
+    {
+        int linesize[4];
+        size_t offset[4];
+        size_t size;
+    };
+
+    std::mutex poolsMutex{};
+    std::map<std::tuple<int, int, int>, AVBufferPool *> pools{};
+    std::atomic<bool> enabled{true};
+    std::atomic<bool> hugePages{false};
+
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> hugePageBytes{0};
+
+    FramePool() = default;
+
+    ~FramePool()
+    {
+        // buffers still referenced keep their pool alive until they are released.
+        for (auto &p : pools)
+        {
+            av_buffer_pool_uninit(&p.second);
+        }
+    }
+
+    // opaque: the mapping length for huge page buffers, 0 for the heap.
+    static void freeBuffer(void *opaque, uint8_t *data)
+    {
+#ifdef __linux__
+        if (opaque != nullptr)
+        {
+            munmap(data, (size_t)(uintptr_t)opaque);
+            return;
+        }
+#endif
+#ifdef _WIN32
+        _aligned_free(data);
+#else
+        std::free(data);
+#endif
+    }
+
+    static AVBufferRef *allocBuffer(void *opaque, int size)
+    {
+        FramePool *self = (FramePool *)opaque;
+        void *data = nullptr;
+        size_t mapped = 0;
+#ifdef __linux__
+        if (self->hugePages.load() && (size_t)size >= HUGE_PAGE)
+        {
+            // large anonymous mappings are placed on a huge page boundary by the kernel.
+            size_t len = (size + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+            data = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (data == MAP_FAILED)
+            {
+                data = nullptr;
+            }
+            else
+            {
+                madvise(data, len, MADV_HUGEPAGE);
+                mapped = len;
+                self->hugePageBytes.fetch_add(len, std::memory_order_relaxed);
+            }
+        }
+#endif
+        if (data == nullptr)
+        {
+#ifdef _WIN32
+            data = _aligned_malloc(size, ALIGN);
+#else
+            if (posix_memalign(&data, ALIGN, size) != 0)
+            {
+                data = nullptr;
+            }
+#endif
+        }
+        if (data == nullptr)
+        {
+            return nullptr;
+        }
+        self->allocations.fetch_add(1, std::memory_order_relaxed);
+        self->bytes.fetch_add(mapped != 0 ? mapped : size, std::memory_order_relaxed);
+        AVBufferRef *ref = av_buffer_create((uint8_t *)data, size, freeBuffer, (void *)(uintptr_t)mapped, 0);
+        if (ref == nullptr)
+        {
+            freeBuffer((void *)(uintptr_t)mapped, (uint8_t *)data);
+        }
+        return ref;
+    }
+
+    // all planes in one buffer, every plane and line starts on an ALIGN boundary.
+    static bool computeLayout(AVPixelFormat format, int width, int height, Layout &layout)
+    {
+        if (av_image_fill_linesizes(layout.linesize, format, width) < 0)
+        {
+            return false;
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            layout.linesize[i] = (layout.linesize[i] + ALIGN - 1) / ALIGN * ALIGN;
+        }
+        uint8_t *data[4] = {};
+        // offsets from a fake base, av_image_fill_pointers only does the arithmetic.
+        uint8_t *base = (uint8_t *)(uintptr_t)ALIGN;
+        int size = av_image_fill_pointers(data, format, height, base, layout.linesize);
+        if (size < 0)
+        {
+            return false;
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            layout.offset[i] = data[i] != nullptr ? data[i] - base : 0;
+        }
+        // decoders may read (SIMD) a little past the end.
+        layout.size = size + AV_INPUT_BUFFER_PADDING_SIZE + ALIGN;
+        return true;
+    }
+
+    AVBufferRef *getBuffer(AVPixelFormat format, int width, int height, size_t size)
+    {
+        AVBufferPool *pool = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(poolsMutex);
+            auto &p = pools[std::make_tuple(width, height, (int)format)];
+            if (p == nullptr)
+            {
+                p = av_buffer_pool_init2((int)size, this, allocBuffer, nullptr);
+            }
+            pool = p;
+        }
+        requests.fetch_add(1, std::memory_order_relaxed);
+        return pool != nullptr ? av_buffer_pool_get(pool) : nullptr;
+    }
+
+    static void setPlanes(AVFrame *frame, const Layout &layout)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            frame->linesize[i] = layout.linesize[i];
+            frame->data[i] = layout.offset[i] != 0 || i == 0 ? frame->buf[0]->data + layout.offset[i] : nullptr;
+        }
+        frame->extended_data = frame->data;
+    }
+
+public:
+    static FramePool &instance()
+    {
+        static FramePool pool{};
+        return pool;
+    }
+
+    // off: initCodec leaves the decoders on the default allocator.
+    void setEnabled(bool e) { enabled = e; }
+    bool isEnabled() const { return enabled; }
+
+    // applies to buffers allocated from now on.
+    void setHugePages(bool h) { hugePages = h; }
+
+    // AVCodecContext::get_buffer2, set by ffutils::initCodec for video decoders.
+    static int getBuffer2(AVCodecContext *codecCtx, AVFrame *frame, int flags)
+    {
+        const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+        if (!(codecCtx->codec->capabilities & AV_CODEC_CAP_DR1) || desc == nullptr ||
+            (desc->flags & AV_PIX_FMT_FLAG_HWACCEL))
+        {
+            return avcodec_default_get_buffer2(codecCtx, frame, flags);
+        }
+
+        // the decoder may write past width / height (edge emulation, macroblock padding).
+        int w = frame->width;
+        int h = frame->height;
+        int linesizeAlign[AV_NUM_DATA_POINTERS];
+        avcodec_align_dimensions2(codecCtx, &w, &h, linesizeAlign);
+
+        Layout layout{};
+        if (!computeLayout((AVPixelFormat)frame->format, w, h, layout))
+        {
+            return avcodec_default_get_buffer2(codecCtx, frame, flags);
+        }
+        frame->buf[0] = instance().getBuffer((AVPixelFormat)frame->format, w, h, layout.size);
+        if (frame->buf[0] == nullptr)
+        {
+            return AVERROR(ENOMEM);
+        }
+        setPlanes(frame, layout);
+        return 0;
+    }
+
+    // frame gets format / width / height and pooled planes, released with av_frame_free.
+    void allocPicture(AVFrame *frame, AVPixelFormat format, int width, int height)
+    {
+        Layout layout{};
+        if (!computeLayout(format, width, height, layout))
+        {
+            throw std::runtime_error("FramePool: unsupported picture format");
+        }
+        frame->format = format;
+        frame->width = width;
+        frame->height = height;
+        frame->buf[0] = getBuffer(format, width, height, layout.size);
+        if (frame->buf[0] == nullptr)
+        {
+            throw std::runtime_error("FramePool: out of memory");
+        }
+        setPlanes(frame, layout);
+    }
+
+    Stats getStats()
+    {
+        Stats s{requests.load(), allocations.load(), bytes.load(), hugePageBytes.load(), 0};
+        std::lock_guard<std::mutex> lock(poolsMutex);
+        s.pools = (int)pools.size();
+        return s;
+    }
+};
+
+} // namespace ffmpegUtil
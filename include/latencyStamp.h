@@ -0,0 +1,85 @@
+#pragma once
+
+#include "ffmpegUtil.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace ffmpegUtil
+{
+
+// Wall clock timestamp painted into the top rows of a YUV420P picture by a test sender and read
+// back by the player after decoding, to measure end-to-end latency between two local processes.
+//
+// The stamp is a row of STAMP_BLOCKS luma blocks, 16 marker bits then the 64 bit timestamp (us),
+// black for 0 and white for 1, big enough to survive lossy encoding.
+struct LatencyStamp
+{
+    static const int MARKER_BITS = 16;
+    static const int STAMP_BITS = 64;
+    static const int STAMP_BLOCKS = MARKER_BITS + STAMP_BITS;
+    static const uint16_t MARKER = 0xA55A;
+
+    static int64_t wallClockUs()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    }
+
+    static bool fits(int width, int height) { return width / STAMP_BLOCKS >= 4 && height >= 16; }
+
+    static void write(AVFrame *pic, int64_t us)
+    {
+        if (!fits(pic->width, pic->height))
+        {
+            return;
+        }
+        int blockW = pic->width / STAMP_BLOCKS;
+        int blockH = std::min(blockW, 16);
+        for (int b = 0; b < STAMP_BLOCKS; b++)
+        {
+            bool bit = b < MARKER_BITS ? (MARKER >> (MARKER_BITS - 1 - b)) & 1
+                                       : ((uint64_t)us >> (STAMP_BITS - 1 - (b - MARKER_BITS))) & 1;
+            for (int y = 0; y < blockH; y++)
+            {
+                memset(pic->data[0] + y * pic->linesize[0] + b * blockW, bit ? 235 : 16, blockW);
+            }
+        }
+    }
+
+    // false when the picture carries no stamp.
+    static bool read(const AVFrame *pic, int64_t &us)
+    {
+        if (!fits(pic->width, pic->height))
+        {
+            return false;
+        }
+        int blockW = pic->width / STAMP_BLOCKS;
+        int blockH = std::min(blockW, 16);
+        uint16_t marker = 0;
+        uint64_t value = 0;
+        for (int b = 0; b < STAMP_BLOCKS; b++)
+        {
+            // sample the block center, the edges are where the codec smears.
+            const uint8_t *p = pic->data[0] + (blockH / 2) * pic->linesize[0] + b * blockW + blockW / 2;
+            int bit = p[0] > 128 ? 1 : 0;
+            if (b < MARKER_BITS)
+            {
+                marker = (uint16_t)((marker << 1) | bit);
+            }
+            else
+            {
+                value = (value << 1) | (uint64_t)bit;
+            }
+        }
+        if (marker != MARKER)
+        {
+            return false;
+        }
+        us = (int64_t)value;
+        return true;
+    }
+};
+
+} // namespace ffmpegUtil
@@ -0,0 +1,432 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__GNUC__)
+#define PLAYER_PRINTF_FORMAT(fmt, args) __attribute__((format(printf, fmt, args)))
+#else
+#define PLAYER_PRINTF_FORMAT(fmt, args)
+#endif
+
+namespace ffmpegUtil
+{
+
+// Leveled logging that never blocks the thread that logs (logInfo / logWarn ..., printf style).
+//
+// Every thread formats into its own single producer ring (vsnprintf into a fixed slot, no
+// allocation, no lock); a background thread drains all rings about every DRAIN_MS, in time order,
+// and writes them to stderr with one flush per batch (stdout may carry a -vsink / -asink stream).
+// A full ring drops the message (counted). A thread's first message costs more: it claims a ring
+// (a bounded scan) and registers the thread exit that gives it back, which may allocate. A thread
+// that must not (the SDL audio callback) gets a ring claimed for it from another thread with
+// reserveThreadRing() and takes it with adoptThreadRing(); from then on its logging is
+// wait-free. With more threads than rings the extra threads' messages are dropped (counted).
+//
+// Repeats are rate limited per call site (the format string): at most SITE_BURST messages per
+// second, the rest are counted and reported with the next one that passes.
+//
+// logError writes before it returns (the caller usually throws next), so it locks: not for
+// the audio callback. Whatever is still queued at exit is written then.
+class Logger
+{
+public:
+    enum Level
+    {
+        LEVEL_DEBUG,
+        LEVEL_INFO,
+        LEVEL_WARN,
+        LEVEL_ERROR,
+        LEVEL_OFF
+    };
+
+    struct Ring;
+
+private:
+    static const int MAX_THREADS = 64;
+    static const uint32_t RING_SLOTS = 64; // power of two
+    static const int TEXT_BYTES = 240;
+    static const int SITES = 256;
+    static const uint32_t SITE_BURST = 10;
+    static const int DRAIN_MS = 20;
+
+    struct Entry
+    {
+        int64_t us;
+        Level level;
+        char text[TEXT_BYTES];
+    };
+
+public:
+    struct Ring
+    {
+        std::atomic<bool> owned{false};
+        std::atomic<uint32_t> head{0}; // written by the owner
+        std::atomic<uint32_t> tail{0}; // read by the drain
+        Entry entries[RING_SLOTS];
+    };
+
+private:
+    // rate limit state of one call site, updated racily: the limit is approximate.
+    struct Site
+    {
+        std::atomic<const char *> key{nullptr};
+        std::atomic<int64_t> windowUs{0};
+        std::atomic<uint32_t> inWindow{0};
+        std::atomic<uint32_t> suppressed{0};
+    };
+
+    // trivially destructible: reading it registers nothing at thread exit.
+    struct ThreadSlot
+    {
+        Ring *ring;
+        bool adopted; // set by adoptThreadRing(): never claim a ring on this thread
+    };
+
+    // gives a claimed ring back when its thread ends.
+    struct RingOwner
+    {
+        Ring *ring = nullptr;
+        ~RingOwner()
+        {
+            if (ring != nullptr)
+            {
+                ring->owned.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    std::atomic<int> level{LEVEL_INFO};
+    Ring rings[MAX_THREADS];
+    Site sites[SITES];
+    std::atomic<uint64_t> dropped{0};
+    const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    std::mutex drainMutex{}; // one reader of the rings at a time: the drain thread or a flush
+    std::mutex stopMutex{};
+    std::condition_variable stopCv{};
+    bool stopping = false;
+    std::atomic<bool> stopped{false}; // after exit: log() writes directly
+    std::thread drainThread{};
+
+    Logger()
+    {
+        drainThread = std::thread(&Logger::drainLoop, this);
+        std::atexit([] { instance().shutdown(); });
+    }
+
+    static const char *levelName(Level l)
+    {
+        static const char *names[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+        return names[l];
+    }
+
+    int64_t nowUs() const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime)
+            .count();
+    }
+
+    static ThreadSlot &threadSlot()
+    {
+        static thread_local ThreadSlot slot{nullptr, false};
+        return slot;
+    }
+
+    Ring *claimRing()
+    {
+        for (Ring &ring : rings)
+        {
+            bool expected = false;
+            if (!ring.owned.load(std::memory_order_relaxed) &&
+                ring.owned.compare_exchange_strong(expected, true, std::memory_order_acquire))
+            {
+                return &ring;
+            }
+        }
+        return nullptr;
+    }
+
+    Ring *threadRing()
+    {
+        ThreadSlot &slot = threadSlot();
+        if (slot.ring == nullptr && !slot.adopted)
+        {
+            slot.ring = claimRing();
+            if (slot.ring != nullptr)
+            {
+                static thread_local RingOwner owner{};
+                owner.ring = slot.ring;
+            }
+        }
+        return slot.ring;
+    }
+
+    // false when the message is suppressed. suppressedBefore: the count to report with it.
+    bool passRateLimit(const char *fmt, int64_t now, uint32_t &suppressedBefore)
+    {
+        size_t h = ((uintptr_t)fmt >> 3) % SITES;
+        Site *site = nullptr;
+        for (int probe = 0; probe < 8 && site == nullptr; probe++)
+        {
+            Site &s = sites[(h + probe) % SITES];
+            const char *key = s.key.load(std::memory_order_relaxed);
+            if (key == nullptr && s.key.compare_exchange_strong(key, fmt))
+            {
+                key = fmt;
+            }
+            if (key == fmt)
+            {
+                site = &s;
+            }
+        }
+        if (site == nullptr)
+        {
+            return true; // table full, not limited
+        }
+        int64_t window = site->windowUs.load(std::memory_order_relaxed);
+        if (now - window >= 1000000 && site->windowUs.compare_exchange_strong(window, now))
+        {
+            site->inWindow.store(0, std::memory_order_relaxed);
+        }
+        if (site->inWindow.fetch_add(1, std::memory_order_relaxed) >= SITE_BURST)
+        {
+            site->suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        suppressedBefore = site->suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+    static void format(Entry &e, const char *fmt, va_list args, uint32_t suppressedBefore)
+    {
+        int n = std::vsnprintf(e.text, TEXT_BYTES, fmt, args);
+        n = std::min(std::max(n, 0), TEXT_BYTES - 1);
+        if (suppressedBefore > 0)
+        {
+            std::snprintf(e.text + n, TEXT_BYTES - n, " (%u similar suppressed)", suppressedBefore);
+        }
+    }
+
+    static void append(std::string &out, const Entry &e)
+    {
+        char prefix[32];
+        std::snprintf(prefix, sizeof(prefix), "%9.3f %s ", e.us / 1e6, levelName(e.level));
+        out += prefix;
+        out += e.text;
+        out += '\n';
+    }
+
+    // everything queued so far, oldest first across the rings.
+    void drain()
+    {
+        std::lock_guard<std::mutex> lg{drainMutex};
+        std::vector<const Entry *> batch{};
+        std::vector<std::pair<Ring *, uint32_t>> taken{};
+        for (Ring &ring : rings)
+        {
+            uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+            uint32_t head = ring.head.load(std::memory_order_acquire);
+            for (uint32_t i = tail; i != head; i++)
+            {
+                batch.push_back(&ring.entries[i % RING_SLOTS]);
+            }
+            if (head != tail)
+            {
+                taken.emplace_back(&ring, head);
+            }
+        }
+        uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+        if (batch.empty() && lost == 0)
+        {
+            return;
+        }
+        std::stable_sort(batch.begin(), batch.end(), [](const Entry *a, const Entry *b) { return a->us < b->us; });
+        std::string out{};
+        for (const Entry *e : batch)
+        {
+            append(out, *e);
+        }
+        if (lost > 0)
+        {
+            out += "logger: " + std::to_string(lost) + " messages dropped, log ring full or none free\n";
+        }
+        // the slots are only given back once they were copied out.
+        for (auto &t : taken)
+        {
+            t.first->tail.store(t.second, std::memory_order_release);
+        }
+        std::cerr.write(out.data(), (std::streamsize)out.size());
+        std::cerr.flush();
+    }
+
+    void drainLoop()
+    {
+        std::unique_lock<std::mutex> lk{stopMutex};
+        while (!stopping)
+        {
+            stopCv.wait_for(lk, std::chrono::milliseconds(DRAIN_MS));
+            lk.unlock();
+            drain();
+            lk.lock();
+        }
+    }
+
+    void shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lg{stopMutex};
+            stopping = true;
+        }
+        stopCv.notify_one();
+        drainThread.join();
+        stopped.store(true);
+        drain();
+    }
+
+public:
+    // never destroyed: threads and static destructors may log until the very end.
+    static Logger &instance()
+    {
+        static Logger *logger = new Logger();
+        return *logger;
+    }
+
+    Logger(const Logger &) = delete;
+    Logger &operator=(const Logger &) = delete;
+
+    void setLevel(Level l) { level.store(l); }
+
+    // a ring for a thread that will take it with adoptThreadRing(), nullptr when none is free.
+    // It stays with that thread: reserve once per thread that will adopt it.
+    Ring *reserveThreadRing() { return claimRing(); }
+
+    // no lock, no allocation. The calling thread logs into ring from now on and never claims one
+    // itself: with nullptr its messages are dropped (counted).
+    void adoptThreadRing(Ring *ring)
+    {
+        ThreadSlot &slot = threadSlot();
+        slot.ring = ring;
+        slot.adopted = true;
+    }
+
+    bool isEnabled(Level l) const { return l >= level.load(std::memory_order_relaxed); }
+
+    // "debug", "info", "warn", "error", "off"; info for anything else.
+    static Level parseLevel(const std::string &name)
+    {
+        static const char *names[] = {"debug", "info", "warn", "error", "off"};
+        for (int l = LEVEL_DEBUG; l <= LEVEL_OFF; l++)
+        {
+            if (name == names[l])
+            {
+                return (Level)l;
+            }
+        }
+        return LEVEL_INFO;
+    }
+
+    void vlog(Level l, const char *fmt, va_list args)
+    {
+        if (!isEnabled(l))
+        {
+            return;
+        }
+        int64_t now = nowUs();
+        uint32_t suppressedBefore = 0;
+        if (l < LEVEL_ERROR && !passRateLimit(fmt, now, suppressedBefore))
+        {
+            return;
+        }
+        if (stopped.load(std::memory_order_relaxed))
+        {
+            // after exit: written right here.
+            Entry e{};
+            e.us = now;
+            e.level = l;
+            format(e, fmt, args, suppressedBefore);
+            std::string out{};
+            append(out, e);
+            std::lock_guard<std::mutex> lg{drainMutex};
+            std::cerr.write(out.data(), (std::streamsize)out.size());
+            std::cerr.flush();
+            return;
+        }
+        Ring *ring = threadRing();
+        if (ring == nullptr)
+        {
+            // more threads than rings: dropped, never a lock on a thread that may not block.
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        uint32_t head = ring->head.load(std::memory_order_relaxed);
+        if (head - ring->tail.load(std::memory_order_acquire) == RING_SLOTS)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Entry &e = ring->entries[head % RING_SLOTS];
+        e.us = now;
+        e.level = l;
+        format(e, fmt, args, suppressedBefore);
+        ring->head.store(head + 1, std::memory_order_release);
+        if (l >= LEVEL_ERROR)
+        {
+            drain();
+        }
+    }
+
+    // what is queued is written before this returns.
+    void flush() { drain(); }
+};
+
+inline void logDebug(const char *fmt, ...) PLAYER_PRINTF_FORMAT(1, 2);
+inline void logInfo(const char *fmt, ...) PLAYER_PRINTF_FORMAT(1, 2);
+inline void logWarn(const char *fmt, ...) PLAYER_PRINTF_FORMAT(1, 2);
+inline void logError(const char *fmt, ...) PLAYER_PRINTF_FORMAT(1, 2);
+
+inline void logDebug(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    Logger::instance().vlog(Logger::LEVEL_DEBUG, fmt, args);
+    va_end(args);
+}
+
+inline void logInfo(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    Logger::instance().vlog(Logger::LEVEL_INFO, fmt, args);
+    va_end(args);
+}
+
+inline void logWarn(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    Logger::instance().vlog(Logger::LEVEL_WARN, fmt, args);
+    va_end(args);
+}
+
+inline void logError(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    Logger::instance().vlog(Logger::LEVEL_ERROR, fmt, args);
+    va_end(args);
+}
+
+} // namespace ffmpegUtil
@@ -1,5 +1,15 @@
+#include "audioDsp.h"
 #include "ffmpegUtil.h"
+#include "outputSink.h"
+#include "pixelConvert.h"
+#include "playbackStats.h"
+#include "sceneDetector.h"
+#include "shmFrameRing.h"
+#include "threadPolicy.h"
+#include "traceRecorder.h"
+#include "videoFilter.h"
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <list>
@@ -9,20 +19,59 @@
 #include <atomic>
 #include <condition_variable>
 #include <mutex>
+#include <cstring>
+#include <functional>
+#include <vector>
 
 using std::condition_variable;
-using std::cout;
-using std::endl;
 using std::list;
 using std::mutex;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
+using ffmpegUtil::PacketPtr;
 
-class MediaProcessor
+// Packets waiting for a decoder, pushed by the reader thread and popped by the frame keeper.
+// A nullptr packet marks the end of the stream.
+class PacketQueue
 {
-  list<unique_ptr<AVPacket>> packetList{};
+  list<PacketPtr> packetList{};
   mutex pktListMutex{};
+
+public:
+  PacketQueue() = default;
+  PacketQueue(const PacketQueue &) = delete;
+  PacketQueue operator=(const PacketQueue &) = delete;
+
+  void push(PacketPtr pkt)
+  {
+    std::lock_guard<std::mutex> lg(pktListMutex);
+    packetList.push_back(std::move(pkt));
+  }
+
+  // false when the queue is empty, otherwise the front packet (maybe the nullptr end mark) is moved out.
+  bool pop(PacketPtr &pkt)
+  {
+    std::lock_guard<std::mutex> lg(pktListMutex);
+    if (packetList.empty())
+    {
+      return false;
+    }
+    pkt = std::move(packetList.front());
+    packetList.pop_front();
+    return true;
+  }
+
+  size_t size()
+  {
+    std::lock_guard<std::mutex> lg(pktListMutex);
+    return packetList.size();
+  }
+};
+
+class MediaProcessor
+{
+  PacketQueue packetQueue{};
   int PKT_WAITING_SIZE = 3;
   bool started = false;
   bool closed = false;
@@ -30,9 +79,16 @@ class MediaProcessor
 
   AVFrame *nextFrame = av_frame_alloc();
   AVPacket *targetPkt = nullptr;
+  bool filterFlushed = false;
+
+  std::function<void()> dataReadyCallback{};
 
   void nextFrameKeeper()
   {
+    bool video = codecCtx->codec_type == AVMEDIA_TYPE_VIDEO;
+    ffmpegUtil::ThreadPolicy::instance().apply(
+        video ? ffmpegUtil::ThreadPolicy::VIDEO_DECODER : ffmpegUtil::ThreadPolicy::AUDIO_DECODER,
+        (video ? "video decoder #" : "audio decoder #") + std::to_string(streamIndex));
     auto lastPrepareTime = std::chrono::system_clock::now();
     while (!streamFinished && started)
     {
@@ -49,7 +105,7 @@ class MediaProcessor
       // intervalTime=" << (diff.count() * 1000) << "ms" <<endl;
       prepareNextData();
     }
-    cout << "[THREAD] next frame keeper finished, index=" << streamIndex << endl;
+    ffmpegUtil::logInfo("[THREAD] next frame keeper finished, index=%d", streamIndex);
     started = false;
     closed = true;
   }
@@ -66,41 +122,109 @@ protected:
   condition_variable cv{};
   mutex nextDataMutex{};
 
+  // signaled when data gets ready or the stream finishes, for consumers that wait (sinks).
+  condition_variable readyCv{};
+  mutex readyMutex{};
+
+  void notifyReady()
+  {
+    std::lock_guard<std::mutex> lg(readyMutex);
+    readyCv.notify_all();
+  }
+
   std::atomic<bool> isNextDataReady{false};
 
   virtual void generateNextData(AVFrame *f) = 0;
 
-  unique_ptr<AVPacket> getNextPkt()
+  // optional filter stage between the decoder and generateNextData (VideoProcessor -vf).
+  // filterFrame(nullptr) flushes it, nextFiltered returns nullptr when it has nothing ready.
+  virtual bool hasFilter() { return false; }
+  virtual void filterFrame(AVFrame *f) {}
+  virtual AVFrame *nextFiltered() { return nullptr; }
+
+  // false when generateNextData did not produce enough for the consumer yet, decoding goes on
+  // (AudioProcessor filling a device callback).
+  virtual bool isNextDataComplete() { return true; }
+
+  // at the end of the stream: true when incomplete data is left, it is then handed out as is.
+  virtual bool hasPartialData() { return false; }
+
+  // video only: the per stage times shown by the StatsOverlay.
+  void addStageTime(std::atomic<uint64_t> &counter, std::chrono::steady_clock::time_point start)
+  {
+    if (codecCtx->codec_type == AVMEDIA_TYPE_VIDEO)
+    {
+      auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+      counter.fetch_add((uint64_t)us.count(), std::memory_order_relaxed);
+    }
+  }
+
+  PacketPtr getNextPkt()
   {
     if (noMorePkt)
     {
       return nullptr;
     }
-    std::lock_guard<std::mutex> lg(pktListMutex);
-    if (packetList.empty())
+    PacketPtr pkt{};
+    if (!packetQueue.pop(pkt))
     {
       return nullptr;
     }
-    else
+    if (pkt == nullptr)
     {
-      auto pkt = std::move(packetList.front());
-      if (pkt == nullptr)
-      {
-        noMorePkt = true;
-        return nullptr;
-      }
-      else
-      {
-        packetList.pop_front();
-        return pkt;
-      }
+      noMorePkt = true;
+    }
+    return pkt;
+  }
+
+  // a frame of the decoder (or of the filter) becomes the next data.
+  void setNextData(AVFrame *frame)
+  {
+    auto stageStart = std::chrono::steady_clock::now();
+    {
+      ffmpegUtil::TraceScope trace("convert");
+      generateNextData(frame);
+    }
+    addStageTime(ffmpegUtil::PlaybackStats::instance().videoConvertUs, stageStart);
+    if (!isNextDataComplete())
+    {
+      return;
+    }
+    publishNextData();
+  }
+
+  void publishNextData()
+  {
+    isNextDataReady.store(true);
+    notifyReady();
+    if (dataReadyCallback)
+    {
+      dataReadyCallback();
+    }
+  }
+
+  // filtered frames go first: one decoded frame may give several (yadif=1) or none (fps).
+  bool takeFiltered()
+  {
+    auto stageStart = std::chrono::steady_clock::now();
+    AVFrame *frame = nextFiltered();
+    addStageTime(ffmpegUtil::PlaybackStats::instance().videoFilterUs, stageStart);
+    if (frame == nullptr)
+    {
+      return false;
     }
+    setNextData(frame);
+    return true;
   }
 
   void prepareNextData()
   {
     while (!isNextDataReady.load() && !streamFinished)
     {
+      if (hasFilter() && takeFiltered())
+      {
+        continue;
+      }
       if (targetPkt == nullptr)
       {
         if (!noMorePkt)
@@ -122,13 +246,18 @@ protected:
         else
         {
           // no more pkt.
-          cout << "++++++++ no more pkt index=" << streamIndex
-               << " finished=" << streamFinished << endl;
+          ffmpegUtil::logDebug("++++++++ no more pkt index=%d finished=%d", streamIndex, (int)streamFinished);
         }
       }
 
+      auto &stats = ffmpegUtil::PlaybackStats::instance();
       int ret = -1;
-      ret = avcodec_send_packet(codecCtx, targetPkt);
+      auto stageStart = std::chrono::steady_clock::now();
+      {
+        ffmpegUtil::TraceScope trace("send packet");
+        ret = avcodec_send_packet(codecCtx, targetPkt);
+      }
+      addStageTime(stats.videoDecodeUs, stageStart);
       if (ret == 0)
       {
         av_packet_free(&targetPkt);
@@ -143,29 +272,63 @@ protected:
       else if (ret == AVERROR_EOF)
       {
         // no new packets can be sent to it, it is safe.
-        cout << "[WARN]  no new packets can be sent to it. index=" << streamIndex << endl;
+        ffmpegUtil::logWarn("no new packets can be sent to it. index=%d", streamIndex);
       }
       else
       {
         string errorMsg = "+++++++++ ERROR avcodec_send_packet error: ";
         errorMsg += ret;
-        cout << errorMsg << endl;
+        ffmpegUtil::logError("%s", errorMsg.c_str());
         throw std::runtime_error(errorMsg);
       }
 
-      ret = avcodec_receive_frame(codecCtx, nextFrame);
+      stageStart = std::chrono::steady_clock::now();
+      {
+        ffmpegUtil::TraceScope trace("receive frame");
+        ret = avcodec_receive_frame(codecCtx, nextFrame);
+      }
+      addStageTime(stats.videoDecodeUs, stageStart);
       if (ret == 0)
       {
         // cout << "avcodec_receive_frame success." << endl;
         // success.
-        generateNextData(nextFrame);
-        isNextDataReady.store(true);
+        if (codecCtx->codec_type == AVMEDIA_TYPE_VIDEO)
+        {
+          stats.videoFramesDecoded.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (hasFilter())
+        {
+          // picked up by takeFiltered, on this iteration or later ones.
+          stageStart = std::chrono::steady_clock::now();
+          filterFrame(nextFrame);
+          addStageTime(stats.videoFilterUs, stageStart);
+        }
+        else
+        {
+          setNextData(nextFrame);
+        }
+      }
+      else if (ret == AVERROR_EOF && hasFilter() && !filterFlushed)
+      {
+        // the filters may still hold frames (yadif, fps...).
+        filterFlushed = true;
+        filterFrame(nullptr);
+      }
+      else if (ret == AVERROR_EOF && hasPartialData())
+      {
+        // the tail first, the end is seen on the next pass.
+        publishNextData();
       }
       else if (ret == AVERROR_EOF)
       {
-        cout << "+++++++++++++++++++++++++++++ MediaProcessor no more output frames. index="
-             << streamIndex << endl;
+        ffmpegUtil::logInfo("+++++++++++++++++++++++++++++ MediaProcessor no more output frames. index=%d",
+                            streamIndex);
         streamFinished = true;
+        notifyReady();
+        if (dataReadyCallback)
+        {
+          dataReadyCallback(); // a consumer woken only by the callback sees the end as well
+        }
       }
       else if (ret == AVERROR(EAGAIN))
       {
@@ -175,7 +338,7 @@ protected:
       {
         string errorMsg = "avcodec_receive_frame error: ";
         errorMsg += ret;
-        cout << errorMsg << endl;
+        ffmpegUtil::logError("%s", errorMsg.c_str());
         throw std::runtime_error(errorMsg);
       }
     }
@@ -200,14 +363,7 @@ public:
       avcodec_free_context(&codecCtx);
     }
 
-    //very important here.
-    for (auto &p : packetList)
-    {
-      auto pkt = p.release();
-      av_packet_free(&pkt);
-    }
-
-    cout << "~MediaProcessor called. index=" << streamIndex << endl;
+    ffmpegUtil::logDebug("~MediaProcessor called. index=%d", streamIndex);
   }
   void start()
   {
@@ -231,83 +387,134 @@ public:
 
   bool isClosed() { return closed; }
 
-  void pushPkt(unique_ptr<AVPacket> pkt)
-  {
-    std::lock_guard<std::mutex> lg(pktListMutex);
-    packetList.push_back(std::move(pkt));
-  }
+  // called on the keeper thread every time new data is ready, and once when the stream finished.
+  // Set it before start().
+  void setDataReadyCallback(std::function<void()> callback) { dataReadyCallback = std::move(callback); }
+
+  // keep at most n packets waiting in front of the decoder.
+  void setPacketWaitingSize(int n) { PKT_WAITING_SIZE = n; }
+
+  void pushPkt(PacketPtr pkt) { packetQueue.push(std::move(pkt)); }
   bool isStreamFinished() { return streamFinished; }
 
-  bool needPacket()
+  // true when data is ready, false on timeout or when the stream is finished.
+  bool waitDataReady(int timeoutMs)
   {
-    bool need;
-    std::lock_guard<std::mutex> lg(pktListMutex);
-    need = packetList.size() < PKT_WAITING_SIZE;
-    return need;
+    std::unique_lock<std::mutex> lk{readyMutex};
+    readyCv.wait_for(lk, std::chrono::milliseconds(timeoutMs),
+                     [this] { return isNextDataReady.load() || streamFinished; });
+    return isNextDataReady.load();
   }
 
+  bool needPacket() { return packetQueue.size() < PKT_WAITING_SIZE; }
+
+  int getPacketQueueSize() { return (int)packetQueue.size(); }
+
+  // decoded data waiting for its consumer: 0 or 1, there is one slot.
+  int getReadyFrames() { return isNextDataReady.load() ? 1 : 0; }
+
   uint64_t getPts() { return currentTimestamp.load(); }
 };
 
 class AudioProcessor : public MediaProcessor
 {
   std::unique_ptr<ffmpegUtil::ReSampler> reSampler{};
+  std::unique_ptr<ffmpegUtil::AudioDsp> dsp{};
 
-  uint8_t *outBuffer = nullptr;
+  uint8_t *mixBuffer = nullptr; // ReSampler output, AudioDsp input
+  int mixBufferSize = -1;
+  uint8_t *outBuffer = nullptr; // AudioDsp output, in the device format
   int outBufferSize = -1;
   int outDataSize = -1;
   int outSamples = -1;
+  int readPos = 0;       // bytes of outBuffer already handed out
+  int callbackBytes = 0; // what the device takes per callback, 0: one decoded frame per callback
 
   ffmpegUtil::AudioInfo inAudio;
-  ffmpegUtil::AudioInfo outAudio;
+  ffmpegUtil::AudioInfo mixAudio; // ReSampler output, S16, 5.1 is kept for the downmix in AudioDsp
+  ffmpegUtil::AudioInfo outAudio; // AudioDsp output, the device format when there is a device
+
+  int64_t bytesToMs(int bytes) const
+  {
+    return (int64_t)bytes / getOutFrameBytes() * 1000 / outAudio.sampleRate;
+  }
+
+  void freeBuffers()
+  {
+    if (mixBuffer != nullptr)
+    {
+      av_freep(&mixBuffer);
+    }
+    if (outBuffer != nullptr)
+    {
+      av_freep(&outBuffer);
+    }
+  }
 
 protected:
+  // what the device did not take yet stays in front of the new frame: when the device rate
+  // differs from the stream rate, frames and callbacks no longer have the same size.
   void generateNextData(AVFrame *frame) final override
   {
+    int kept = outDataSize > readPos ? outDataSize - readPos : 0;
     if (outBuffer == nullptr)
     {
-      outBufferSize = reSampler->allocDataBuf(&outBuffer, frame->nb_samples);
+      // the mix of a frame, then room for it and what a callback left of the previous ones.
+      mixBufferSize = reSampler->allocDataBuf(&mixBuffer, frame->nb_samples);
+      int mixSamples = mixBufferSize / (mixAudio.channels * 2);
+      int callbackSamples = callbackBytes / getOutFrameBytes();
+      outBufferSize = (mixSamples + std::max(mixSamples, callbackSamples)) * getOutFrameBytes();
+      outBuffer = (uint8_t *)av_malloc(outBufferSize);
     }
-    else
+    else if (kept > 0 && readPos > 0)
     {
-      memset(outBuffer, 0, outBufferSize);
+      memmove(outBuffer, outBuffer + readPos, kept);
     }
-    std::tie(outSamples, outDataSize) = reSampler->reSample(outBuffer, outBufferSize, frame);
-    auto t = frame->pts * av_q2d(streamTimeBase) * 1000;
-    nextFrameTimestamp.store((uint64_t)t);
+    readPos = 0;
+    memset(outBuffer + kept, 0, outBufferSize - kept);
+    int dataSize;
+    std::tie(outSamples, dataSize) = reSampler->reSample(mixBuffer, mixBufferSize, frame);
+    outDataSize = kept + dsp->process((const int16_t *)mixBuffer, mixAudio.channels, outSamples, outBuffer + kept);
+    // the time of outBuffer[0].
+    auto t = frame->pts * av_q2d(streamTimeBase) * 1000 - bytesToMs(kept);
+    nextFrameTimestamp.store((uint64_t)std::max(0.0, t));
   }
 
+  bool isNextDataComplete() override { return outDataSize - readPos >= callbackBytes; }
+
+  // less than a callback left: writeAudioData pads it with silence.
+  bool hasPartialData() override { return outDataSize - readPos > 0; }
+
 public:
   AudioProcessor(const AudioProcessor &) = delete;
   AudioProcessor(AudioProcessor &&) noexcept = delete;
   AudioProcessor operator=(const AudioProcessor &) = delete;
   ~AudioProcessor()
   {
-    if (outBuffer != nullptr)
-    {
-      av_freep(&outBuffer);
-    }
-    cout << "~AudioProcessor() called." << endl;
+    freeBuffers();
+    ffmpegUtil::logDebug("~AudioProcessor() called.");
   }
 
-  AudioProcessor(AVFormatContext *formatCtx)
+  // index < 0 means the first audio stream of formatCtx.
+  AudioProcessor(AVFormatContext *formatCtx, int index = -1, bool lowDelay = false)
   {
     for (int i = 0; i < formatCtx->nb_streams; i++)
     {
-      if (formatCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO)
+      if (formatCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && (index < 0 || index == i))
       {
         streamTimeBase = formatCtx->streams[i]->time_base;
         streamIndex = i;
-        cout << "audio stream index = : [" << i << "] tb.n" << streamTimeBase.num << endl;
+        ffmpegUtil::logInfo("audio stream index = : [%d] tb.n%d", i, streamTimeBase.num);
         break;
       }
     }
     if (streamIndex < 0)
     {
-      cout << "WARN: can not find audio stream." << endl;
+      ffmpegUtil::logWarn("can not find audio stream.");
+      throw std::runtime_error("can not find audio stream.");
     }
 
-    ffmpegUtil::ffutils::initCodec(formatCtx, streamIndex, &codecCtx);
+    ffmpegUtil::ffutils::initCodec(formatCtx, streamIndex, &codecCtx, lowDelay);
 
     int64_t inLayout = codecCtx->channel_layout;
     int inSampleRate = codecCtx->sample_rate;
@@ -316,16 +523,63 @@ public:
 
     inAudio = ffmpegUtil::AudioInfo(inLayout, inSampleRate, inChannels, inFormat);
     outAudio = ffmpegUtil::ReSampler::getDefaultAudioInfo(inSampleRate);
+    mixAudio = outAudio;
+    if (inChannels == 6 &&
+        (inLayout == AV_CH_LAYOUT_5POINT1 || inLayout == AV_CH_LAYOUT_5POINT1_BACK || inLayout == 0))
+    {
+      mixAudio = ffmpegUtil::AudioInfo(inLayout != 0 ? inLayout : AV_CH_LAYOUT_5POINT1, inSampleRate, 6,
+                                       AV_SAMPLE_FMT_S16);
+    }
 
-    reSampler.reset(new ffmpegUtil::ReSampler(inAudio, outAudio));
+    reSampler.reset(new ffmpegUtil::ReSampler(inAudio, mixAudio));
+    dsp.reset(new ffmpegUtil::AudioDsp(inSampleRate));
   }
 
+  // 1.0 is unity gain, can be changed while playing.
+  void setVolume(float volume) { dsp->setVolume(volume); }
+  float getVolume() const { return dsp->getVolume(); }
+
   int getAudioIndex() const { return streamIndex; }
 
   int getSamples() { return outSamples; }
 
-  void writeAudioData(uint8_t *stream, int len)
+  // the SDL device runs at its own rate, sample format and channel count: the ReSampler converts
+  // to the rate in the same pass as the format / layout conversion, AudioDsp writes the format
+  // and the channels, so SDL converts nothing. format: AV_SAMPLE_FMT_S16 or AV_SAMPLE_FMT_FLT.
+  // samples: per callback, decoded frames are then gathered until a callback is full. Called
+  // once the device is open.
+  void setDeviceOutput(int sampleRate, AVSampleFormat format, int channels, int samples)
   {
+    {
+      std::lock_guard<std::mutex> lock(nextDataMutex);
+      if (sampleRate != outAudio.sampleRate || format != outAudio.format || channels != outAudio.channels)
+      {
+        if (sampleRate != outAudio.sampleRate)
+        {
+          mixAudio.sampleRate = sampleRate;
+          reSampler.reset(new ffmpegUtil::ReSampler(inAudio, mixAudio));
+          float volume = dsp->getVolume();
+          dsp.reset(new ffmpegUtil::AudioDsp(sampleRate));
+          dsp->setVolume(volume);
+        }
+        outAudio = ffmpegUtil::AudioInfo(av_get_default_channel_layout(channels), sampleRate, channels, format);
+        dsp->setOutput(format == AV_SAMPLE_FMT_FLT ? ffmpegUtil::AudioDsp::OUT_F32 : ffmpegUtil::AudioDsp::OUT_S16,
+                       channels);
+        // a frame converted for the old output (codecs without a frame size) is dropped.
+        freeBuffers();
+        outDataSize = -1;
+        readPos = 0;
+        isNextDataReady.store(false);
+      }
+      callbackBytes = samples * getOutFrameBytes();
+    }
+    cv.notify_one();
+  }
+
+  // false when there was no decoded data and silence was written.
+  bool writeAudioData(uint8_t *stream, int len)
+  {
+    bool written = false;
     static uint8_t *silenceBuff = nullptr;
     if (silenceBuff == nullptr)
     {
@@ -336,23 +590,33 @@ public:
     if (isNextDataReady.load())
     {
       std::lock_guard<std::mutex> lock(nextDataMutex);
-      currentTimestamp.store(nextFrameTimestamp.load());
-      if (outDataSize != len)
+      currentTimestamp.store(nextFrameTimestamp.load() + bytesToMs(readPos));
+      int bytes = std::min(len, outDataSize - readPos);
+      if (bytes != len)
       {
-        cout << "WARNING: outDataSize[" << outDataSize << "] != len[" << len << "]" << endl;
+        ffmpegUtil::logWarn("outDataSize[%d] != len[%d]", bytes, len);
+        std::memset(stream + bytes, 0, len - bytes);
       }
-      std::memcpy(stream, outBuffer, outDataSize);
-      isNextDataReady.store(false);
+      std::memcpy(stream, outBuffer + readPos, bytes);
+      readPos += bytes;
+      // a whole callback left over (device faster than the stream rate): no decoding needed for it.
+      isNextDataReady.store(outDataSize - readPos >= len && bytes == len);
+      written = true;
     }
     else
     {
       // if list is empty, silent will be written.
-      cout << "WARNING: writeAudioData, audio data not ready." << endl;
+      ffmpegUtil::PlaybackStats::instance().audioUnderruns.fetch_add(1, std::memory_order_relaxed);
+      ffmpegUtil::logWarn("writeAudioData, audio data not ready.");
       std::memcpy(stream, silenceBuff, len);
     }
     cv.notify_one();
+    return written;
   }
 
+  // samples per decoded frame, known once the codec is open; 0 when the codec does not say.
+  int getCodecFrameSize() const { return codecCtx != nullptr ? codecCtx->frame_size : 0; }
+
   int getInChannels() const
   {
     if (codecCtx != nullptr)
@@ -367,6 +631,29 @@ public:
 
   int getOutChannels() const { return outAudio.channels; }
 
+  // bytes of one interleaved output frame (all channels).
+  int getOutFrameBytes() const { return outAudio.channels * av_get_bytes_per_sample(outAudio.format); }
+
+  const ffmpegUtil::AudioInfo &getOutAudioInfo() const { return outAudio; }
+
+  // non-realtime path: hand the ready buffer to the sink, false when nothing was ready.
+  bool feed(AudioSink &sink)
+  {
+    if (!isNextDataReady.load())
+    {
+      return false;
+    }
+    {
+      std::lock_guard<std::mutex> lock(nextDataMutex);
+      currentTimestamp.store(nextFrameTimestamp.load() + bytesToMs(readPos));
+      sink.write(outBuffer + readPos, outDataSize - readPos, currentTimestamp.load());
+      readPos = outDataSize;
+      isNextDataReady.store(false);
+    }
+    cv.notify_one();
+    return true;
+  }
+
   int getInChannleLayout() const
   {
     if (codecCtx != nullptr)
@@ -410,71 +697,273 @@ public:
 
 class VideoProcessor : public MediaProcessor
 {
-  struct SwsContext *sws_ctx = nullptr;
-  AVFrame *outPic = nullptr;
+  // what converts one source size / format to the YUV420P output: the scaler, the same size
+  // kernel and the picture they write.
+  struct Conversion
+  {
+    int srcW = 0;
+    int srcH = 0;
+    AVPixelFormat srcFormat = AV_PIX_FMT_NONE;
+    struct SwsContext *sws_ctx = nullptr;
+    // same size repack / bit depth reduction without swscale, nullptr when the format has no kernel.
+    ffmpegUtil::PixelConvert::Fn convert = nullptr;
+    AVFrame *outPic = nullptr;
+    uint64_t lastUse = 0;
+  };
+
+  // a stream switching between a few sizes / formats (adaptive streams, spliced recordings) finds
+  // its conversions here again, nothing is reallocated when it switches back.
+  static const size_t MAX_CONVERSIONS = 4;
+  std::vector<Conversion> conversions{}; // reserved, the pointers into it stay valid
+  Conversion *conversion = nullptr;      // of the current source
+  uint64_t conversionUses = 0;
+  int outWidth = 0;
+  int outHeight = 0;
+  bool followSource = false; // the output takes the size of every source instead of outWidth x outHeight
+  AVFrame *outPic = nullptr; // conversion->outPic, the frame handed out
+  ffmpegUtil::ShmFrameWriter *frameExport = nullptr;
+  ffmpegUtil::SceneDetector *sceneDetector = nullptr;
+  std::unique_ptr<ffmpegUtil::VideoFilter> filter{};
+  AVRational frameTimeBase{1, 0}; // of the frames given to generateNextData
+  std::function<bool(int64_t)> frameSelector{};
+  bool frameSkipped = false;
+
+  void freeConversions()
+  {
+    for (auto &c : conversions)
+    {
+      sws_freeContext(c.sws_ctx);
+      // the planes go back to the FramePool.
+      av_frame_free(&c.outPic);
+    }
+    conversions.clear();
+    conversion = nullptr;
+    outPic = nullptr;
+  }
+
+  // the conversion of a srcW x srcH srcFormat source, cached or built in place of the least
+  // recently used one. cached: it was found.
+  Conversion *findConversion(int srcW, int srcH, AVPixelFormat srcFormat, bool &cached)
+  {
+    Conversion *c = nullptr;
+    for (auto &candidate : conversions)
+    {
+      if (candidate.srcW == srcW && candidate.srcH == srcH && candidate.srcFormat == srcFormat)
+      {
+        c = &candidate;
+      }
+    }
+    cached = c != nullptr;
+    if (c == nullptr)
+    {
+      if (conversions.size() < MAX_CONVERSIONS)
+      {
+        conversions.emplace_back();
+        c = &conversions.back();
+      }
+      else
+      {
+        c = &*std::min_element(conversions.begin(), conversions.end(),
+                               [](const Conversion &a, const Conversion &b) { return a.lastUse < b.lastUse; });
+        sws_freeContext(c->sws_ctx);
+        av_frame_free(&c->outPic);
+        *c = Conversion{};
+      }
+      int w = followSource ? srcW : outWidth;
+      int h = followSource ? srcH : outHeight;
+      c->srcW = srcW;
+      c->srcH = srcH;
+      c->srcFormat = srcFormat;
+      c->sws_ctx = sws_getContext(srcW, srcH, srcFormat, w, h, AV_PIX_FMT_YUV420P, SWS_BILINEAR, NULL, NULL, NULL);
+      const char *isa = nullptr;
+      c->convert = srcW == w && srcH == h ? ffmpegUtil::PixelConvert::find(srcFormat, &isa) : nullptr; // no scaling
+      if (c->convert != nullptr)
+      {
+        ffmpegUtil::logInfo("video convert: %s -> yuv420p, %s kernel", av_get_pix_fmt_name(srcFormat), isa);
+      }
+      c->outPic = av_frame_alloc();
+      ffmpegUtil::FramePool::instance().allocPicture(c->outPic, AV_PIX_FMT_YUV420P, w, h);
+    }
+    c->lastUse = ++conversionUses;
+    return c;
+  }
+
+  // drops the cached conversions, starts over from the current source (the decoder, or the
+  // filter output).
+  void resetConversion()
+  {
+    freeConversions();
+    conversions.reserve(MAX_CONVERSIONS);
+    int srcW = filter != nullptr ? filter->getWidth() : codecCtx->width;
+    int srcH = filter != nullptr ? filter->getHeight() : codecCtx->height;
+    AVPixelFormat srcFormat = filter != nullptr ? filter->getFormat() : codecCtx->pix_fmt;
+    bool cached = false;
+    conversion = findConversion(srcW, srcH, srcFormat, cached);
+    outPic = conversion->outPic;
+  }
+
+  // the frames changed size or pixel format mid-stream, the codec context still announces the first.
+  void switchConversion(const AVFrame *frame)
+  {
+    auto start = std::chrono::steady_clock::now();
+    int fromW = conversion->srcW;
+    int fromH = conversion->srcH;
+    AVPixelFormat fromFormat = conversion->srcFormat;
+    bool cached = false;
+    conversion = findConversion(frame->width, frame->height, (AVPixelFormat)frame->format, cached);
+    outPic = conversion->outPic;
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    auto &stats = ffmpegUtil::PlaybackStats::instance();
+    stats.formatSwitches.fetch_add(1, std::memory_order_relaxed);
+    stats.formatSwitchUs.fetch_add((uint64_t)us, std::memory_order_relaxed);
+    if (cached)
+    {
+      stats.formatSwitchesCached.fetch_add(1, std::memory_order_relaxed);
+    }
+    ffmpegUtil::TraceRecorder::instance().instant("format switch");
+    ffmpegUtil::logInfo("video source %dx%d %s -> %dx%d %s, output %dx%d, %s conversion in %lldus", fromW, fromH,
+                        av_get_pix_fmt_name(fromFormat), frame->width, frame->height,
+                        av_get_pix_fmt_name((AVPixelFormat)frame->format), outPic->width, outPic->height,
+                        cached ? "cached" : "new", (long long)us);
+  }
 
 protected:
   void generateNextData(AVFrame *frame) override
   {
-    auto t = frame->pts * av_q2d(streamTimeBase) * 1000;
+    auto t = frame->pts * av_q2d(frameTimeBase) * 1000;
+    if (sceneDetector != nullptr)
+    {
+      ffmpegUtil::TraceScope trace("scene submit");
+      sceneDetector->submit(frame, (int64_t)t); // every frame, also the ones the selector skips
+    }
+    frameSkipped = frameSelector && !frameSelector((int64_t)t);
+    if (frameSkipped)
+    {
+      return; // decoded (the next frames may need it), never converted
+    }
     nextFrameTimestamp.store((uint64_t)t);
-    sws_scale(sws_ctx, (uint8_t const *const *)frame->data, frame->linesize, 0,
-              codecCtx->height, outPic->data, outPic->linesize);
+    if (frame->width != conversion->srcW || frame->height != conversion->srcH ||
+        frame->format != conversion->srcFormat)
+    {
+      switchConversion(frame);
+    }
+    if (conversion->convert != nullptr)
+    {
+      conversion->convert(frame, outPic, outPic->width, outPic->height);
+    }
+    else
+    {
+      sws_scale(conversion->sws_ctx, (uint8_t const *const *)frame->data, frame->linesize, 0,
+                frame->height, outPic->data, outPic->linesize);
+    }
+    if (frameExport != nullptr)
+    {
+      ffmpegUtil::TraceScope trace("shm export");
+      frameExport->publish(outPic, (int64_t)t);
+    }
     // unlock nextFrame
   }
 
+  bool hasFilter() override { return filter != nullptr; }
+
+  void filterFrame(AVFrame *frame) override { filter->push(frame); }
+
+  AVFrame *nextFiltered() override { return filter->pull(); }
+
+  bool isNextDataComplete() override { return !frameSkipped; }
+
 public:
   VideoProcessor(const VideoProcessor &) = delete;
   VideoProcessor(VideoProcessor &&) noexcept = delete;
   VideoProcessor operator=(const VideoProcessor &) = delete;
   ~VideoProcessor()
   {
-    if (sws_ctx != nullptr)
-    {
-      sws_freeContext(sws_ctx);
-      sws_ctx = nullptr;
-    }
-
-    if (outPic != nullptr)
-    {
-      av_frame_free(&outPic);
-    }
-    cout << "~VideoProcessor() called." << endl;
+    freeConversions();
+    ffmpegUtil::logDebug("~VideoProcessor() called.");
   }
 
-  VideoProcessor(AVFormatContext *formatCtx)
+  // index < 0 means the first video stream of formatCtx.
+  VideoProcessor(AVFormatContext *formatCtx, int index = -1, bool lowDelay = false)
   {
     for (int i = 0; i < formatCtx->nb_streams; i++)
     {
-      if (formatCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO)
+      if (formatCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && (index < 0 || index == i))
       {
         streamIndex = i;
         streamTimeBase = formatCtx->streams[i]->time_base;
-        cout << "video stream index = : [" << i << "] tb.n" << streamTimeBase.num << endl;
+        ffmpegUtil::logInfo("video stream index = : [%d] tb.n%d", i, streamTimeBase.num);
         break;
       }
     }
 
     if (streamIndex < 0)
     {
-      cout << "WARN: can not find video stream." << endl;
+      ffmpegUtil::logWarn("can not find video stream.");
+      throw std::runtime_error("can not find video stream.");
     }
 
-    ffmpegUtil::ffutils::initCodec(formatCtx, streamIndex, &codecCtx);
+    ffmpegUtil::ffutils::initCodec(formatCtx, streamIndex, &codecCtx, lowDelay);
+    frameTimeBase = streamTimeBase;
+    outWidth = codecCtx->width;
+    outHeight = codecCtx->height;
+    resetConversion();
+  }
 
-    int w = codecCtx->width;
-    int h = codecCtx->height;
+  int getVideoIndex() const { return streamIndex; }
 
-    sws_ctx = sws_getContext(w, h, codecCtx->pix_fmt, w, h, AV_PIX_FMT_YUV420P, SWS_BILINEAR,
-                             NULL, NULL, NULL);
+  // scale to w x h instead of the stream size (mosaic tiles), on the decoder thread like the
+  // conversion. Every frame has this size, also after the source changed size. Call it before start().
+  void setOutputSize(int w, int h)
+  {
+    outWidth = w;
+    outHeight = h;
+    followSource = false;
+    resetConversion();
+  }
 
-    int numBytes = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, w, h, 32);
-    outPic = av_frame_alloc();
-    uint8_t *buffer = (uint8_t *)av_malloc(numBytes * sizeof(uint8_t));
-    av_image_fill_arrays(outPic->data, outPic->linesize, buffer, AV_PIX_FMT_YUV420P, w, h, 32);
+  // follow: when the source changes size mid-stream the output does too (the SDL sink re-creates
+  // its texture), instead of scaling to the first size. Only for sinks that take any frame size.
+  // Call it before start().
+  void setFollowSource(bool follow)
+  {
+    followSource = follow;
+    resetConversion();
   }
 
-  int getVideoIndex() const { return streamIndex; }
+  // run the decoded frames through a libavfilter description (-vf) before the conversion, with
+  // that many slice threads (0: automatic). The output size stays: a filter that changes the size
+  // is scaled back to it, unless the output follows the source. Call it before start().
+  void setFilter(const string &description, int threads)
+  {
+    filter.reset(new ffmpegUtil::VideoFilter(description, threads, codecCtx->width, codecCtx->height,
+                                             codecCtx->pix_fmt, streamTimeBase, codecCtx->sample_aspect_ratio));
+    frameTimeBase = filter->getTimeBase();
+    resetConversion();
+  }
+
+  // only the frames selector(ptsMs) accepts are converted and handed out, the others are decoded
+  // and dropped on the decoder thread (-tensor sampling). Set it before start().
+  void setFrameSelector(std::function<bool(int64_t)> selector) { frameSelector = std::move(selector); }
+
+  // every decoded frame is also published to the ring (decoder thread), set it before start().
+  void setFrameExport(ffmpegUtil::ShmFrameWriter *writer) { frameExport = writer; }
+
+  // every decoded (filtered) frame is also referenced to the detector, which analyzes it on its
+  // own thread. Set it before start().
+  void setSceneDetector(ffmpegUtil::SceneDetector *detector) { sceneDetector = detector; }
+
+  // non-realtime path: hand the ready frame to the sink, false when nothing was ready.
+  bool feed(VideoSink &sink)
+  {
+    if (!isNextDataReady.load())
+    {
+      return false;
+    }
+    currentTimestamp.store(nextFrameTimestamp.load());
+    sink.write(outPic, currentTimestamp.load());
+    return refreshFrame();
+  }
 
   AVFrame *getFrame()
   {
@@ -485,7 +974,7 @@ public:
     }
     else
     {
-      cout << "WARNING: getFrame, video data not ready." << endl;
+      ffmpegUtil::logWarn("getFrame, video data not ready.");
       return nullptr;
     }
   }
@@ -0,0 +1,183 @@
+#pragma once
+
+#include "logger.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ffmpegUtil
+{
+
+// A .npy file (numpy format 1.0) written through memory mapped batches:
+//
+//   [header, HEADER_BYTES][item 0][item 1]...     numpy.load(path, mmap_mode="r") reads it in place
+//
+// Items have a fixed shape, their count grows: next() hands out the slot of the next item inside
+// the mapped batch, a new batch of `batch` items is mapped (and the file extended) when the current
+// one is full. The header is rewritten at every batch and on close, so a partly written file still
+// loads with the items done so far.
+class NpyBatchWriter
+{
+    // a whole page, the item data starts page aligned.
+    static const size_t HEADER_BYTES = 4096;
+
+    std::string path;
+    std::string descr;
+    std::vector<int> itemShape;
+    size_t itemBytes;
+    size_t batch;
+    int fd = -1;
+    uint8_t *mapped = nullptr; // page aligned start of the mapping
+    size_t mappedBytes = 0;
+    uint8_t *batchData = nullptr;
+    size_t batchUsed = 0;
+    uint64_t count = 0;
+
+    static void fail(const std::string &what)
+    {
+        std::string errMsg = what + ": " + std::strerror(errno);
+        logError("%s", errMsg.c_str());
+        throw std::runtime_error(errMsg);
+    }
+
+#ifndef _WIN32
+    void writeHeader()
+    {
+        std::string shape = "(" + std::to_string(count);
+        for (int d : itemShape)
+        {
+            shape += ", " + std::to_string(d);
+        }
+        shape += ")";
+        std::string dict = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': " + shape + ", }";
+        std::string header = "\x93NUMPY";
+        header += (char)1; // version 1.0
+        header += (char)0;
+        uint16_t dictBytes = (uint16_t)(HEADER_BYTES - 10);
+        header += (char)(dictBytes & 0xFF); // little endian
+        header += (char)(dictBytes >> 8);
+        header += dict;
+        header.append(HEADER_BYTES - 1 - header.size(), ' ');
+        header += '\n';
+        if (pwrite(fd, header.data(), header.size(), 0) != (ssize_t)header.size())
+        {
+            fail("can not write npy header " + path);
+        }
+    }
+
+    void unmapBatch()
+    {
+        if (mapped != nullptr)
+        {
+            munmap(mapped, mappedBytes);
+            mapped = nullptr;
+            batchData = nullptr;
+        }
+    }
+
+    void mapBatch()
+    {
+        unmapBatch();
+        off_t start = (off_t)(HEADER_BYTES + count * itemBytes);
+        off_t end = start + (off_t)(batch * itemBytes);
+        if (ftruncate(fd, end) != 0)
+        {
+            fail("can not extend " + path);
+        }
+        long page = sysconf(_SC_PAGESIZE);
+        off_t mapStart = start / page * page;
+        mappedBytes = (size_t)(end - mapStart);
+        void *p = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mapStart);
+        if (p == MAP_FAILED)
+        {
+            mapped = nullptr;
+            fail("can not map " + path);
+        }
+        mapped = (uint8_t *)p;
+        batchData = mapped + (start - mapStart);
+        batchUsed = 0;
+        writeHeader();
+    }
+#endif
+
+public:
+    // descr: numpy dtype string ("<f4", "|u1"). shape: of one item.
+    NpyBatchWriter(const std::string &filePath, const std::string &dtype, const std::vector<int> &shape,
+                   size_t bytesPerItem, size_t itemsPerBatch)
+        : path(filePath), descr(dtype), itemShape(shape), itemBytes(bytesPerItem),
+          batch(itemsPerBatch > 0 ? itemsPerBatch : 1)
+    {
+#ifdef _WIN32
+        std::string errMsg = "npy export is not supported on this platform";
+        logError("%s", errMsg.c_str());
+        throw std::runtime_error(errMsg);
+#else
+        fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+        if (fd < 0)
+        {
+            fail("can not create " + path);
+        }
+        writeHeader();
+#endif
+    }
+
+    NpyBatchWriter(const NpyBatchWriter &) = delete;
+    NpyBatchWriter &operator=(const NpyBatchWriter &) = delete;
+
+    ~NpyBatchWriter() { close(); }
+
+    // the memory of the next item, written in place. Valid until the next call.
+    uint8_t *next()
+    {
+#ifdef _WIN32
+        return nullptr;
+#else
+        if (batchData == nullptr || batchUsed == batch)
+        {
+            mapBatch();
+        }
+        uint8_t *item = batchData + batchUsed * itemBytes;
+        batchUsed++;
+        count++;
+        return item;
+#endif
+    }
+
+    uint64_t getCount() const { return count; }
+
+    // final header, the unused end of the last batch is cut off.
+    void close()
+    {
+#ifndef _WIN32
+        if (fd < 0)
+        {
+            return;
+        }
+        unmapBatch();
+        if (ftruncate(fd, (off_t)(HEADER_BYTES + count * itemBytes)) != 0)
+        {
+            logWarn("can not truncate %s: %s", path.c_str(), std::strerror(errno));
+        }
+        writeHeader();
+        ::close(fd);
+        fd = -1;
+        logInfo("npy export: %s, %llu items of %zuKB", path.c_str(), (unsigned long long)count,
+                (size_t)(itemBytes / 1024));
+#endif
+    }
+};
+
+} // namespace ffmpegUtil
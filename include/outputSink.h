@@ -0,0 +1,226 @@
+#pragma once
+
+#include "ffmpegUtil.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <functional>
+#include <string>
+
+// Where decoded data goes. VideoProcessor / AudioProcessor feed sinks, play() picks them.
+//
+// Realtime sinks (SDL) are paced: video by the refresh timer and A/V sync, audio by the device
+// pulling through AudioProcessor::writeAudioData. Every other sink is fed as fast as the decoder
+// produces data, so batch jobs and benchmarks run unthrottled.
+
+class VideoSink
+{
+public:
+    virtual ~VideoSink() {}
+
+    virtual bool isRealtime() const { return false; }
+
+    virtual void open(int width, int height, AVRational frameRate) = 0;
+
+    // frame is YUV420P and only valid during the call.
+    virtual void write(const AVFrame *frame, uint64_t ptsMs) = 0;
+
+    virtual void close() {}
+};
+
+class AudioSink
+{
+public:
+    virtual ~AudioSink() {}
+
+    virtual bool isRealtime() const { return false; }
+
+    // samples: frames per write, a hint for device sinks.
+    virtual void open(const ffmpegUtil::AudioInfo &info, int samples) = 0;
+
+    // interleaved samples in the format given to open().
+    virtual void write(const uint8_t *data, int size, uint64_t ptsMs) = 0;
+
+    virtual void close() {}
+};
+
+// drops everything, counts what it got.
+class NullVideoSink : public VideoSink
+{
+    uint64_t frames = 0;
+
+public:
+    void open(int, int, AVRational) override {}
+    void write(const AVFrame *, uint64_t) override { frames++; }
+    void close() override { ffmpegUtil::logInfo("null video sink: frames = %llu", (unsigned long long)frames); }
+};
+
+class NullAudioSink : public AudioSink
+{
+    uint64_t bytes = 0;
+
+public:
+    void open(const ffmpegUtil::AudioInfo &, int) override {}
+    void write(const uint8_t *, int size, uint64_t) override { bytes += size; }
+    void close() override { ffmpegUtil::logInfo("null audio sink: bytes = %llu", (unsigned long long)bytes); }
+};
+
+// hands every frame / buffer to user code.
+class CallbackVideoSink : public VideoSink
+{
+    std::function<void(const AVFrame *, uint64_t)> callback;
+
+public:
+    explicit CallbackVideoSink(std::function<void(const AVFrame *, uint64_t)> cb) : callback(std::move(cb)) {}
+    void open(int, int, AVRational) override {}
+    void write(const AVFrame *frame, uint64_t ptsMs) override { callback(frame, ptsMs); }
+};
+
+class CallbackAudioSink : public AudioSink
+{
+    std::function<void(const uint8_t *, int, uint64_t)> callback;
+
+public:
+    explicit CallbackAudioSink(std::function<void(const uint8_t *, int, uint64_t)> cb) : callback(std::move(cb)) {}
+    void open(const ffmpegUtil::AudioInfo &, int) override {}
+    void write(const uint8_t *data, int size, uint64_t ptsMs) override { callback(data, size, ptsMs); }
+};
+
+namespace ffmpegUtil
+{
+// "-" is stdout, so the writers can feed a pipe.
+inline FILE *openOutputFile(const string &path)
+{
+    FILE *f = path == "-" ? stdout : std::fopen(path.c_str(), "wb");
+    if (f == nullptr)
+    {
+        string errorMsg = "Can not open output file:";
+        errorMsg += path;
+        logError("%s", errorMsg.c_str());
+        throw std::runtime_error(errorMsg);
+    }
+    return f;
+}
+} // namespace ffmpegUtil
+
+// raw YUV4MPEG2 stream, what ffmpeg / x264 / mpv read from a pipe.
+class Y4mVideoSink : public VideoSink
+{
+    const std::string path;
+    FILE *file = nullptr;
+    int width = 0;
+    int height = 0;
+
+public:
+    explicit Y4mVideoSink(const std::string &p) : path(p) {}
+    ~Y4mVideoSink() { close(); }
+
+    void open(int w, int h, AVRational frameRate) override
+    {
+        width = w;
+        height = h;
+        if (frameRate.num <= 0 || frameRate.den <= 0)
+        {
+            frameRate = AVRational{25, 1};
+        }
+        file = ffmpegUtil::openOutputFile(path);
+        std::fprintf(file, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg\n", w, h, frameRate.num, frameRate.den);
+    }
+
+    void write(const AVFrame *frame, uint64_t) override
+    {
+        std::fputs("FRAME\n", file);
+        for (int plane = 0; plane < 3; plane++)
+        {
+            int w = plane == 0 ? width : (width + 1) / 2;
+            int h = plane == 0 ? height : (height + 1) / 2;
+            for (int y = 0; y < h; y++)
+            {
+                std::fwrite(frame->data[plane] + y * frame->linesize[plane], 1, w, file);
+            }
+        }
+    }
+
+    void close() override
+    {
+        if (file != nullptr)
+        {
+            std::fflush(file);
+            if (file != stdout)
+            {
+                std::fclose(file);
+            }
+            file = nullptr;
+        }
+    }
+};
+
+// RIFF WAVE, the sizes are patched on close when the output is seekable.
+class WavAudioSink : public AudioSink
+{
+    const std::string path;
+    FILE *file = nullptr;
+    uint32_t dataBytes = 0;
+
+    void writeLe(uint32_t v, int bytes)
+    {
+        for (int i = 0; i < bytes; i++)
+        {
+            std::fputc((v >> (8 * i)) & 0xFF, file);
+        }
+    }
+
+public:
+    explicit WavAudioSink(const std::string &p) : path(p) {}
+    ~WavAudioSink() { close(); }
+
+    void open(const ffmpegUtil::AudioInfo &info, int) override
+    {
+        if (av_sample_fmt_is_planar(info.format))
+        {
+            throw std::runtime_error("WavAudioSink: planar sample formats are not supported");
+        }
+        int bytesPerSample = av_get_bytes_per_sample(info.format);
+        bool isFloat = info.format == AV_SAMPLE_FMT_FLT || info.format == AV_SAMPLE_FMT_DBL;
+
+        file = ffmpegUtil::openOutputFile(path);
+        std::fwrite("RIFF", 1, 4, file);
+        writeLe(0xFFFFFFFF, 4); // unknown yet, streaming readers accept it.
+        std::fwrite("WAVEfmt ", 1, 8, file);
+        writeLe(16, 4);
+        writeLe(isFloat ? 3 : 1, 2);
+        writeLe(info.channels, 2);
+        writeLe(info.sampleRate, 4);
+        writeLe(info.sampleRate * info.channels * bytesPerSample, 4);
+        writeLe(info.channels * bytesPerSample, 2);
+        writeLe(bytesPerSample * 8, 2);
+        std::fwrite("data", 1, 4, file);
+        writeLe(0xFFFFFFFF, 4);
+    }
+
+    void write(const uint8_t *data, int size, uint64_t) override
+    {
+        std::fwrite(data, 1, size, file);
+        dataBytes += size;
+    }
+
+    void close() override
+    {
+        if (file == nullptr)
+        {
+            return;
+        }
+        if (file != stdout && std::fseek(file, 4, SEEK_SET) == 0)
+        {
+            writeLe(36 + dataBytes, 4);
+            std::fseek(file, 40, SEEK_SET);
+            writeLe(dataBytes, 4);
+        }
+        std::fflush(file);
+        if (file != stdout)
+        {
+            std::fclose(file);
+        }
+        file = nullptr;
+    }
+};
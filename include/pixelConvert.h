@@ -0,0 +1,256 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+#ifdef __cplusplus
+};
+#endif
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PIXEL_CONVERT_SSE2 1
+#endif
+
+// AVX2 is compiled per function (target attribute) and picked at runtime, the build stays generic.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PIXEL_CONVERT_AVX2 1
+#endif
+
+namespace ffmpegUtil
+{
+
+// Same size conversions to YUV420P that need no scaling, done without swscale:
+//   NV12 / NV21     -> copy Y, deinterleave the chroma plane.
+//   YUV420P10LE/12LE -> round every sample down to 8 bits.
+// Each kernel is a template instantiated per source format and per instruction set, find() returns
+// the best one for this CPU, or nullptr when the format has none (swscale then).
+//
+// 8 bit formats match swscale exactly. For the high bit depths swscale dithers while we round,
+// samples differ by at most 1 (player_microbench pixel_convert checks both).
+class PixelConvert
+{
+public:
+    typedef void (*Fn)(const AVFrame *src, AVFrame *dst, int width, int height);
+
+    enum Isa
+    {
+        SCALAR,
+        SSE2,
+        AVX2
+    };
+
+private:
+    template <Isa ISA> struct Rows;
+
+    template <typename R, bool SWAP> static void convertNv(const AVFrame *src, AVFrame *dst, int width, int height)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            std::memcpy(dst->data[0] + y * dst->linesize[0], src->data[0] + y * src->linesize[0], width);
+        }
+        int cw = (width + 1) / 2;
+        int ch = (height + 1) / 2;
+        for (int y = 0; y < ch; y++)
+        {
+            uint8_t *u = dst->data[1] + y * dst->linesize[1];
+            uint8_t *v = dst->data[2] + y * dst->linesize[2];
+            R::template deinterleave<SWAP>(src->data[1] + y * src->linesize[1], u, v, cw);
+        }
+    }
+
+    template <typename R, int BITS> static void convertHigh(const AVFrame *src, AVFrame *dst, int width, int height)
+    {
+        for (int p = 0; p < 3; p++)
+        {
+            int w = p == 0 ? width : (width + 1) / 2;
+            int h = p == 0 ? height : (height + 1) / 2;
+            for (int y = 0; y < h; y++)
+            {
+                R::template reduce<BITS>((const uint16_t *)(src->data[p] + y * src->linesize[p]),
+                                         dst->data[p] + y * dst->linesize[p], w);
+            }
+        }
+    }
+
+    template <typename R> static Fn select(AVPixelFormat format)
+    {
+        switch (format)
+        {
+        case AV_PIX_FMT_NV12:
+            return convertNv<R, false>;
+        case AV_PIX_FMT_NV21:
+            return convertNv<R, true>;
+        case AV_PIX_FMT_YUV420P10LE:
+            return convertHigh<R, 10>;
+        case AV_PIX_FMT_YUV420P12LE:
+            return convertHigh<R, 12>;
+        default:
+            return nullptr;
+        }
+    }
+
+    static bool hasAvx2()
+    {
+#ifdef PIXEL_CONVERT_AVX2
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        return avx2;
+#else
+        return false;
+#endif
+    }
+
+public:
+    // kernel of one instruction set, nullptr when the format has none or the CPU can not run it.
+    static Fn find(AVPixelFormat format, Isa isa);
+
+    // the fastest kernel for this CPU.
+    static Fn find(AVPixelFormat format, const char **isaName = nullptr);
+};
+
+template <> struct PixelConvert::Rows<PixelConvert::SCALAR>
+{
+    template <bool SWAP> static void deinterleave(const uint8_t *uv, uint8_t *u, uint8_t *v, int n)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            u[i] = uv[i * 2 + (SWAP ? 1 : 0)];
+            v[i] = uv[i * 2 + (SWAP ? 0 : 1)];
+        }
+    }
+
+    template <int BITS> static void reduce(const uint16_t *src, uint8_t *dst, int n)
+    {
+        const int shift = BITS - 8;
+        for (int i = 0; i < n; i++)
+        {
+            int value = (src[i] + (1 << (shift - 1))) >> shift;
+            dst[i] = (uint8_t)(value > 255 ? 255 : value);
+        }
+    }
+};
+
+#ifdef PIXEL_CONVERT_SSE2
+template <> struct PixelConvert::Rows<PixelConvert::SSE2>
+{
+    // 16 chroma pairs per step.
+    template <bool SWAP> static void deinterleave(const uint8_t *uv, uint8_t *u, uint8_t *v, int n)
+    {
+        const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)(uv + i * 2));
+            __m128i b = _mm_loadu_si128((const __m128i *)(uv + i * 2 + 16));
+            __m128i first = _mm_packus_epi16(_mm_and_si128(a, lowBytes), _mm_and_si128(b, lowBytes));
+            __m128i second = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+            _mm_storeu_si128((__m128i *)(u + i), SWAP ? second : first);
+            _mm_storeu_si128((__m128i *)(v + i), SWAP ? first : second);
+        }
+        Rows<SCALAR>::deinterleave<SWAP>(uv + i * 2, u + i, v + i, n - i);
+    }
+
+    template <int BITS> static void reduce(const uint16_t *src, uint8_t *dst, int n)
+    {
+        const int shift = BITS - 8;
+        const __m128i round = _mm_set1_epi16(1 << (shift - 1));
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            // saturating add: out of range input stays positive for packus, which clamps to 255.
+            __m128i a = _mm_srli_epi16(_mm_adds_epu16(_mm_loadu_si128((const __m128i *)(src + i)), round), shift);
+            __m128i b = _mm_srli_epi16(_mm_adds_epu16(_mm_loadu_si128((const __m128i *)(src + i + 8)), round), shift);
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+        }
+        Rows<SCALAR>::reduce<BITS>(src + i, dst + i, n - i);
+    }
+};
+#endif
+
+#ifdef PIXEL_CONVERT_AVX2
+template <> struct PixelConvert::Rows<PixelConvert::AVX2>
+{
+    // 32 chroma pairs per step. packus works per 128 bit lane, permute puts the quadwords back in order.
+    template <bool SWAP> __attribute__((target("avx2"))) static void deinterleave(const uint8_t *uv, uint8_t *u,
+                                                                                 uint8_t *v, int n)
+    {
+        const __m256i lowBytes = _mm256_set1_epi16(0x00FF);
+        int i = 0;
+        for (; i + 32 <= n; i += 32)
+        {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(uv + i * 2));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(uv + i * 2 + 32));
+            __m256i first = _mm256_permute4x64_epi64(
+                _mm256_packus_epi16(_mm256_and_si256(a, lowBytes), _mm256_and_si256(b, lowBytes)), 0xD8);
+            __m256i second =
+                _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)), 0xD8);
+            _mm256_storeu_si256((__m256i *)(u + i), SWAP ? second : first);
+            _mm256_storeu_si256((__m256i *)(v + i), SWAP ? first : second);
+        }
+        Rows<SCALAR>::deinterleave<SWAP>(uv + i * 2, u + i, v + i, n - i);
+    }
+
+    template <int BITS> __attribute__((target("avx2"))) static void reduce(const uint16_t *src, uint8_t *dst, int n)
+    {
+        const int shift = BITS - 8;
+        const __m256i round = _mm256_set1_epi16(1 << (shift - 1));
+        int i = 0;
+        for (; i + 32 <= n; i += 32)
+        {
+            __m256i a =
+                _mm256_srli_epi16(_mm256_adds_epu16(_mm256_loadu_si256((const __m256i *)(src + i)), round), shift);
+            __m256i b =
+                _mm256_srli_epi16(_mm256_adds_epu16(_mm256_loadu_si256((const __m256i *)(src + i + 16)), round), shift);
+            _mm256_storeu_si256((__m256i *)(dst + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+        }
+        Rows<SCALAR>::reduce<BITS>(src + i, dst + i, n - i);
+    }
+};
+#endif
+
+// after the Rows specializations, which select() instantiates.
+inline PixelConvert::Fn PixelConvert::find(AVPixelFormat format, Isa isa)
+{
+    switch (isa)
+    {
+#ifdef PIXEL_CONVERT_AVX2
+    case AVX2:
+        return hasAvx2() ? select<Rows<AVX2>>(format) : nullptr;
+#endif
+#ifdef PIXEL_CONVERT_SSE2
+    case SSE2:
+        return select<Rows<SSE2>>(format);
+#endif
+    case SCALAR:
+        return select<Rows<SCALAR>>(format);
+    default:
+        return nullptr;
+    }
+}
+
+inline PixelConvert::Fn PixelConvert::find(AVPixelFormat format, const char **isaName)
+{
+    static const char *names[] = {"scalar", "sse2", "avx2"};
+    for (int isa = AVX2; isa >= SCALAR; isa--)
+    {
+        Fn fn = find(format, (Isa)isa);
+        if (fn != nullptr)
+        {
+            if (isaName != nullptr)
+            {
+                *isaName = names[isa];
+            }
+            return fn;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace ffmpegUtil
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Options chosen on the command line, passed down to play().
+struct PlayOptions
+{
+    bool disableVideo = false; // -vn: do not decode / present video
+    bool disableAudio = false; // -an: do not decode / play audio
+    int videoStream = -1;      // -vst N: video stream index, -1 means the first video stream
+    int audioStream = -1;      // -ast N: audio stream index, -1 means the first audio stream
+    std::string tracePath{};   // -trace file.json: record pipeline events as a Chrome trace
+    bool lowLatency = false;   // -lowlatency: live input, minimal probing / buffering, present on decode
+    bool latencyProbe = false; // -latency-probe: read LatencyStamp from presented frames, report latency
+    std::string videoSink = "sdl"; // -vsink sdl|null|y4m:path ("-" is stdout)
+    std::string audioSink = "sdl"; // -asink sdl|null|wav:path ("-" is stdout)
+    bool review = false;           // -review: pause / frame step / reverse playback keys, video only
+    int cacheMb = 512;             // -cache-mb N: memory bound of the review frame cache
+    int volume = 100;              // -volume N: percent, up / down keys change it while playing
+    bool framePool = true;         // -no-frame-pool: decoders use the default allocator
+    bool hugePages = false;        // -hugepages: back large pooled frames with transparent huge pages
+    std::string affinity{};        // -affinity role=cpus:...: pin pipeline threads, see ThreadPolicy
+    bool realtimeAudio = false;    // -rt-audio: SCHED_FIFO / nice for the audio path where allowed
+    bool overlay = false;          // -overlay: performance overlay on at start, o toggles it
+    std::string exportShm{};       // -export-shm name[:slots]: publish decoded frames, see ShmFrameWriter
+    int exportSlots = 8;
+    bool mosaic = false;           // -mosaic: every input file in one window, see playMosaicInputs
+    int mosaicWidth = 1920;        // -mosaic-size WxH: the whole window, split into tiles
+    int mosaicHeight = 1080;
+    std::string videoFilter{};     // -vf desc: libavfilter description run after the decoder, see VideoFilter
+    int filterThreads = 0;         // -filter-threads N: slice threads of the filters, 0 automatic
+    std::string tensorPath{};      // -tensor out.npy: headless export of sampled frames, see TensorVideoSink
+    int tensorWidth = 224;         // -tensor-size WxH
+    int tensorHeight = 224;
+    bool tensorU8 = false;         // -tensor-format f32|u8: planar float32 NCHW or uint8 NHWC
+    int tensorEvery = 1;           // -tensor-every N: every Nth decoded frame
+    std::vector<int64_t> tensorAtMs{}; // -tensor-at s,s,...: the first frame at or after each time instead
+    int tensorBatch = 32;          // -tensor-batch N: frames per mapped window of the file
+    float tensorMean[3] = {0, 0, 0}; // -tensor-mean r,g,b / -tensor-std r,g,b: (x / 255 - mean) / std
+    float tensorStd[3] = {1, 1, 1};
+    bool sceneDetect = false;      // -scenes: report scene cuts while decoding, see SceneDetector
+    double sceneThreshold = 10;    // -scene-threshold x: cut score in percent
+    std::string sceneOut{};        // -scene-out path: cut times in seconds, one per line
+    int parallel = 0;              // -parallel N: headless decode by N segment decoders, see SegmentDecoder
+    int parallelMb = 1024;         // -parallel-mb N: frames decoded ahead of the sink
+    bool parallelScaling = false;  // -parallel-scaling: 1, 2, 4 ... N decoders, throughput and output hash
+    bool frameHash = false;        // -frame-hash: hash of the output frames, equal for equal output
+    std::string clipPath{};        // -clip out.mkv: headless stream copy of a part of the input, see ClipExtractor
+    int64_t clipStartMs = 0;       // -clip-start s
+    int64_t clipEndMs = 0;         // -clip-end s, 0 is the end of the input
+    bool clipReencode = false;     // -clip-reencode: start exactly at -clip-start, the partial GOP is encoded again
+};
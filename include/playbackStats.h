@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace ffmpegUtil
+{
+
+// Counters written by the pipeline threads, read by anyone watching the playback
+// (soak harness, logs). Everything is a relaxed atomic, updating costs next to nothing.
+struct PlaybackStats
+{
+    std::atomic<int64_t> videoPtsMs{0};
+    std::atomic<int64_t> audioPtsMs{0};
+    std::atomic<int64_t> avOffsetMs{0};        // video - audio, sampled on every refresh
+    std::atomic<uint64_t> framesPresented{0};
+    std::atomic<uint64_t> framesSkipped{0};    // refresh ticks dropped because video was ahead
+    std::atomic<uint64_t> framesNotReady{0};   // refresh ticks with no decoded frame ready
+    std::atomic<uint64_t> audioCallbacks{0};
+    std::atomic<uint64_t> audioUnderruns{0};   // callbacks that had to play silence
+    std::atomic<int64_t> audioDeviceBufferUs{0}; // SDL device buffer (samples / rate), set on open
+    std::atomic<uint64_t> audioCallbackGapUs{0}; // sum of the intervals between callbacks
+    std::atomic<uint64_t> audioCallbackMaxGapUs{0};
+
+    // per stage time, summed in us (StatsOverlay divides by the frame counts)
+    std::atomic<uint64_t> videoFramesDecoded{0};
+    std::atomic<uint64_t> videoDecodeUs{0};    // avcodec_send_packet + avcodec_receive_frame
+    std::atomic<uint64_t> videoFilterUs{0};    // VideoFilter push + pull (-vf)
+    std::atomic<uint64_t> videoConvertUs{0};   // VideoProcessor::generateNextData
+    std::atomic<uint64_t> presentUs{0};        // sink write of the presented frames
+
+    // -scenes SceneDetector, on its own thread
+    std::atomic<uint64_t> sceneFrames{0};
+    std::atomic<uint64_t> sceneAnalyzeUs{0};   // downsample + compare
+    std::atomic<uint64_t> sceneDropped{0};     // not analyzed: analyzer behind, or no luma plane
+    std::atomic<uint64_t> sceneCuts{0};
+
+    // mid-stream source size / pixel format changes
+    std::atomic<uint64_t> formatSwitches{0};
+    std::atomic<uint64_t> formatSwitchesCached{0}; // back to a conversion still cached
+    std::atomic<uint64_t> formatSwitchUs{0};       // finding or building the conversion
+    std::atomic<uint64_t> textureRecreates{0};     // SdlVideoSink, a frame of another size
+    std::atomic<uint64_t> textureRecreateUs{0};
+
+    // review mode FrameCache
+    std::atomic<uint64_t> cacheHits{0};
+    std::atomic<uint64_t> cacheMisses{0};      // lookups that had to decode a GOP first
+    std::atomic<uint64_t> cacheBytes{0};
+    std::atomic<uint64_t> cacheFrames{0};
+
+    // startup, PlayerClock us, -1 until it happened
+    std::atomic<int64_t> openStartUs{-1};
+    std::atomic<int64_t> firstVideoUs{-1};     // first frame presented
+    std::atomic<int64_t> firstAudioUs{-1};     // first callback with decoded audio
+
+    static PlaybackStats &instance()
+    {
+        static PlaybackStats stats{};
+        return stats;
+    }
+
+    void reset()
+    {
+        videoPtsMs = 0;
+        audioPtsMs = 0;
+        avOffsetMs = 0;
+        framesPresented = 0;
+        framesSkipped = 0;
+        framesNotReady = 0;
+        audioCallbacks = 0;
+        audioUnderruns = 0;
+        audioDeviceBufferUs = 0;
+        audioCallbackGapUs = 0;
+        audioCallbackMaxGapUs = 0;
+        videoFramesDecoded = 0;
+        videoDecodeUs = 0;
+        videoFilterUs = 0;
+        videoConvertUs = 0;
+        presentUs = 0;
+        sceneFrames = 0;
+        sceneAnalyzeUs = 0;
+        sceneDropped = 0;
+        sceneCuts = 0;
+        formatSwitches = 0;
+        formatSwitchesCached = 0;
+        formatSwitchUs = 0;
+        textureRecreates = 0;
+        textureRecreateUs = 0;
+        cacheHits = 0;
+        cacheMisses = 0;
+        cacheBytes = 0;
+        cacheFrames = 0;
+        openStartUs = -1;
+        firstVideoUs = -1;
+        firstAudioUs = -1;
+    }
+};
+
+} // namespace ffmpegUtil
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace ffmpegUtil
+{
+
+// Time source for every sleep / timestamp the playback pipeline takes.
+// The default clock is the wall clock; a test harness can install a faster one
+// (ScaledClock) so that hours of content play in minutes.
+class PlayerClock
+{
+    static std::atomic<PlayerClock *> &installed()
+    {
+        static std::atomic<PlayerClock *> clock{nullptr};
+        return clock;
+    }
+
+protected:
+    const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    int64_t realElapsedUs() const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime)
+            .count();
+    }
+
+public:
+    virtual ~PlayerClock() {}
+
+    // false when the clock does not follow the wall clock, real time devices (the SDL audio
+    // device) can not be used with it then.
+    virtual bool isRealtime() const { return true; }
+
+    // us since the clock was created.
+    virtual int64_t nowUs() const { return realElapsedUs(); }
+
+    virtual void sleepForUs(int64_t us)
+    {
+        if (us > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(us));
+        }
+    }
+
+    void sleepForMs(int64_t ms) { sleepForUs(ms * 1000); }
+
+    static PlayerClock &get()
+    {
+        static PlayerClock realtimeClock{};
+        auto clock = installed().load();
+        return clock != nullptr ? *clock : realtimeClock;
+    }
+
+    // install before play() starts, nullptr goes back to the wall clock.
+    static void install(PlayerClock *clock) { installed().store(clock); }
+};
+
+// virtual clock running `speed` times faster than the wall clock.
+class ScaledClock : public PlayerClock
+{
+    const double speed;
+
+public:
+    explicit ScaledClock(double s) : speed(s > 0 ? s : 1.0) {}
+
+    bool isRealtime() const override { return speed == 1.0; }
+
+    int64_t nowUs() const override { return (int64_t)(realElapsedUs() * speed); }
+
+    void sleepForUs(int64_t us) override { PlayerClock::sleepForUs((int64_t)(us / speed)); }
+
+    double getSpeed() const { return speed; }
+};
+
+} // namespace ffmpegUtil
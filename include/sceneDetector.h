@@ -0,0 +1,313 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+#include <libavutil/frame.h>
+#include <libavutil/pixdesc.h>
+#ifdef __cplusplus
+};
+#endif
+
+#include "ffmpegUtil.h"
+#include "outputSink.h"
+#include "playbackStats.h"
+#include "threadPolicy.h"
+#include "traceRecorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SCENE_DETECT_SSE2 1
+#endif
+
+namespace ffmpegUtil
+{
+
+// Scene cuts found while the video decodes (-scenes), for chapters and thumbnails.
+//
+// The decoder thread only takes a reference to each decoded frame (submit, no pixel copy); the
+// analyzer thread averages the luma over 8x8 blocks and compares the grid with the previous
+// frame's (sum of absolute differences, psadbw). The score, like ffmpeg's scdet, is
+// min(mafd, |mafd - previous mafd|) with mafd the mean difference in percent of full scale: a cut
+// jumps once, steady motion does not. score >= threshold is a cut.
+//
+// The analyzer never holds up decoding: with MAX_QUEUED frames waiting the next ones are dropped
+// (counted), the following frame is then compared with the last one analyzed.
+class SceneDetector
+{
+    static const int BLOCK = 8;
+    static const int MAX_QUEUED = 8;
+
+    struct Pending
+    {
+        FramePtr frame;
+        int64_t ptsMs;
+    };
+
+    const double threshold;
+    FILE *out = nullptr; // cut list, one time in seconds per line
+
+    std::deque<Pending> queue{};
+    std::mutex queueMutex{};
+    std::condition_variable queueCv{};
+    bool stopping = false;
+    std::thread worker{};
+
+    // analyzer thread only
+    std::vector<uint8_t> grid{};
+    std::vector<uint8_t> previous{};
+    int gridW = 0;
+    int gridH = 0;
+    bool havePrevious = false;
+    double lastMafd = 0;
+    uint64_t analyzed = 0;
+    uint64_t analyzeUs = 0;
+    std::vector<int64_t> cuts{};
+
+    // 9 to 16 bit luma in 16 bit words: the sample is at bit `shift` of the word (MSB aligned
+    // P010 / P016 have shift 16 - depth), reduceBits brings the depth down to 8.
+    static void downsampleWide(const uint8_t *src, int linesize, int shift, int reduceBits, int gridW, int gridH,
+                               uint8_t *dst)
+    {
+        for (int gy = 0; gy < gridH; gy++)
+        {
+            for (int gx = 0; gx < gridW; gx++)
+            {
+                uint32_t sum = 0;
+                for (int y = 0; y < BLOCK; y++)
+                {
+                    const uint16_t *row = (const uint16_t *)(src + (gy * BLOCK + y) * linesize) + gx * BLOCK;
+                    for (int x = 0; x < BLOCK; x++)
+                    {
+                        sum += row[x] >> shift;
+                    }
+                }
+                dst[gy * gridW + gx] = (uint8_t)std::min<uint32_t>(255, (sum + 32) >> 6 >> reduceBits);
+            }
+        }
+    }
+
+    void analyze(const AVFrame *frame, int64_t ptsMs)
+    {
+        auto start = std::chrono::steady_clock::now();
+        {
+            TraceScope trace("scene analyze");
+            const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+            int w = frame->width / BLOCK;
+            int h = frame->height / BLOCK;
+            if (w != gridW || h != gridH)
+            {
+                gridW = w;
+                gridH = h;
+                grid.assign((size_t)w * h, 0);
+                previous.assign((size_t)w * h, 0);
+                havePrevious = false; // another size: no cut can be told from the comparison
+            }
+            if (desc->comp[0].depth > 8)
+            {
+                downsampleWide(frame->data[0], frame->linesize[0], desc->comp[0].shift, desc->comp[0].depth - 8, w, h,
+                               grid.data());
+            }
+            else
+            {
+                downsample<true>(frame->data[0], frame->linesize[0], w, h, grid.data());
+            }
+
+            if (havePrevious && !grid.empty())
+            {
+                double mafd = sad<true>(grid.data(), previous.data(), (int)grid.size()) * 100.0 / (grid.size() * 255.0);
+                double score = std::min(mafd, std::fabs(mafd - lastMafd));
+                lastMafd = mafd;
+                if (score >= threshold)
+                {
+                    cuts.push_back(ptsMs);
+                    PlaybackStats::instance().sceneCuts.fetch_add(1, std::memory_order_relaxed);
+                    TraceRecorder::instance().instant("scene cut");
+                    logInfo("scene cut: %gs, score %g", ptsMs / 1000.0, score);
+                    if (out != nullptr)
+                    {
+                        std::fprintf(out, "%.3f\n", ptsMs / 1000.0);
+                        std::fflush(out);
+                    }
+                }
+            }
+            grid.swap(previous);
+            havePrevious = true;
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        analyzed++;
+        analyzeUs += (uint64_t)us.count();
+        auto &stats = PlaybackStats::instance();
+        stats.sceneFrames.fetch_add(1, std::memory_order_relaxed);
+        stats.sceneAnalyzeUs.fetch_add((uint64_t)us.count(), std::memory_order_relaxed);
+    }
+
+    void run()
+    {
+        ThreadPolicy::instance().apply(ThreadPolicy::ANALYZER, "scene analyzer");
+        while (true)
+        {
+            Pending pending{};
+            {
+                std::unique_lock<std::mutex> lk{queueMutex};
+                queueCv.wait(lk, [this] { return stopping || !queue.empty(); });
+                if (queue.empty())
+                {
+                    break; // stopping, everything submitted was analyzed
+                }
+                pending = std::move(queue.front());
+                queue.pop_front();
+            }
+            analyze(pending.frame.get(), pending.ptsMs);
+        }
+        logInfo("[THREAD] scene analyzer finished.");
+    }
+
+public:
+    // threshold: score in percent of full scale, 10 is a hard cut for most content.
+    // cutsPath: where the cut times go as well, empty for none ("-" is stdout).
+    SceneDetector(double cutThreshold, const string &cutsPath) : threshold(cutThreshold)
+    {
+        if (!cutsPath.empty())
+        {
+            out = openOutputFile(cutsPath);
+        }
+        worker = std::thread(&SceneDetector::run, this);
+    }
+
+    SceneDetector(const SceneDetector &) = delete;
+    SceneDetector &operator=(const SceneDetector &) = delete;
+
+    ~SceneDetector() { stop(); }
+
+    // decoder thread: queues a reference to the frame, never waits for the analyzer.
+    void submit(const AVFrame *frame, int64_t ptsMs)
+    {
+        const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+        int sampleBytes = desc != nullptr && desc->comp[0].depth > 8 ? 2 : 1;
+        if (desc == nullptr || (desc->flags & AV_PIX_FMT_FLAG_RGB) || desc->comp[0].plane != 0 ||
+            desc->comp[0].step != sampleBytes)
+        {
+            PlaybackStats::instance().sceneDropped.fetch_add(1, std::memory_order_relaxed); // no luma plane
+            return;
+        }
+        std::lock_guard<std::mutex> lg{queueMutex};
+        if (stopping || queue.size() >= MAX_QUEUED)
+        {
+            PlaybackStats::instance().sceneDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        FramePtr ref{av_frame_alloc()};
+        if (av_frame_ref(ref.get(), frame) < 0)
+        {
+            return;
+        }
+        queue.push_back(Pending{std::move(ref), ptsMs});
+        queueCv.notify_one();
+    }
+
+    // analyzes what is still queued, then reports. The cuts are complete afterwards.
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lg{queueMutex};
+            if (stopping)
+            {
+                return;
+            }
+            stopping = true;
+        }
+        queueCv.notify_one();
+        worker.join();
+        if (out != nullptr && out != stdout)
+        {
+            std::fclose(out);
+        }
+        out = nullptr;
+        logInfo("scene detector: analyzed = %llu, dropped = %llu, cuts = %zu, ms/frame = %g",
+                (unsigned long long)analyzed, (unsigned long long)PlaybackStats::instance().sceneDropped.load(),
+                cuts.size(), analyzed > 0 ? analyzeUs / 1000.0 / analyzed : 0.0);
+    }
+
+    const std::vector<int64_t> &getCuts() const { return cuts; }
+
+    // 8 bit luma -> gridW x gridH averages of 8x8 blocks. SIMD: psadbw against zero sums 8 pixels
+    // per 64 bit lane, one load covers two blocks.
+    template <bool SIMD> static void downsample(const uint8_t *src, int linesize, int gridW, int gridH, uint8_t *dst)
+    {
+        for (int gy = 0; gy < gridH; gy++)
+        {
+            const uint8_t *rows = src + gy * BLOCK * linesize;
+            int gx = 0;
+#ifdef SCENE_DETECT_SSE2
+            if (SIMD)
+            {
+                const __m128i zero = _mm_setzero_si128();
+                for (; gx + 2 <= gridW; gx += 2)
+                {
+                    __m128i acc = zero;
+                    for (int y = 0; y < BLOCK; y++)
+                    {
+                        __m128i pixels = _mm_loadu_si128((const __m128i *)(rows + y * linesize + gx * BLOCK));
+                        acc = _mm_add_epi32(acc, _mm_sad_epu8(pixels, zero));
+                    }
+                    dst[gy * gridW + gx] = (uint8_t)((_mm_cvtsi128_si32(acc) + 32) >> 6);
+                    dst[gy * gridW + gx + 1] = (uint8_t)((_mm_cvtsi128_si32(_mm_srli_si128(acc, 8)) + 32) >> 6);
+                }
+            }
+#endif
+            for (; gx < gridW; gx++)
+            {
+                uint32_t sum = 0;
+                for (int y = 0; y < BLOCK; y++)
+                {
+                    const uint8_t *row = rows + y * linesize + gx * BLOCK;
+                    for (int x = 0; x < BLOCK; x++)
+                    {
+                        sum += row[x];
+                    }
+                }
+                dst[gy * gridW + gx] = (uint8_t)((sum + 32) >> 6);
+            }
+        }
+    }
+
+    template <bool SIMD> static uint64_t sad(const uint8_t *a, const uint8_t *b, int n)
+    {
+        uint64_t total = 0;
+        int i = 0;
+#ifdef SCENE_DETECT_SSE2
+        if (SIMD)
+        {
+            __m128i acc = _mm_setzero_si128();
+            for (; i + 16 <= n; i += 16)
+            {
+                acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(a + i)),
+                                                      _mm_loadu_si128((const __m128i *)(b + i))));
+            }
+            total = (uint64_t)_mm_cvtsi128_si32(acc) + (uint64_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+        }
+#endif
+        for (; i < n; i++)
+        {
+            total += (uint64_t)std::abs(a[i] - b[i]);
+        }
+        return total;
+    }
+};
+
+} // namespace ffmpegUtil
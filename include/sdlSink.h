@@ -0,0 +1,268 @@
+#pragma once
+
+#include "logger.h"
+#include "outputSink.h"
+#include "playbackStats.h"
+#include "statsOverlay.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+extern "C"
+{
+#include "SDL2/SDL.h"
+};
+
+class AudioProcessor;
+
+// SDL device callback, feeds the device from AudioProcessor::writeAudioData (src/playAudio.cpp).
+extern void sdlAudioCallback(void *userdata, Uint8 *stream, int len);
+// tells the AudioProcessor the rate, format, channels and callback size the device really runs
+// at (src/playAudio.cpp).
+extern void setAudioDeviceOutput(AudioProcessor &source, int sampleRate, AVSampleFormat format, int channels,
+                                 int samples);
+
+// Window, renderer and the streaming IYUV texture the video is presented on.
+// open() only needs the stream dimensions, so it can run while the codecs are still opening;
+// it has to be called on the main thread.
+class SdlVideoSink : public VideoSink
+{
+    SDL_Window *window = nullptr;
+    SDL_Renderer *renderer = nullptr;
+    SDL_Texture *texture = nullptr;
+    int textureWidth = 0;
+    int textureHeight = 0;
+    std::unique_ptr<StatsOverlay> overlay{};
+
+    // a frame of another size than the texture (the source changed size mid-stream): a new
+    // texture, the window keeps its size and scales it. false when SDL can not create it, the
+    // old texture is kept and the frame is not presented.
+    bool recreateTexture(int width, int height)
+    {
+        auto start = std::chrono::steady_clock::now();
+        SDL_Texture *t = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, width, height);
+        if (t == nullptr)
+        {
+            ffmpegUtil::logWarn("sdl texture %dx%d: %s, frame not presented", width, height, SDL_GetError());
+            return false;
+        }
+        SDL_DestroyTexture(texture);
+        texture = t;
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        auto &stats = ffmpegUtil::PlaybackStats::instance();
+        stats.textureRecreates.fetch_add(1, std::memory_order_relaxed);
+        stats.textureRecreateUs.fetch_add((uint64_t)us.count(), std::memory_order_relaxed);
+        ffmpegUtil::logInfo("sdl texture %dx%d -> %dx%d in %lldus", textureWidth, textureHeight, width, height,
+                            (long long)us.count());
+        textureWidth = width;
+        textureHeight = height;
+        return true;
+    }
+
+public:
+    SdlVideoSink() = default;
+    SdlVideoSink(const SdlVideoSink &) = delete;
+    SdlVideoSink &operator=(const SdlVideoSink &) = delete;
+    ~SdlVideoSink() { close(); }
+
+    bool isRealtime() const override { return true; }
+
+    void open(int width, int height, AVRational) override
+    {
+        // create SDL_Window
+        // SDL 2.0 Support for multiple windows
+        window = SDL_CreateWindow(":-D Player", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, width, height,
+                                  SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+        if (!window)
+        {
+            std::string errMsg = "SDL: could not create window - exiting:";
+            errMsg += SDL_GetError();
+            ffmpegUtil::logError("%s", errMsg.c_str());
+            throw std::runtime_error(errMsg);
+        }
+
+        //创建渲染器SDL_Renderer
+        renderer = SDL_CreateRenderer(window, -1, 0);
+
+        //创建纹理SDL_Texture
+        Uint32 pixFmt = SDL_PIXELFORMAT_IYUV;
+        texture = SDL_CreateTexture(renderer, pixFmt, SDL_TEXTUREACCESS_STREAMING, width, height);
+        textureWidth = width;
+        textureHeight = height;
+        overlay.reset(new StatsOverlay(renderer));
+    }
+
+    void write(const AVFrame *frame, uint64_t) override
+    {
+        if ((frame->width != textureWidth || frame->height != textureHeight) &&
+            !recreateTexture(frame->width, frame->height))
+        {
+            return;
+        }
+        SDL_UpdateYUVTexture(texture, NULL, frame->data[0], frame->linesize[0], frame->data[1],
+                             frame->linesize[1], frame->data[2], frame->linesize[2]); //设置纹理的数据
+        SDL_RenderClear(renderer);                                                  //渲染器clear
+        SDL_RenderCopy(renderer, texture, NULL, NULL); //将纹理的数据拷贝给渲染器
+        overlay->draw();
+        SDL_RenderPresent(renderer);                   //显示
+    }
+
+    void close() override
+    {
+        overlay.reset(); // its texture belongs to the renderer
+        if (texture != nullptr)
+        {
+            SDL_DestroyTexture(texture);
+            texture = nullptr;
+        }
+        if (renderer != nullptr)
+        {
+            SDL_DestroyRenderer(renderer);
+            renderer = nullptr;
+        }
+        if (window != nullptr)
+        {
+            SDL_DestroyWindow(window);
+            window = nullptr;
+        }
+    }
+
+    SDL_Renderer *getRenderer() const { return renderer; }
+
+    // nullptr until open().
+    StatsOverlay *getOverlay() const { return overlay.get(); }
+};
+
+// The SDL audio device. It is realtime: the device thread pulls the data from the
+// AudioProcessor through sdlAudioCallback, write() is never used.
+class SdlAudioSink : public AudioSink
+{
+    AudioProcessor &source;
+    SDL_AudioDeviceID audioDeviceID = 0;
+    int64_t bufferUs = 0;
+
+public:
+    explicit SdlAudioSink(AudioProcessor &p) : source(p) {}
+    SdlAudioSink(const SdlAudioSink &) = delete;
+    SdlAudioSink &operator=(const SdlAudioSink &) = delete;
+    ~SdlAudioSink() { close(); }
+
+    bool isRealtime() const override { return true; }
+
+    bool isOpen() const { return audioDeviceID != 0; }
+
+    void open(const ffmpegUtil::AudioInfo &info, int samples) override
+    {
+        // audio specs containers
+        SDL_AudioSpec wanted_specs; // desired output format
+        SDL_AudioSpec specs;        // actual output format
+
+        // set audio settings from codec info
+        wanted_specs.freq = info.sampleRate;
+        wanted_specs.format = AUDIO_S16SYS;
+        wanted_specs.channels = info.channels;
+        wanted_specs.samples = samples;
+        wanted_specs.silence = 0;
+        wanted_specs.callback = sdlAudioCallback;
+        wanted_specs.userdata = &source;
+
+        // Negotiated with the device: the rate, the callback size, the sample format and the
+        // channel count, so the ReSampler and AudioDsp produce what the device plays and SDL
+        // converts nothing. AudioDsp writes S16 or float; a device with another native format
+        // (S32 ...) gets float and SDL casts it. Older SDL can not tell the native spec: S16 at
+        // the stream's channel count is asked for and only the rate follows the device.
+#if SDL_VERSION_ATLEAST(2, 24, 0)
+        SDL_AudioSpec native;
+        char *deviceName = nullptr;
+        if (SDL_GetDefaultAudioInfo(&deviceName, &native, 0) == 0)
+        {
+            ffmpegUtil::logInfo("audio device: %s, native %dHz, %d channels, format 0x%X",
+                                deviceName != nullptr ? deviceName : "default", native.freq, (int)native.channels,
+                                native.format);
+            SDL_free(deviceName);
+            if (native.freq > 0)
+            {
+                wanted_specs.freq = native.freq;
+            }
+            else
+            {
+                ffmpegUtil::logWarn("audio device: no native rate, asking for the stream rate %dHz", info.sampleRate);
+            }
+            if (native.channels > 0)
+            {
+                wanted_specs.channels = native.channels;
+            }
+            bool wide = SDL_AUDIO_ISFLOAT(native.format) || SDL_AUDIO_BITSIZE(native.format) > 16;
+            wanted_specs.format = wide ? AUDIO_F32SYS : AUDIO_S16SYS;
+            if (wanted_specs.format != native.format)
+            {
+                ffmpegUtil::logInfo("audio device: native format 0x%X, writing 0x%X, SDL converts it", native.format,
+                                    wanted_specs.format);
+            }
+        }
+#endif
+        // the callback lasts as long as a decoded frame at the device rate. Without the native rate
+        // (older SDL) a changed rate keeps the stream's frame size, frames are gathered either way.
+        wanted_specs.samples = (Uint16)((int64_t)samples * wanted_specs.freq / info.sampleRate);
+
+        // open audio device. A rate change is taken as is (the ReSampler then outputs that rate),
+        // SDL would resample again after the ReSampler otherwise.
+        audioDeviceID = SDL_OpenAudioDevice(nullptr, 0, &wanted_specs, &specs, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+
+        // SDL_OpenAudioDevice returns a valid device ID that is > 0 on success or 0 on failure
+        if (audioDeviceID == 0)
+        {
+            std::string errMsg = "Failed to open audio device:";
+            errMsg += SDL_GetError();
+            ffmpegUtil::logError("%s", errMsg.c_str());
+            throw std::runtime_error(errMsg);
+        }
+
+        ffmpegUtil::logInfo("wanted_specs: freq = %d, format = 0x%X, channels = %d, silence = %d, samples = %d",
+                            wanted_specs.freq, wanted_specs.format, (int)wanted_specs.channels,
+                            (int)wanted_specs.silence, (int)wanted_specs.samples);
+        ffmpegUtil::logInfo("specs: freq = %d, format = 0x%X, channels = %d, silence = %d, samples = %d", specs.freq,
+                            specs.format, (int)specs.channels, (int)specs.silence, (int)specs.samples);
+
+        // no ALLOW_FORMAT / ALLOW_CHANNELS change: specs has the format and channels asked for.
+        AVSampleFormat format = specs.format == AUDIO_F32SYS ? AV_SAMPLE_FMT_FLT : AV_SAMPLE_FMT_S16;
+        setAudioDeviceOutput(source, specs.freq, format, specs.channels, specs.samples);
+        bufferUs = (int64_t)specs.samples * 1000000 / specs.freq;
+        ffmpegUtil::PlaybackStats::instance().audioDeviceBufferUs.store(bufferUs, std::memory_order_relaxed);
+        ffmpegUtil::logInfo("audio device: %dHz %s %d channels (stream %dHz, converted once), %d samples per "
+                            "callback, buffer %.1fms",
+                            specs.freq, av_get_sample_fmt_name(format), (int)specs.channels, info.sampleRate,
+                            (int)specs.samples, bufferUs / 1000.0);
+    }
+
+    // The device is opened paused, resume() once the AudioProcessor has data: the callback
+    // would only play silence and count underruns before that.
+    void resume()
+    {
+        if (audioDeviceID != 0)
+        {
+            SDL_PauseAudioDevice(audioDeviceID, 0);
+        }
+    }
+
+    void write(const uint8_t *, int, uint64_t) override {}
+
+    void close() override
+    {
+        if (audioDeviceID != 0)
+        {
+            SDL_PauseAudioDevice(audioDeviceID, 1);
+            SDL_CloseAudioDevice(audioDeviceID);
+            audioDeviceID = 0;
+            ffmpegUtil::logInfo("Pause and Close audio");
+
+            // the device keeps about one buffer queued, the callback gaps show what the backend adds.
+            auto &stats = ffmpegUtil::PlaybackStats::instance();
+            uint64_t callbacks = stats.audioCallbacks.load();
+            double avgMs = callbacks > 1 ? stats.audioCallbackGapUs.load() / 1000.0 / (callbacks - 1) : 0;
+            ffmpegUtil::logInfo("audio device latency: buffer %.1fms, callback period avg %.2fms, max %.2fms",
+                                bufferUs / 1000.0, avgMs, stats.audioCallbackMaxGapUs.load() / 1000.0);
+        }
+    }
+};
@@ -0,0 +1,494 @@
+#pragma once
+
+#include "ffmpegUtil.h"
+#include "outputSink.h"
+#include "playerClock.h"
+#include "threadPolicy.h"
+#include "traceRecorder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ffmpegUtil
+{
+
+// Headless decoding of one file by several decoders at once (-parallel N).
+//
+// A demux-only pass (scanKeyframes, no decoding) lists the keyframes. The file is cut at keyframes
+// into segments of about the same packet count, a few per worker so a slow segment does not hold
+// the others up. Every worker has its own PacketGrabber and single threaded decoder, takes the next
+// segment, seeks to its keyframe and decodes it. run() hands the frames to the sink segment after
+// segment, in the order one decoder would have output them.
+//
+// Frame exact: a segment owns the frames with startPts <= pts < endPts. It keeps decoding past its
+// end through the next keyframe and the packets that follow it with a smaller pts (leading pictures
+// of an open GOP, which reference frames before that keyframe), then drops what is not its own.
+// The next segment drops those pictures, it can not decode them correctly.
+//
+// Memory: frames wait in their segment until the merge reaches it. Past maxBufferMb a worker that
+// is not on the oldest segment waits, the oldest one always goes on.
+class SegmentDecoder
+{
+public:
+    struct KeyframeIndex
+    {
+        std::vector<int64_t> keyPts{};         // stream time base, increasing
+        std::vector<uint64_t> keyPacket{};     // index of the keyframe packet in the stream
+        uint64_t packets = 0;
+        double seconds = 0;                    // of the scan
+    };
+
+    struct Result
+    {
+        uint64_t frames = 0;  // handed to the sink
+        uint64_t decoded = 0; // out of the decoders, with the frames decoded twice at the boundaries
+        uint64_t hash = 0;    // of the frames in output order, 0 without hashing
+        size_t segments = 0;
+        double wallSec = 0;
+        double cpuSec = 0;
+    };
+
+private:
+    static const int64_t STREAM_END = INT64_MAX;
+    static const size_t HEAD_QUEUE = 16; // frames of the oldest segment waiting for the sink
+
+    struct Segment
+    {
+        int64_t startPts;
+        int64_t endPts; // the next segment's keyframe, STREAM_END for the last one
+        std::deque<FramePtr> frames{};
+        bool done = false;
+
+        Segment(int64_t start, int64_t end) : startPts(start), endPts(end) {}
+    };
+
+    struct Worker
+    {
+        std::unique_ptr<PacketGrabber> grabber{};
+        AVCodecContext *codecCtx = nullptr;
+        struct SwsContext *sws = nullptr;
+        bool fresh = true; // at the start of the file, segment 0 needs no seek
+
+        ~Worker()
+        {
+            sws_freeContext(sws);
+            avcodec_free_context(&codecCtx);
+        }
+    };
+
+    const string url;
+    const int videoIndex;
+    const int workerCount;
+    int width = 0;
+    int height = 0;
+    AVRational timeBase{1, 1000};
+    AVRational frameRate{25, 1};
+    size_t maxBuffered = 0; // frames
+
+    std::deque<Segment> segments{}; // never moved, the workers hold references
+    std::mutex segmentMutex{};
+    std::condition_variable segmentCv{};
+    size_t nextSegment = 0;
+    size_t head = 0;
+    size_t buffered = 0;
+    bool aborted = false;
+    string error{};
+    std::atomic<uint64_t> decoded{0};
+
+    static int64_t packetPts(const AVPacket *pkt) { return pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts; }
+
+    static int64_t framePts(const AVFrame *frame)
+    {
+        return frame->pts != AV_NOPTS_VALUE ? frame->pts : frame->best_effort_timestamp;
+    }
+
+    // false when the worker should stop.
+    bool emit(size_t s, FramePtr frame)
+    {
+        std::unique_lock<std::mutex> lk{segmentMutex};
+        segmentCv.wait(lk, [&] {
+            return aborted || (s == head ? segments[s].frames.size() < HEAD_QUEUE : buffered < maxBuffered);
+        });
+        if (aborted)
+        {
+            return false;
+        }
+        segments[s].frames.push_back(std::move(frame));
+        buffered++;
+        segmentCv.notify_all();
+        return true;
+    }
+
+    // YUV420P of the stream size, what the sinks take. Frames that already are pass by reference.
+    FramePtr toOutput(Worker &w, AVFrame *frame)
+    {
+        FramePtr out{av_frame_alloc()};
+        if (frame->format == AV_PIX_FMT_YUV420P && frame->width == width && frame->height == height)
+        {
+            av_frame_move_ref(out.get(), frame);
+            return out;
+        }
+        w.sws = sws_getCachedContext(w.sws, frame->width, frame->height, (AVPixelFormat)frame->format, width,
+                                     height, AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr, nullptr, nullptr);
+        FramePool::instance().allocPicture(out.get(), AV_PIX_FMT_YUV420P, width, height);
+        sws_scale(w.sws, (uint8_t const *const *)frame->data, frame->linesize, 0, frame->height, out->data,
+                  out->linesize);
+        out->pts = frame->pts;
+        out->best_effort_timestamp = frame->best_effort_timestamp;
+        av_frame_unref(frame);
+        return out;
+    }
+
+    // false when the worker should stop.
+    bool receiveFrames(Worker &w, size_t s, AVFrame *frame)
+    {
+        const Segment &seg = segments[s];
+        while (avcodec_receive_frame(w.codecCtx, frame) == 0)
+        {
+            decoded.fetch_add(1, std::memory_order_relaxed);
+            int64_t pts = framePts(frame);
+            bool own = pts == AV_NOPTS_VALUE || ((s == 0 || pts >= seg.startPts) && pts < seg.endPts);
+            if (!own)
+            {
+                av_frame_unref(frame);
+                continue;
+            }
+            if (!emit(s, toOutput(w, frame)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // leaves the demuxer so that the next video packet read is at or before startPts.
+    void seekTo(Worker &w, int64_t startPts)
+    {
+        auto formatCtx = w.grabber->getFormatCtx();
+        auto stream = formatCtx->streams[videoIndex];
+        int64_t fiveSec = av_rescale_q(5000, AVRational{1, 1000}, stream->time_base);
+        int64_t first = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+        // some demuxers land after the target, go further back and finally to the start.
+        for (int64_t target : {startPts, startPts - fiveSec, first})
+        {
+            if (av_seek_frame(formatCtx, videoIndex, target, AVSEEK_FLAG_BACKWARD) < 0)
+            {
+                continue;
+            }
+            PacketPtr pkt{av_packet_alloc()};
+            while (av_read_frame(formatCtx, pkt.get()) >= 0 && pkt->stream_index != videoIndex)
+            {
+                av_packet_unref(pkt.get());
+            }
+            bool before = pkt->stream_index == videoIndex && packetPts(pkt.get()) <= startPts;
+            av_seek_frame(formatCtx, videoIndex, target, AVSEEK_FLAG_BACKWARD);
+            if (before)
+            {
+                return;
+            }
+        }
+        string errMsg = "segment decoder: can not seek to " + std::to_string(startPts) + " in " + url;
+        logError("%s", errMsg.c_str());
+        throw std::runtime_error(errMsg);
+    }
+
+    void decodeSegment(Worker &w, size_t s)
+    {
+        TraceScope trace("segment decode");
+        const Segment &seg = segments[s];
+        auto formatCtx = w.grabber->getFormatCtx();
+        if (s > 0 || !w.fresh)
+        {
+            seekTo(w, seg.startPts);
+            avcodec_flush_buffers(w.codecCtx);
+        }
+        w.fresh = false;
+
+        PacketPtr pkt{av_packet_alloc()};
+        FramePtr frame{av_frame_alloc()};
+        bool started = s == 0;
+        bool pastEnd = false; // the next segment's keyframe was sent
+        while (av_read_frame(formatCtx, pkt.get()) >= 0)
+        {
+            if (pkt->stream_index != videoIndex)
+            {
+                av_packet_unref(pkt.get());
+                continue;
+            }
+            int64_t pts = packetPts(pkt.get());
+            bool key = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+            if (!started && !(key && pts >= seg.startPts))
+            {
+                av_packet_unref(pkt.get()); // before our keyframe, the seek landed earlier
+                continue;
+            }
+            started = true;
+            if (pastEnd && pts >= seg.endPts)
+            {
+                av_packet_unref(pkt.get()); // the leading pictures are through
+                break;
+            }
+            pastEnd = pastEnd || (key && pts >= seg.endPts);
+
+            // receiveFrames drains the decoder, so EAGAIN can not happen here.
+            avcodec_send_packet(w.codecCtx, pkt.get());
+            av_packet_unref(pkt.get());
+            if (!receiveFrames(w, s, frame.get()))
+            {
+                return;
+            }
+        }
+        avcodec_send_packet(w.codecCtx, nullptr);
+        receiveFrames(w, s, frame.get());
+    }
+
+    void work(int id)
+    {
+        ThreadPolicy::instance().apply(ThreadPolicy::VIDEO_DECODER, "segment decoder " + std::to_string(id));
+        try
+        {
+            Worker w{};
+            w.grabber.reset(new PacketGrabber(url));
+            w.grabber->selectStreams(videoIndex, -1);
+            // one thread per decoder: the parallelism is the segments.
+            ffutils::initCodec(w.grabber->getFormatCtx(), videoIndex, &w.codecCtx, false, 1);
+            while (true)
+            {
+                size_t s;
+                {
+                    std::lock_guard<std::mutex> lg{segmentMutex};
+                    if (aborted || nextSegment == segments.size())
+                    {
+                        break;
+                    }
+                    s = nextSegment++;
+                }
+                decodeSegment(w, s);
+                std::lock_guard<std::mutex> lg{segmentMutex};
+                segments[s].done = true;
+                segmentCv.notify_all();
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::lock_guard<std::mutex> lg{segmentMutex};
+            aborted = true;
+            error = e.what();
+            segmentCv.notify_all();
+        }
+    }
+
+    // 64 bit FNV-1a style, a word at a time, over the visible picture.
+    static uint64_t hashFrame(uint64_t h, const AVFrame *frame)
+    {
+        const uint64_t prime = 0x100000001b3ULL;
+        for (int plane = 0; plane < 3; plane++)
+        {
+            int w = plane == 0 ? frame->width : (frame->width + 1) / 2;
+            int rows = plane == 0 ? frame->height : (frame->height + 1) / 2;
+            for (int y = 0; y < rows; y++)
+            {
+                const uint8_t *row = frame->data[plane] + y * frame->linesize[plane];
+                int x = 0;
+                for (; x + 8 <= w; x += 8)
+                {
+                    uint64_t word;
+                    std::memcpy(&word, row + x, 8);
+                    h = (h ^ word) * prime;
+                }
+                for (; x < w; x++)
+                {
+                    h = (h ^ row[x]) * prime;
+                }
+            }
+        }
+        return h;
+    }
+
+    // the oldest segment's frames, in order, then the next segment. hash: nullptr for none.
+    void mergeInto(VideoSink &sink, uint64_t *hash, uint64_t &frames)
+    {
+        while (true)
+        {
+            FramePtr frame{};
+            {
+                std::unique_lock<std::mutex> lk{segmentMutex};
+                segmentCv.wait(lk, [&] {
+                    return aborted || head == segments.size() || !segments[head].frames.empty() ||
+                           segments[head].done;
+                });
+                if (aborted || head == segments.size())
+                {
+                    return;
+                }
+                if (segments[head].frames.empty())
+                {
+                    head++; // done, the next segment may now fill up to HEAD_QUEUE
+                    segmentCv.notify_all();
+                    continue;
+                }
+                frame = std::move(segments[head].frames.front());
+                segments[head].frames.pop_front();
+                buffered--;
+                segmentCv.notify_all();
+            }
+            int64_t pts = framePts(frame.get());
+            uint64_t ptsMs = pts != AV_NOPTS_VALUE ? (uint64_t)av_rescale_q(pts, timeBase, AVRational{1, 1000}) : 0;
+            if (hash != nullptr)
+            {
+                *hash = hashFrame(*hash, frame.get());
+            }
+            sink.write(frame.get(), ptsMs);
+            frames++;
+        }
+    }
+
+public:
+    // demux only, the keyframes of the video stream. Reads the whole file once.
+    static KeyframeIndex scanKeyframes(const string &url, int videoIndex)
+    {
+        auto start = std::chrono::steady_clock::now();
+        KeyframeIndex index{};
+        PacketGrabber grabber{url};
+        grabber.selectStreams(videoIndex, -1);
+        PacketPtr pkt{av_packet_alloc()};
+        while (grabber.grabPacket(pkt.get()) >= 0)
+        {
+            if (pkt->stream_index == videoIndex)
+            {
+                int64_t pts = packetPts(pkt.get());
+                if ((pkt->flags & AV_PKT_FLAG_KEY) && pts != AV_NOPTS_VALUE &&
+                    (index.keyPts.empty() || pts > index.keyPts.back()))
+                {
+                    index.keyPts.push_back(pts);
+                    index.keyPacket.push_back(index.packets);
+                }
+                index.packets++;
+            }
+            av_packet_unref(pkt.get());
+        }
+        index.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        logInfo("segment decoder: %zu keyframes in %llu packets, scan %gs", index.keyPts.size(),
+                (unsigned long long)index.packets, index.seconds);
+        return index;
+    }
+
+    // workers: decoders running at once. 1 decodes the file front to back in one segment, exactly
+    // like a single decoder. maxBufferMb: frames decoded ahead of the sink.
+    SegmentDecoder(const string &inputUrl, int index, const KeyframeIndex &keyframes, int workers, int maxBufferMb)
+        : url(inputUrl), videoIndex(index), workerCount(std::max(1, workers))
+    {
+        {
+            PacketGrabber probe{url};
+            auto stream = probe.getFormatCtx()->streams[videoIndex];
+            width = stream->codecpar->width;
+            height = stream->codecpar->height;
+            timeBase = stream->time_base;
+            if (stream->avg_frame_rate.num > 0 && stream->avg_frame_rate.den > 0)
+            {
+                frameRate = stream->avg_frame_rate;
+            }
+        }
+        size_t frameBytes = (size_t)width * height * 3 / 2;
+        maxBuffered = std::max((size_t)workerCount * 2,
+                               (size_t)maxBufferMb * 1024 * 1024 / std::max<size_t>(frameBytes, 1));
+
+        // cut at the keyframe nearest after every packets / wanted share, a few segments per worker.
+        size_t wanted = workerCount == 1 ? 1 : (size_t)workerCount * 4;
+        segments.emplace_back(INT64_MIN, STREAM_END);
+        for (size_t i = 1; i < wanted; i++)
+        {
+            uint64_t target = keyframes.packets * i / wanted;
+            auto k = std::lower_bound(keyframes.keyPacket.begin(), keyframes.keyPacket.end(), target);
+            if (k == keyframes.keyPacket.end())
+            {
+                break;
+            }
+            int64_t pts = keyframes.keyPts[k - keyframes.keyPacket.begin()];
+            if (*k == 0 || (segments.size() > 1 && pts <= segments.back().startPts))
+            {
+                continue;
+            }
+            segments.back().endPts = pts;
+            segments.emplace_back(pts, STREAM_END);
+        }
+        logInfo("segment decoder: %d workers, %zu segments, %zu frames buffered at most", workerCount, segments.size(),
+                maxBuffered);
+    }
+
+    SegmentDecoder(const SegmentDecoder &) = delete;
+    SegmentDecoder &operator=(const SegmentDecoder &) = delete;
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+    // decodes the whole stream into sink (opened and closed here), on this thread and workers.
+    Result run(VideoSink &sink, bool hash)
+    {
+        Result result{};
+        result.segments = segments.size();
+        auto &clock = PlayerClock::get();
+        int64_t startUs = clock.nowUs();
+        std::clock_t startCpu = std::clock();
+        const uint64_t offsetBasis = 0xcbf29ce484222325ULL;
+        result.hash = hash ? offsetBasis : 0;
+
+        sink.open(width, height, frameRate);
+        std::vector<std::thread> workers{};
+        for (int i = 0; i < workerCount; i++)
+        {
+            workers.emplace_back(&SegmentDecoder::work, this, i);
+        }
+
+        auto stopWorkers = [&]() {
+            {
+                std::lock_guard<std::mutex> lg{segmentMutex};
+                aborted = aborted || head != segments.size();
+                segmentCv.notify_all();
+            }
+            for (auto &t : workers)
+            {
+                t.join();
+            }
+        };
+
+        try
+        {
+            mergeInto(sink, hash ? &result.hash : nullptr, result.frames);
+        }
+        catch (...)
+        {
+            stopWorkers(); // the sink failed
+            throw;
+        }
+        stopWorkers();
+        sink.close();
+        if (!error.empty())
+        {
+            string errMsg = "segment decoder: " + error;
+            logError("%s", errMsg.c_str());
+            throw std::runtime_error(errMsg);
+        }
+
+        result.decoded = decoded.load();
+        result.wallSec = (clock.nowUs() - startUs) / 1e6;
+        result.cpuSec = (double)(std::clock() - startCpu) / CLOCKS_PER_SEC;
+        return result;
+    }
+};
+
+} // namespace ffmpegUtil
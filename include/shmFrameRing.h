@@ -0,0 +1,335 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+#ifdef __cplusplus
+};
+#endif
+
+#include "logger.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ffmpegUtil
+{
+
+// Decoded frames for other processes, in a POSIX shared memory ring (-export-shm name).
+//
+//   [ShmRingHeader][slot 0][slot 1]...    slot = [ShmSlotHeader][Y][U][V], planes 64 byte aligned
+//
+// The player writes every presented size YUV420P frame into slot (frame number % slotCount) and
+// never waits for anyone. Each slot is guarded by a sequence lock: seq is odd while the writer is
+// in the slot and is bumped again when it is done. A reader takes seq, uses the pixels in place,
+// then checks seq again: unchanged means the frame was intact, otherwise the writer lapped it and
+// the frame is discarded. So a slow reader only loses frames, playback never notices it.
+//
+// The layout is plain data plus lock-free 32/64 bit atomics, readable from C as well.
+const uint32_t SHM_RING_MAGIC = 0x46524D52; // "RMRF"
+const uint32_t SHM_RING_VERSION = 1;
+
+struct ShmRingHeader
+{
+    uint32_t magic; // written last, readers check it first
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t headerBytes;            // offset of slot 0
+    uint64_t slotBytes;              // distance between slots
+    std::atomic<uint64_t> published; // frames written so far, the newest one is published - 1
+    std::atomic<uint32_t> writerAlive;
+};
+
+struct ShmSlotHeader
+{
+    std::atomic<uint32_t> seq;
+    uint32_t dataBytes;
+    uint64_t frameNumber;
+    int64_t ptsMs;
+    int32_t format; // AVPixelFormat
+    int32_t width;
+    int32_t height;
+    int32_t linesize[4];
+    uint32_t offset[4]; // plane offsets from the slot start
+};
+
+// a frame read in place, valid until ShmFrameReader::validate says otherwise.
+struct ShmFrameView
+{
+    uint64_t frameNumber;
+    int64_t ptsMs;
+    int format;
+    int width;
+    int height;
+    int linesize[4];
+    const uint8_t *data[4];
+    uint32_t seq;
+    const ShmSlotHeader *slot;
+};
+
+class ShmFrameWriter
+{
+    static const int ALIGN = 64;
+
+    std::string name;
+    uint8_t *base = nullptr;
+    size_t mappedBytes = 0;
+    ShmRingHeader *header = nullptr;
+    int width;
+    int height;
+    int linesize[3];
+    uint32_t offset[3];
+    uint64_t dropped = 0;
+
+    static size_t alignUp(size_t n) { return (n + ALIGN - 1) / ALIGN * ALIGN; }
+
+    ShmSlotHeader *slotAt(uint64_t frameNumber)
+    {
+        return (ShmSlotHeader *)(base + header->headerBytes + frameNumber % header->slotCount * header->slotBytes);
+    }
+
+public:
+    // name: "/player" style, the leading slash is added when missing. The ring holds frames of
+    // width x height, YUV420P, the size VideoProcessor outputs.
+    ShmFrameWriter(const std::string &shmName, int slots, int w, int h)
+        : name(shmName.empty() || shmName[0] != '/' ? "/" + shmName : shmName), width(w), height(h)
+    {
+#ifdef _WIN32
+        std::string errMsg = "shared memory export is not supported on this platform";
+        logError("%s", errMsg.c_str());
+        throw std::runtime_error(errMsg);
+#else
+        int cw = (w + 1) / 2;
+        int ch = (h + 1) / 2;
+        linesize[0] = (int)alignUp(w);
+        linesize[1] = linesize[2] = (int)alignUp(cw);
+        offset[0] = (uint32_t)alignUp(sizeof(ShmSlotHeader));
+        offset[1] = (uint32_t)(offset[0] + alignUp((size_t)linesize[0] * h));
+        offset[2] = (uint32_t)(offset[1] + alignUp((size_t)linesize[1] * ch));
+        size_t slotBytes = offset[2] + alignUp((size_t)linesize[2] * ch);
+        size_t headerBytes = alignUp(sizeof(ShmRingHeader));
+        mappedBytes = headerBytes + slotBytes * slots;
+
+        // a ring left behind by a crashed player is replaced.
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0 || ftruncate(fd, (off_t)mappedBytes) != 0)
+        {
+            std::string errMsg = "can not create shared memory " + name + ": " + std::strerror(errno);
+            if (fd >= 0)
+            {
+                ::close(fd);
+                shm_unlink(name.c_str());
+            }
+            logError("%s", errMsg.c_str());
+            throw std::runtime_error(errMsg);
+        }
+        void *p = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+        {
+            std::string errMsg = "can not map shared memory " + name + ": " + std::strerror(errno);
+            shm_unlink(name.c_str());
+            logError("%s", errMsg.c_str());
+            throw std::runtime_error(errMsg);
+        }
+        base = (uint8_t *)p; // zero filled: every seq starts even, nothing published
+
+        header = (ShmRingHeader *)base;
+        header->version = SHM_RING_VERSION;
+        header->slotCount = (uint32_t)slots;
+        header->headerBytes = (uint32_t)headerBytes;
+        header->slotBytes = slotBytes;
+        header->writerAlive.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = SHM_RING_MAGIC;
+        logInfo("shm export: %s, %d slots of %zuKB", name.c_str(), slots, (size_t)(slotBytes / 1024));
+#endif
+    }
+
+    ShmFrameWriter(const ShmFrameWriter &) = delete;
+    ShmFrameWriter &operator=(const ShmFrameWriter &) = delete;
+
+    ~ShmFrameWriter()
+    {
+#ifndef _WIN32
+        if (base != nullptr)
+        {
+            logInfo("shm export: published = %llu, dropped = %llu", (unsigned long long)header->published.load(),
+                    (unsigned long long)dropped);
+            header->writerAlive.store(0, std::memory_order_release);
+            munmap(base, mappedBytes);
+            // readers that still have it mapped keep their mapping.
+            shm_unlink(name.c_str());
+        }
+#endif
+    }
+
+    // copies the frame into the next slot, never blocks. Frames that do not fit the ring
+    // (another format or a larger size) are counted and dropped.
+    void publish(const AVFrame *frame, int64_t ptsMs)
+    {
+        if (frame->format != AV_PIX_FMT_YUV420P || frame->width > width || frame->height > height)
+        {
+            dropped++;
+            return;
+        }
+        uint64_t n = header->published.load(std::memory_order_relaxed);
+        ShmSlotHeader *slot = slotAt(n);
+        uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+        slot->seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release); // the odd seq is visible before any write
+
+        slot->frameNumber = n;
+        slot->ptsMs = ptsMs;
+        slot->format = frame->format;
+        slot->width = frame->width;
+        slot->height = frame->height;
+        uint8_t *slotBase = (uint8_t *)slot;
+        for (int p = 0; p < 3; p++)
+        {
+            int w = p == 0 ? frame->width : (frame->width + 1) / 2;
+            int h = p == 0 ? frame->height : (frame->height + 1) / 2;
+            slot->linesize[p] = linesize[p];
+            slot->offset[p] = offset[p];
+            for (int y = 0; y < h; y++)
+            {
+                std::memcpy(slotBase + offset[p] + (size_t)y * linesize[p], frame->data[p] + y * frame->linesize[p],
+                            w);
+            }
+        }
+        slot->linesize[3] = 0;
+        slot->offset[3] = 0;
+        slot->dataBytes = (uint32_t)(header->slotBytes - offset[0]);
+
+        slot->seq.store(seq + 2, std::memory_order_release);
+        header->published.store(n + 1, std::memory_order_release);
+    }
+
+    uint64_t getPublished() const { return header->published.load(std::memory_order_relaxed); }
+    uint64_t getDropped() const { return dropped; }
+};
+
+class ShmFrameReader
+{
+    const uint8_t *base = nullptr;
+    size_t mappedBytes = 0;
+    const ShmRingHeader *header = nullptr;
+
+public:
+    explicit ShmFrameReader(const std::string &shmName)
+    {
+#ifdef _WIN32
+        std::string errMsg = "shared memory export is not supported on this platform";
+        logError("%s", errMsg.c_str());
+        throw std::runtime_error(errMsg);
+#else
+        std::string name = shmName.empty() || shmName[0] != '/' ? "/" + shmName : shmName;
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        struct stat st
+        {
+        };
+        if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmRingHeader))
+        {
+            std::string errMsg = "can not open shared memory " + name + ": " + std::strerror(errno);
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            logError("%s", errMsg.c_str());
+            throw std::runtime_error(errMsg);
+        }
+        mappedBytes = (size_t)st.st_size;
+        void *p = mmap(nullptr, mappedBytes, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+        {
+            std::string errMsg = "can not map shared memory " + name + ": " + std::strerror(errno);
+            logError("%s", errMsg.c_str());
+            throw std::runtime_error(errMsg);
+        }
+        base = (const uint8_t *)p;
+        header = (const ShmRingHeader *)base;
+        if (header->magic != SHM_RING_MAGIC || header->version != SHM_RING_VERSION)
+        {
+            munmap((void *)base, mappedBytes);
+            std::string errMsg = "not a player frame ring: " + name;
+            logError("%s", errMsg.c_str());
+            throw std::runtime_error(errMsg);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+#endif
+    }
+
+    ShmFrameReader(const ShmFrameReader &) = delete;
+    ShmFrameReader &operator=(const ShmFrameReader &) = delete;
+
+    ~ShmFrameReader()
+    {
+#ifndef _WIN32
+        if (base != nullptr)
+        {
+            munmap((void *)base, mappedBytes);
+        }
+#endif
+    }
+
+    uint64_t getPublished() const { return header->published.load(std::memory_order_acquire); }
+    bool isWriterAlive() const { return header->writerAlive.load(std::memory_order_acquire) != 0; }
+
+    // the newest frame, if it is newer than frame number `after` (-1: any). false when there is
+    // nothing new, or the writer is in that slot right now.
+    bool acquire(int64_t after, ShmFrameView &view) const
+    {
+        uint64_t published = getPublished();
+        if (published == 0 || (int64_t)(published - 1) <= after)
+        {
+            return false;
+        }
+        uint64_t n = published - 1;
+        const ShmSlotHeader *slot =
+            (const ShmSlotHeader *)(base + header->headerBytes + n % header->slotCount * header->slotBytes);
+        view.seq = slot->seq.load(std::memory_order_acquire);
+        if (view.seq & 1)
+        {
+            return false;
+        }
+        view.slot = slot;
+        view.frameNumber = slot->frameNumber;
+        view.ptsMs = slot->ptsMs;
+        view.format = slot->format;
+        view.width = slot->width;
+        view.height = slot->height;
+        for (int p = 0; p < 4; p++)
+        {
+            view.linesize[p] = slot->linesize[p];
+            view.data[p] = slot->linesize[p] != 0 ? (const uint8_t *)slot + slot->offset[p] : nullptr;
+        }
+        // the header fields above are only trusted once seq is confirmed.
+        return validate(view) && view.frameNumber == n;
+    }
+
+    // call after using view.data: false means the writer reused the slot meanwhile, the pixels
+    // read may be torn and have to be discarded.
+    bool validate(const ShmFrameView &view) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return view.slot->seq.load(std::memory_order_relaxed) == view.seq;
+    }
+};
+
+} // namespace ffmpegUtil
@@ -0,0 +1,228 @@
+#pragma once
+
+#include "logger.h"
+#include "playbackStats.h"
+#include "playerClock.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include "SDL2/SDL.h"
+};
+
+// Performance overlay of the SDL video window, toggled with the o key (-overlay: on at start).
+//
+// The numbers come from PlaybackStats, rates are taken over the last update interval. The text is
+// rasterized into a small ARGB texture at most every UPDATE_MS, draw() is then a single
+// SDL_RenderCopy per presented frame, so showing it costs next to nothing on the render thread.
+class StatsOverlay
+{
+public:
+    static const int UPDATE_MS = 500;
+
+    // what the overlay can not read from PlaybackStats, sampled by the video loop.
+    struct Queues
+    {
+        int videoPackets;
+        int audioPackets;
+        int videoFrames; // decoded and waiting for the consumer, 0 or 1
+        int audioFrames;
+    };
+
+private:
+    static const int COLS = 52;
+    static const int LINES = 6;
+    static const int SCALE = 2;     // font pixels per glyph pixel
+    static const int CELL_W = 6;    // 5 + spacing
+    static const int CELL_H = 9;    // 7 + spacing
+    static const int MARGIN = 4;
+
+    // 5x7, one byte per column, bit 0 is the top row. ' ' to 'Z', the text is upper-cased.
+    static const uint8_t *glyph(char c)
+    {
+        static const uint8_t font[][5] = {
+            {0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x5F, 0x00, 0x00}, {0x00, 0x07, 0x00, 0x07, 0x00},
+            {0x14, 0x7F, 0x14, 0x7F, 0x14}, {0x24, 0x2A, 0x7F, 0x2A, 0x12}, {0x23, 0x13, 0x08, 0x64, 0x62},
+            {0x36, 0x49, 0x55, 0x22, 0x50}, {0x00, 0x05, 0x03, 0x00, 0x00}, {0x00, 0x1C, 0x22, 0x41, 0x00},
+            {0x00, 0x41, 0x22, 0x1C, 0x00}, {0x08, 0x2A, 0x1C, 0x2A, 0x08}, {0x08, 0x08, 0x3E, 0x08, 0x08},
+            {0x00, 0x50, 0x30, 0x00, 0x00}, {0x08, 0x08, 0x08, 0x08, 0x08}, {0x00, 0x60, 0x60, 0x00, 0x00},
+            {0x20, 0x10, 0x08, 0x04, 0x02}, {0x3E, 0x51, 0x49, 0x45, 0x3E}, {0x00, 0x42, 0x7F, 0x40, 0x00},
+            {0x42, 0x61, 0x51, 0x49, 0x46}, {0x21, 0x41, 0x45, 0x4B, 0x31}, {0x18, 0x14, 0x12, 0x7F, 0x10},
+            {0x27, 0x45, 0x45, 0x45, 0x39}, {0x3C, 0x4A, 0x49, 0x49, 0x30}, {0x01, 0x71, 0x09, 0x05, 0x03},
+            {0x36, 0x49, 0x49, 0x49, 0x36}, {0x06, 0x49, 0x49, 0x29, 0x1E}, {0x00, 0x36, 0x36, 0x00, 0x00},
+            {0x00, 0x56, 0x36, 0x00, 0x00}, {0x08, 0x14, 0x22, 0x41, 0x00}, {0x14, 0x14, 0x14, 0x14, 0x14},
+            {0x00, 0x41, 0x22, 0x14, 0x08}, {0x02, 0x01, 0x51, 0x09, 0x06}, {0x32, 0x49, 0x79, 0x41, 0x3E},
+            {0x7E, 0x11, 0x11, 0x11, 0x7E}, {0x7F, 0x49, 0x49, 0x49, 0x36}, {0x3E, 0x41, 0x41, 0x41, 0x22},
+            {0x7F, 0x41, 0x41, 0x22, 0x1C}, {0x7F, 0x49, 0x49, 0x49, 0x41}, {0x7F, 0x09, 0x09, 0x01, 0x01},
+            {0x3E, 0x41, 0x41, 0x51, 0x32}, {0x7F, 0x08, 0x08, 0x08, 0x7F}, {0x00, 0x41, 0x7F, 0x41, 0x00},
+            {0x20, 0x40, 0x41, 0x3F, 0x01}, {0x7F, 0x08, 0x14, 0x22, 0x41}, {0x7F, 0x40, 0x40, 0x40, 0x40},
+            {0x7F, 0x02, 0x04, 0x02, 0x7F}, {0x7F, 0x04, 0x08, 0x10, 0x7F}, {0x3E, 0x41, 0x41, 0x41, 0x3E},
+            {0x7F, 0x09, 0x09, 0x09, 0x06}, {0x3E, 0x41, 0x51, 0x21, 0x5E}, {0x7F, 0x09, 0x19, 0x29, 0x46},
+            {0x46, 0x49, 0x49, 0x49, 0x31}, {0x01, 0x01, 0x7F, 0x01, 0x01}, {0x3F, 0x40, 0x40, 0x40, 0x3F},
+            {0x1F, 0x20, 0x40, 0x20, 0x1F}, {0x7F, 0x20, 0x18, 0x20, 0x7F}, {0x63, 0x14, 0x08, 0x14, 0x63},
+            {0x03, 0x04, 0x78, 0x04, 0x03}, {0x61, 0x51, 0x49, 0x45, 0x43}};
+        c = (char)std::toupper((unsigned char)c);
+        return c >= ' ' && c <= 'Z' ? font[c - ' '] : font['?' - ' '];
+    }
+
+    SDL_Renderer *renderer;
+    SDL_Texture *texture = nullptr;
+    int width = 0;
+    int height = 0;
+    std::vector<uint32_t> pixels{};
+    bool visible = false;
+
+    // last update, for the rates.
+    int64_t lastUs = -1;
+    uint64_t lastPresented = 0;
+    uint64_t lastDecoded = 0;
+    uint64_t lastDecodeUs = 0;
+    uint64_t lastFilterUs = 0;
+    uint64_t lastConvertUs = 0;
+    uint64_t lastPresentUs = 0;
+
+    void drawText(int line, const std::string &text)
+    {
+        for (int col = 0; col < (int)text.size() && col < COLS; col++)
+        {
+            const uint8_t *g = glyph(text[col]);
+            int x0 = MARGIN + col * CELL_W * SCALE;
+            int y0 = MARGIN + line * CELL_H * SCALE;
+            for (int gx = 0; gx < 5; gx++)
+            {
+                for (int gy = 0; gy < 7; gy++)
+                {
+                    if (!(g[gx] & (1 << gy)))
+                    {
+                        continue;
+                    }
+                    for (int s = 0; s < SCALE * SCALE; s++)
+                    {
+                        pixels[(y0 + gy * SCALE + s / SCALE) * width + x0 + gx * SCALE + s % SCALE] = 0xFFFFFFFF;
+                    }
+                }
+            }
+        }
+    }
+
+    static double perFrameMs(uint64_t us, uint64_t frames) { return frames > 0 ? us / 1000.0 / frames : 0; }
+
+public:
+    explicit StatsOverlay(SDL_Renderer *r) : renderer(r) {}
+    StatsOverlay(const StatsOverlay &) = delete;
+    StatsOverlay &operator=(const StatsOverlay &) = delete;
+    ~StatsOverlay()
+    {
+        if (texture != nullptr)
+        {
+            SDL_DestroyTexture(texture);
+        }
+    }
+
+    void setVisible(bool v)
+    {
+        visible = v;
+        lastUs = -1; // the next update starts a fresh interval
+    }
+    bool isVisible() const { return visible; }
+
+    // cheap when called more often than UPDATE_MS, the video loop calls it on every refresh tick.
+    void update(const Queues &queues)
+    {
+        if (!visible)
+        {
+            return;
+        }
+        auto &stats = ffmpegUtil::PlaybackStats::instance();
+        int64_t now = ffmpegUtil::PlayerClock::get().nowUs();
+        uint64_t presented = stats.framesPresented.load(std::memory_order_relaxed);
+        uint64_t decoded = stats.videoFramesDecoded.load(std::memory_order_relaxed);
+        uint64_t decodeUs = stats.videoDecodeUs.load(std::memory_order_relaxed);
+        uint64_t filterUs = stats.videoFilterUs.load(std::memory_order_relaxed);
+        uint64_t convertUs = stats.videoConvertUs.load(std::memory_order_relaxed);
+        uint64_t presentUs = stats.presentUs.load(std::memory_order_relaxed);
+        if (lastUs >= 0 && now - lastUs < UPDATE_MS * 1000)
+        {
+            return;
+        }
+        if (lastUs < 0)
+        {
+            // first call: only the baseline, the rates need an interval. Shown one interval later.
+            lastUs = now;
+            lastPresented = presented;
+            lastDecoded = decoded;
+            lastDecodeUs = decodeUs;
+            lastFilterUs = filterUs;
+            lastConvertUs = convertUs;
+            lastPresentUs = presentUs;
+            return;
+        }
+
+        double sec = (now - lastUs) / 1e6;
+        uint64_t dPresented = presented - lastPresented;
+        uint64_t dDecoded = decoded - lastDecoded;
+        char lines[LINES][COLS + 1];
+        std::snprintf(lines[0], sizeof(lines[0]), "PRESENT %5.1f FPS  DECODE %5.1f FPS", dPresented / sec,
+                      dDecoded / sec);
+        std::snprintf(lines[1], sizeof(lines[1]), "SKIPPED %llu  NOT READY %llu  UNDERRUNS %llu",
+                      (unsigned long long)stats.framesSkipped.load(),
+                      (unsigned long long)stats.framesNotReady.load(),
+                      (unsigned long long)stats.audioUnderruns.load());
+        std::snprintf(lines[2], sizeof(lines[2]), "A/V OFFSET %+lld MS  AUDIO BUFFER %.1f MS",
+                      (long long)stats.avOffsetMs.load(), stats.audioDeviceBufferUs.load() / 1000.0);
+        std::snprintf(lines[3], sizeof(lines[3]), "PACKETS V %d A %d  FRAMES V %d A %d", queues.videoPackets,
+                      queues.audioPackets, queues.videoFrames, queues.audioFrames);
+        std::snprintf(lines[4], sizeof(lines[4]), "MS/FRAME DEC %.2f FLT %.2f CONV %.2f PRES %.2f",
+                      perFrameMs(decodeUs - lastDecodeUs, dDecoded), perFrameMs(filterUs - lastFilterUs, dDecoded),
+                      perFrameMs(convertUs - lastConvertUs, dDecoded),
+                      perFrameMs(presentUs - lastPresentUs, dPresented));
+        std::snprintf(lines[5], sizeof(lines[5]), "SCENE CUTS %llu  DROPPED %llu  MS/FRAME %.2f",
+                      (unsigned long long)stats.sceneCuts.load(), (unsigned long long)stats.sceneDropped.load(),
+                      perFrameMs(stats.sceneAnalyzeUs.load(), stats.sceneFrames.load()));
+        lastUs = now;
+        lastPresented = presented;
+        lastDecoded = decoded;
+        lastDecodeUs = decodeUs;
+        lastFilterUs = filterUs;
+        lastConvertUs = convertUs;
+        lastPresentUs = presentUs;
+
+        if (texture == nullptr)
+        {
+            width = MARGIN * 2 + COLS * CELL_W * SCALE;
+            height = MARGIN * 2 + LINES * CELL_H * SCALE;
+            pixels.resize(width * height);
+            texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, width, height);
+            if (texture == nullptr)
+            {
+                ffmpegUtil::logWarn("overlay texture: %s", SDL_GetError());
+                visible = false;
+                return;
+            }
+            SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+        }
+        std::fill(pixels.begin(), pixels.end(), 0xA0000000); // translucent black
+        for (int i = 0; i < LINES; i++)
+        {
+            drawText(i, lines[i]);
+        }
+        SDL_UpdateTexture(texture, nullptr, pixels.data(), width * (int)sizeof(uint32_t));
+    }
+
+    // on top of the video, between SDL_RenderCopy of the frame and SDL_RenderPresent.
+    void draw()
+    {
+        if (!visible || texture == nullptr)
+        {
+            return;
+        }
+        SDL_Rect dst{0, 0, width, height};
+        SDL_RenderCopy(renderer, texture, nullptr, &dst);
+    }
+};
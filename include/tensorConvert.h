@@ -0,0 +1,284 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+#include <libavutil/frame.h>
+#ifdef __cplusplus
+};
+#endif
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TENSOR_CONVERT_SSE2 1
+#endif
+
+namespace ffmpegUtil
+{
+
+// YUV420P frame -> model input, in one pass (the VideoProcessor already scaled it to the tensor size):
+//   PLANAR_F32: 3 x H x W float32 planes R, G, B, each value (x / 255 - mean) / std.
+//   NHWC_U8:    H x W x 3 uint8, R G B per pixel.
+// BT.601 limited range, what swscale assumes for frames without colour information.
+// Each kernel exists per instruction set, find() returns the best one for this CPU.
+// The SSE2 kernels do the same float operations as the scalar ones: F32 output is identical up to
+// rounding of the last bit, U8 within 1 (player_microbench tensor_convert checks both).
+class TensorConvert
+{
+public:
+    enum Layout
+    {
+        PLANAR_F32,
+        NHWC_U8
+    };
+
+    enum Isa
+    {
+        SCALAR,
+        SSE2
+    };
+
+    // per channel R G B, applied to x / 255.
+    struct Norm
+    {
+        float mean[3] = {0, 0, 0};
+        float std[3] = {1, 1, 1};
+    };
+
+    // dst: the whole tensor of one frame, frame->width x frame->height.
+    typedef void (*Fn)(const AVFrame *frame, uint8_t *dst, const Norm &norm);
+
+private:
+    template <Isa ISA> struct Rows;
+
+    // out = x * scale + bias, with x in 0..255.
+    struct Affine
+    {
+        float scale[3];
+        float bias[3];
+
+        explicit Affine(const Norm &norm)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                scale[c] = 1.0f / (255.0f * norm.std[c]);
+                bias[c] = -norm.mean[c] / norm.std[c];
+            }
+        }
+    };
+
+    template <typename R> static void convertF32(const AVFrame *frame, uint8_t *dst, const Norm &norm)
+    {
+        Affine affine{norm};
+        int w = frame->width;
+        int h = frame->height;
+        float *planes[3];
+        for (int c = 0; c < 3; c++)
+        {
+            planes[c] = (float *)dst + (size_t)c * w * h;
+        }
+        for (int y = 0; y < h; y++)
+        {
+            const uint8_t *yRow = frame->data[0] + y * frame->linesize[0];
+            const uint8_t *uRow = frame->data[1] + y / 2 * frame->linesize[1];
+            const uint8_t *vRow = frame->data[2] + y / 2 * frame->linesize[2];
+            size_t offset = (size_t)y * w;
+            R::f32(yRow, uRow, vRow, planes[0] + offset, planes[1] + offset, planes[2] + offset, w, affine);
+        }
+    }
+
+    template <typename R> static void convertU8(const AVFrame *frame, uint8_t *dst, const Norm &)
+    {
+        int w = frame->width;
+        for (int y = 0; y < frame->height; y++)
+        {
+            const uint8_t *yRow = frame->data[0] + y * frame->linesize[0];
+            const uint8_t *uRow = frame->data[1] + y / 2 * frame->linesize[1];
+            const uint8_t *vRow = frame->data[2] + y / 2 * frame->linesize[2];
+            R::u8(yRow, uRow, vRow, dst + (size_t)y * w * 3, w);
+        }
+    }
+
+    template <typename R> static Fn select(Layout layout)
+    {
+        return layout == PLANAR_F32 ? convertF32<R> : convertU8<R>;
+    }
+
+public:
+    // kernel of one instruction set, nullptr when the CPU can not run it.
+    static Fn find(Layout layout, Isa isa);
+
+    // the fastest kernel for this CPU.
+    static Fn find(Layout layout, const char **isaName = nullptr);
+
+    // bytes of one frame's tensor.
+    static size_t frameBytes(Layout layout, int width, int height)
+    {
+        return (size_t)width * height * 3 * (layout == PLANAR_F32 ? sizeof(float) : 1);
+    }
+};
+
+template <> struct TensorConvert::Rows<TensorConvert::SCALAR>
+{
+    static float clamp(float x) { return x < 0 ? 0 : (x > 255 ? 255 : x); }
+
+    static void rgb(int y, int u, int v, float &r, float &g, float &b)
+    {
+        float yy = 1.164383f * (float)(y - 16);
+        float uu = (float)(u - 128);
+        float vv = (float)(v - 128);
+        r = clamp(yy + 1.596027f * vv);
+        g = clamp(yy - 0.391762f * uu - 0.812968f * vv);
+        b = clamp(yy + 2.017232f * uu);
+    }
+
+    static void f32(const uint8_t *y, const uint8_t *u, const uint8_t *v, float *r, float *g, float *b, int n,
+                    const Affine &a)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            float cr, cg, cb;
+            rgb(y[i], u[i / 2], v[i / 2], cr, cg, cb);
+            r[i] = cr * a.scale[0] + a.bias[0];
+            g[i] = cg * a.scale[1] + a.bias[1];
+            b[i] = cb * a.scale[2] + a.bias[2];
+        }
+    }
+
+    static void u8(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *rgbOut, int n)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            float cr, cg, cb;
+            rgb(y[i], u[i / 2], v[i / 2], cr, cg, cb);
+            rgbOut[i * 3] = (uint8_t)(cr + 0.5f);
+            rgbOut[i * 3 + 1] = (uint8_t)(cg + 0.5f);
+            rgbOut[i * 3 + 2] = (uint8_t)(cb + 0.5f);
+        }
+    }
+};
+
+#ifdef TENSOR_CONVERT_SSE2
+template <> struct TensorConvert::Rows<TensorConvert::SSE2>
+{
+    // 8 pixels: Y widened to two float vectors, the 4 chroma samples duplicated to match.
+    static void rgb8(const uint8_t *y, const uint8_t *u, const uint8_t *v, __m128 r[2], __m128 g[2], __m128 b[2])
+    {
+        const __m128i zero = _mm_setzero_si128();
+        int32_t u4, v4;
+        std::memcpy(&u4, u, 4);
+        std::memcpy(&v4, v, 4);
+        __m128i y16 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)y), zero);
+        __m128i u8 = _mm_cvtsi32_si128(u4);
+        __m128i v8 = _mm_cvtsi32_si128(v4);
+        __m128i u16 = _mm_unpacklo_epi8(_mm_unpacklo_epi8(u8, u8), zero);
+        __m128i v16 = _mm_unpacklo_epi8(_mm_unpacklo_epi8(v8, v8), zero);
+
+        const __m128 k16 = _mm_set1_ps(16.0f), k128 = _mm_set1_ps(128.0f);
+        const __m128 ky = _mm_set1_ps(1.164383f), krv = _mm_set1_ps(1.596027f), kgu = _mm_set1_ps(0.391762f),
+                     kgv = _mm_set1_ps(0.812968f), kbu = _mm_set1_ps(2.017232f);
+        const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(255.0f);
+        for (int half = 0; half < 2; half++)
+        {
+            __m128i y32 = half == 0 ? _mm_unpacklo_epi16(y16, zero) : _mm_unpackhi_epi16(y16, zero);
+            __m128i u32 = half == 0 ? _mm_unpacklo_epi16(u16, zero) : _mm_unpackhi_epi16(u16, zero);
+            __m128i v32 = half == 0 ? _mm_unpacklo_epi16(v16, zero) : _mm_unpackhi_epi16(v16, zero);
+            __m128 yy = _mm_mul_ps(ky, _mm_sub_ps(_mm_cvtepi32_ps(y32), k16));
+            __m128 uu = _mm_sub_ps(_mm_cvtepi32_ps(u32), k128);
+            __m128 vv = _mm_sub_ps(_mm_cvtepi32_ps(v32), k128);
+            r[half] = _mm_min_ps(hi, _mm_max_ps(lo, _mm_add_ps(yy, _mm_mul_ps(krv, vv))));
+            g[half] = _mm_min_ps(
+                hi, _mm_max_ps(lo, _mm_sub_ps(_mm_sub_ps(yy, _mm_mul_ps(kgu, uu)), _mm_mul_ps(kgv, vv))));
+            b[half] = _mm_min_ps(hi, _mm_max_ps(lo, _mm_add_ps(yy, _mm_mul_ps(kbu, uu))));
+        }
+    }
+
+    static void f32(const uint8_t *y, const uint8_t *u, const uint8_t *v, float *r, float *g, float *b, int n,
+                    const Affine &a)
+    {
+        const __m128 sr = _mm_set1_ps(a.scale[0]), sg = _mm_set1_ps(a.scale[1]), sb = _mm_set1_ps(a.scale[2]);
+        const __m128 br = _mm_set1_ps(a.bias[0]), bg = _mm_set1_ps(a.bias[1]), bb = _mm_set1_ps(a.bias[2]);
+        int i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m128 cr[2], cg[2], cb[2];
+            rgb8(y + i, u + i / 2, v + i / 2, cr, cg, cb);
+            for (int half = 0; half < 2; half++)
+            {
+                _mm_storeu_ps(r + i + half * 4, _mm_add_ps(_mm_mul_ps(cr[half], sr), br));
+                _mm_storeu_ps(g + i + half * 4, _mm_add_ps(_mm_mul_ps(cg[half], sg), bg));
+                _mm_storeu_ps(b + i + half * 4, _mm_add_ps(_mm_mul_ps(cb[half], sb), bb));
+            }
+        }
+        Rows<SCALAR>::f32(y + i, u + i / 2, v + i / 2, r + i, g + i, b + i, n - i, a);
+    }
+
+    static void u8(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *rgbOut, int n)
+    {
+        int i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m128 cr[2], cg[2], cb[2];
+            rgb8(y + i, u + i / 2, v + i / 2, cr, cg, cb);
+            // rounded, packed to 8 bytes per channel, then interleaved: SSE2 has no 3 way byte shuffle.
+            uint8_t planes[3][16];
+            __m128 *channels[3] = {cr, cg, cb};
+            for (int c = 0; c < 3; c++)
+            {
+                __m128i lo = _mm_cvtps_epi32(channels[c][0]);
+                __m128i hi = _mm_cvtps_epi32(channels[c][1]);
+                __m128i packed = _mm_packs_epi32(lo, hi);
+                _mm_storeu_si128((__m128i *)planes[c], _mm_packus_epi16(packed, packed));
+            }
+            uint8_t *out = rgbOut + i * 3;
+            for (int k = 0; k < 8; k++)
+            {
+                out[k * 3] = planes[0][k];
+                out[k * 3 + 1] = planes[1][k];
+                out[k * 3 + 2] = planes[2][k];
+            }
+        }
+        Rows<SCALAR>::u8(y + i, u + i / 2, v + i / 2, rgbOut + i * 3, n - i);
+    }
+};
+#endif
+
+// after the Rows specializations, which select() instantiates.
+inline TensorConvert::Fn TensorConvert::find(Layout layout, Isa isa)
+{
+    switch (isa)
+    {
+#ifdef TENSOR_CONVERT_SSE2
+    case SSE2:
+        return select<Rows<SSE2>>(layout);
+#endif
+    case SCALAR:
+        return select<Rows<SCALAR>>(layout);
+    default:
+        return nullptr;
+    }
+}
+
+inline TensorConvert::Fn TensorConvert::find(Layout layout, const char **isaName)
+{
+    static const char *names[] = {"scalar", "sse2"};
+    for (int isa = SSE2; isa >= SCALAR; isa--)
+    {
+        Fn fn = find(layout, (Isa)isa);
+        if (fn != nullptr)
+        {
+            if (isaName != nullptr)
+            {
+                *isaName = names[isa];
+            }
+            return fn;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace ffmpegUtil
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "logger.h"
+#include "npyWriter.h"
+#include "outputSink.h"
+#include "tensorConvert.h"
+#include "traceRecorder.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// -tensor out.npy: every frame it gets becomes one model input in a .npy file, converted straight
+// into the mapped file (NpyBatchWriter), no intermediate copy. Frames arrive YUV420P at the tensor
+// size, the VideoProcessor scaled them (setOutputSize) and dropped the ones not sampled.
+//   PLANAR_F32: shape (N, 3, H, W) float32, normalized with norm.
+//   NHWC_U8:    shape (N, H, W, 3) uint8.
+class TensorVideoSink : public VideoSink
+{
+    const std::string path;
+    const ffmpegUtil::TensorConvert::Layout layout;
+    const ffmpegUtil::TensorConvert::Norm norm;
+    const int batch;
+    ffmpegUtil::TensorConvert::Fn convert = nullptr;
+    std::unique_ptr<ffmpegUtil::NpyBatchWriter> writer{};
+    int width = 0;
+    int height = 0;
+
+public:
+    TensorVideoSink(const std::string &p, ffmpegUtil::TensorConvert::Layout l,
+                    const ffmpegUtil::TensorConvert::Norm &n, int b)
+        : path(p), layout(l), norm(n), batch(b)
+    {
+    }
+
+    void open(int w, int h, AVRational) override
+    {
+        using ffmpegUtil::TensorConvert;
+        width = w;
+        height = h;
+        const char *isa = nullptr;
+        convert = TensorConvert::find(layout, &isa);
+        bool f32 = layout == TensorConvert::PLANAR_F32;
+        std::vector<int> shape = f32 ? std::vector<int>{3, h, w} : std::vector<int>{h, w, 3};
+        writer.reset(new ffmpegUtil::NpyBatchWriter(path, f32 ? "<f4" : "|u1", shape,
+                                                    TensorConvert::frameBytes(layout, w, h), batch));
+        ffmpegUtil::logInfo("tensor sink: %s, %dx%d%s, batches of %d, %s kernel", path.c_str(), w, h,
+                            f32 ? " planar float32" : " NHWC uint8", batch, isa);
+    }
+
+    void write(const AVFrame *frame, uint64_t) override
+    {
+        if (frame->width != width || frame->height != height)
+        {
+            ffmpegUtil::logWarn("tensor sink: frame %dx%d dropped", frame->width, frame->height);
+            return;
+        }
+        ffmpegUtil::TraceScope trace("tensor convert");
+        convert(frame, writer->next(), norm);
+    }
+
+    void close() override
+    {
+        if (writer != nullptr)
+        {
+            writer->close();
+        }
+    }
+
+    uint64_t getFrames() const { return writer != nullptr ? writer->getCount() : 0; }
+};
@@ -0,0 +1,269 @@
+#pragma once
+
+#include "logger.h"
+#include "traceRecorder.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace ffmpegUtil
+{
+
+// Where and how the pipeline threads run. Every thread calls apply() with its role once, when it
+// starts: it gets its name (top -H, gdb, the trace), the CPUs configured for the role and, for the
+// audio path, a better scheduling class when asked for. Threads we do not run the code of at
+// start (the SDL audio callback) record currentThread() and get applyTo() from another thread.
+// The main thread is not renamed, that would rename the process.
+//
+// NUMA: there is no explicit node binding. A pinned thread first-touches its own buffers (decoded
+// frames from the FramePool, outPic and the audio buffer are all first written by their decoder
+// thread), so they end up on the node of the CPUs it is pinned to.
+class ThreadPolicy
+{
+public:
+    enum Role
+    {
+        READER,
+        VIDEO_DECODER,
+        AUDIO_DECODER,
+        RENDER,
+        REFRESH,
+        AUDIO_OUTPUT, // SDL audio callback / virtual audio
+        SINK,
+        PREFETCH,
+        ANALYZER,
+        ROLE_COUNT
+    };
+
+    struct ThreadHandle
+    {
+#ifndef _WIN32
+        pthread_t thread{};
+#endif
+        long tid = 0; // kernel thread id, setpriority() takes it
+    };
+
+private:
+    std::vector<int> cpus[ROLE_COUNT];
+    bool pinning = false;
+#ifdef __linux__
+    cpu_set_t processCpus{}; // threads inherit the mask of their creator, unpinned roles get this back
+#endif
+    bool realtimeAudio = false;
+    int realtimePriority = 10;
+    int audioNice = -10;
+
+    ThreadPolicy() = default;
+
+    static const char *roleName(int role)
+    {
+        static const char *names[ROLE_COUNT] = {"reader", "video", "audio", "render",
+                                                "refresh", "audio-out", "sink", "prefetch",
+                                                "analyzer"};
+        return names[role];
+    }
+
+    // "0,2-5"
+    static std::vector<int> parseCpuList(const string &list)
+    {
+        std::vector<int> result{};
+        size_t pos = 0;
+        while (pos < list.size())
+        {
+            size_t end = list.find(',', pos);
+            string item = list.substr(pos, end == string::npos ? string::npos : end - pos);
+            size_t dash = item.find('-');
+            int first = std::stoi(item.substr(0, dash));
+            int last = dash == string::npos ? first : std::stoi(item.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++)
+            {
+                result.push_back(cpu);
+            }
+            pos = end == string::npos ? list.size() : end + 1;
+        }
+        return result;
+    }
+
+    static void log(const string &name, const string &what)
+    {
+        logInfo("thread policy: [%s] %s", name.c_str(), what.c_str());
+    }
+
+    static bool isMainThread(const ThreadHandle &t)
+    {
+#if defined(__linux__)
+        return t.tid == (long)getpid();
+#elif defined(__APPLE__)
+        return pthread_equal(t.thread, pthread_self()) && pthread_main_np() != 0;
+#else
+        (void)t;
+        return false;
+#endif
+    }
+
+    static void setName(const ThreadHandle &t, const string &name)
+    {
+        if (isMainThread(t))
+        {
+            return;
+        }
+#if defined(__linux__)
+        pthread_setname_np(t.thread, name.substr(0, 15).c_str()); // 16 bytes with the 0
+#elif defined(__APPLE__)
+        if (pthread_equal(t.thread, pthread_self())) // only the calling thread can be named
+        {
+            pthread_setname_np(name.c_str());
+        }
+#else
+        (void)name;
+#endif
+    }
+
+    void pin(const ThreadHandle &t, Role role, const string &name)
+    {
+#ifdef __linux__
+        if (cpus[role].empty())
+        {
+            pthread_setaffinity_np(t.thread, sizeof(processCpus), &processCpus);
+            return;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus[role])
+        {
+            CPU_SET(cpu, &set);
+        }
+        int err = pthread_setaffinity_np(t.thread, sizeof(set), &set);
+        log(name, err == 0 ? "pinned to " + std::to_string(cpus[role].size()) + " cpu(s)"
+                           : string("can not pin: ") + std::strerror(err));
+#else
+        (void)t;
+        log(name, "cpu pinning is not supported on this platform");
+#endif
+    }
+
+    // SCHED_FIFO needs CAP_SYS_NICE or an rtprio limit, a negative nice value the nice limit;
+    // without either the thread keeps the default policy.
+    void raise(const ThreadHandle &t, Role role, const string &name)
+    {
+#ifdef __linux__
+        if (role == AUDIO_OUTPUT)
+        {
+            sched_param param{};
+            param.sched_priority = realtimePriority;
+            int err = pthread_setschedparam(t.thread, SCHED_FIFO, &param);
+            if (err == 0)
+            {
+                log(name, "SCHED_FIFO priority " + std::to_string(realtimePriority));
+                return;
+            }
+        }
+        if (setpriority(PRIO_PROCESS, (id_t)t.tid, audioNice) == 0)
+        {
+            log(name, "nice " + std::to_string(audioNice));
+        }
+        else
+        {
+            log(name, string("default priority, no permission for SCHED_FIFO or nice: ") + std::strerror(errno));
+        }
+#else
+        (void)t;
+        (void)role;
+        log(name, "real-time audio is not supported on this platform");
+#endif
+    }
+
+public:
+    static ThreadPolicy &instance()
+    {
+        static ThreadPolicy policy{};
+        return policy;
+    }
+
+    // "role=cpus:role=cpus", e.g. "audio-out=1:video=4-7:reader=2".
+    // roles: reader video audio render refresh audio-out sink prefetch. Set it before any thread starts.
+    void configure(const string &spec)
+    {
+        size_t pos = 0;
+        while (pos < spec.size())
+        {
+            size_t end = spec.find(':', pos);
+            string item = spec.substr(pos, end == string::npos ? string::npos : end - pos);
+            size_t eq = item.find('=');
+            int role = 0;
+            while (role < ROLE_COUNT && (eq == string::npos || item.compare(0, eq, roleName(role)) != 0))
+            {
+                role++;
+            }
+            if (role == ROLE_COUNT)
+            {
+                string errMsg = "Bad thread affinity: ";
+                errMsg += item;
+                logError("%s", errMsg.c_str());
+                throw std::runtime_error(errMsg);
+            }
+            cpus[role] = parseCpuList(item.substr(eq + 1));
+            pinning = true;
+            pos = end == string::npos ? spec.size() : end + 1;
+        }
+#ifdef __linux__
+        sched_getaffinity(0, sizeof(processCpus), &processCpus);
+#endif
+    }
+
+    // audio output: SCHED_FIFO (falls back to nice), audio decoder: nice.
+    void setRealtimeAudio(bool enabled, int priority = 10)
+    {
+        realtimeAudio = enabled;
+        realtimePriority = priority;
+    }
+
+    // the calling thread, cheap: no lock, at most one syscall.
+    static ThreadHandle currentThread()
+    {
+        ThreadHandle t{};
+#ifndef _WIN32
+        t.thread = pthread_self();
+#endif
+#ifdef __linux__
+        t.tid = (long)syscall(SYS_gettid);
+#endif
+        return t;
+    }
+
+    // called by the thread itself.
+    void apply(Role role, const string &name)
+    {
+        TraceRecorder::instance().setThreadName(name);
+        applyTo(currentThread(), role, name);
+    }
+
+    // for a thread that can not do it itself, it has to be alive. Takes locks and logs.
+    void applyTo(const ThreadHandle &t, Role role, const string &name)
+    {
+        setName(t, name);
+        if (pinning)
+        {
+            pin(t, role, name);
+        }
+        if (realtimeAudio && (role == AUDIO_OUTPUT || role == AUDIO_DECODER))
+        {
+            raise(t, role, name);
+        }
+    }
+};
+
+} // namespace ffmpegUtil
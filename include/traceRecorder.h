@@ -0,0 +1,273 @@
+#pragma once
+
+#include "logger.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace ffmpegUtil
+{
+using std::string;
+
+// Timeline recorder for pipeline events, written out as a Chrome trace (chrome://tracing, Perfetto).
+//
+// Every thread records into its own fixed size buffer, so the record path takes no lock and
+// never allocates: one relaxed load when tracing is off, a slot write plus a release store when
+// it is on. A full buffer drops further events and counts them.
+// Only the pointer of an event name is stored: names are string literals, or built once with
+// intern(). A thread that must not allocate (the SDL audio callback) gets a buffer reserved for
+// it from another thread with reserveThreadBuffer() and takes it with adoptThreadBuffer().
+class TraceRecorder
+{
+public:
+    struct ThreadBuffer;
+
+private:
+    struct Event
+    {
+        const char *name;
+        char phase; // 'B' begin, 'E' end, 'i' instant
+        int64_t ts; // us since the recorder was created
+    };
+
+public:
+    struct ThreadBuffer
+    {
+        int tid = 0;
+        string threadName{};
+        std::unique_ptr<Event[]> events{};
+        std::atomic<size_t> count{0};
+        std::atomic<uint64_t> dropped{0};
+    };
+
+private:
+    static const size_t EVENTS_PER_THREAD = 1 << 16;
+
+    std::atomic<bool> enabled{false};
+    std::mutex buffersMutex{};
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers{};
+    std::mutex namesMutex{};
+    std::set<string> names{}; // set nodes do not move, the c_str() of a name stays valid
+    const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    TraceRecorder() = default;
+
+    // buffers are owned by the recorder, they stay valid after their thread has exited.
+    static ThreadBuffer *&currentBuffer()
+    {
+        static thread_local ThreadBuffer *buffer = nullptr;
+        return buffer;
+    }
+
+    ThreadBuffer *newBuffer(const string &threadName)
+    {
+        std::unique_ptr<ThreadBuffer> b{new ThreadBuffer()};
+        b->events.reset(new Event[EVENTS_PER_THREAD]);
+        std::lock_guard<std::mutex> lg(buffersMutex);
+        b->tid = (int)buffers.size() + 1;
+        b->threadName = threadName.empty() ? "thread-" + std::to_string(b->tid) : threadName;
+        buffers.push_back(std::move(b));
+        return buffers.back().get();
+    }
+
+    ThreadBuffer *threadBuffer()
+    {
+        ThreadBuffer *&buffer = currentBuffer();
+        if (buffer == nullptr)
+        {
+            buffer = newBuffer(string());
+        }
+        return buffer;
+    }
+
+    void record(const char *name, char phase)
+    {
+        auto buffer = threadBuffer();
+        size_t n = buffer->count.load(std::memory_order_relaxed);
+        if (n >= EVENTS_PER_THREAD)
+        {
+            buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        auto ts = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now() - startTime)
+                      .count();
+        buffer->events[n] = Event{name, phase, ts};
+        buffer->count.store(n + 1, std::memory_order_release);
+    }
+
+    // names come from the command line as well (-vf), quote them as JSON strings.
+    static void writeEscaped(std::ostream &os, const char *s)
+    {
+        for (; *s != '\0'; s++)
+        {
+            unsigned char c = (unsigned char)*s;
+            if (c < 0x20)
+            {
+                char hex[8];
+                std::snprintf(hex, sizeof(hex), "\\u%04x", c);
+                os << hex;
+                continue;
+            }
+            if (c == '"' || c == '\\')
+            {
+                os << '\\';
+            }
+            os << (char)c;
+        }
+    }
+
+public:
+    TraceRecorder(const TraceRecorder &) = delete;
+    TraceRecorder &operator=(const TraceRecorder &) = delete;
+
+    static TraceRecorder &instance()
+    {
+        static TraceRecorder recorder{};
+        return recorder;
+    }
+
+    void setEnabled(bool e) { enabled.store(e); }
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    // a name built at run time ("filter " + description), valid as long as the recorder.
+    const char *intern(const string &name)
+    {
+        std::lock_guard<std::mutex> lg(namesMutex);
+        return names.insert(name).first->c_str();
+    }
+
+    // a buffer for a thread that will take it with adoptThreadBuffer(), nullptr when tracing is off.
+    ThreadBuffer *reserveThreadBuffer(const string &threadName)
+    {
+        return isEnabled() ? newBuffer(threadName) : nullptr;
+    }
+
+    // no lock, no allocation. nullptr leaves the calling thread as it is.
+    void adoptThreadBuffer(ThreadBuffer *buffer)
+    {
+        if (buffer != nullptr)
+        {
+            currentBuffer() = buffer;
+        }
+    }
+
+    // name shown for the calling thread in the trace viewer.
+    void setThreadName(const string &name)
+    {
+        if (!isEnabled())
+        {
+            return;
+        }
+        auto buffer = threadBuffer();
+        std::lock_guard<std::mutex> lg(buffersMutex);
+        buffer->threadName = name;
+    }
+
+    void begin(const char *name)
+    {
+        if (isEnabled())
+        {
+            record(name, 'B');
+        }
+    }
+
+    void end(const char *name)
+    {
+        if (isEnabled())
+        {
+            record(name, 'E');
+        }
+    }
+
+    void instant(const char *name)
+    {
+        if (isEnabled())
+        {
+            record(name, 'i');
+        }
+    }
+
+    // Write all buffers as Chrome trace JSON. Call it once the pipeline threads are stopped,
+    // events recorded while writing may or may not show up.
+    bool writeChromeTrace(const string &path)
+    {
+        std::ofstream os(path);
+        if (!os)
+        {
+            logWarn("can not open trace file: %s", path.c_str());
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lg(buffersMutex);
+        size_t total = 0;
+        uint64_t dropped = 0;
+        bool first = true;
+        os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        for (auto &b : buffers)
+        {
+            os << (first ? "\n" : ",\n");
+            first = false;
+            os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->tid
+               << ",\"args\":{\"name\":\"";
+            writeEscaped(os, b->threadName.c_str());
+            os << "\"}}";
+
+            size_t n = b->count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < n; i++)
+            {
+                const Event &e = b->events[i];
+                os << ",\n{\"name\":\"";
+                writeEscaped(os, e.name);
+                os << "\",\"ph\":\"" << e.phase << "\",\"ts\":" << e.ts << ",\"pid\":1,\"tid\":" << b->tid;
+                if (e.phase == 'i')
+                {
+                    os << ",\"s\":\"t\"";
+                }
+                os << "}";
+            }
+            total += n;
+            dropped += b->dropped.load();
+        }
+        os << "\n]}\n";
+
+        logInfo("trace written: %s, events = %zu, dropped = %llu, threads = %zu", path.c_str(), total,
+                (unsigned long long)dropped, buffers.size());
+        return true;
+    }
+};
+
+// begin / end pair for the enclosing block.
+class TraceScope
+{
+    const char *name;
+    bool active;
+
+public:
+    explicit TraceScope(const char *n) : name(n), active(TraceRecorder::instance().isEnabled())
+    {
+        if (active)
+        {
+            TraceRecorder::instance().begin(name);
+        }
+    }
+    ~TraceScope()
+    {
+        if (active)
+        {
+            TraceRecorder::instance().end(name);
+        }
+    }
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+};
+
+} // namespace ffmpegUtil
@@ -0,0 +1,315 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixdesc.h>
+#ifdef __cplusplus
+};
+#endif
+
+#include "logger.h"
+#include "traceRecorder.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace ffmpegUtil
+{
+
+// Video filter stage between the decoder and the conversion (-vf "yadif,hqdn3d,eq=contrast=1.1").
+//
+// A plain chain "a,b,c" becomes one buffer -> filter -> buffersink graph per filter, so the cost of
+// every filter can be measured on its own. Descriptions with labels or several chains ('[', ';')
+// are run as one graph and reported as one stage. Frames go from the decoder through every stage
+// by reference (av_buffersrc_add_frame_flags with KEEP_REF / moved between stages), nothing is copied
+// unless a filter writes in place on a frame it shares.
+//
+// threads: slice threads of every graph (AVFilterGraph::nb_threads), 0 lets libavfilter decide.
+// push() and pull() run on the decoder thread.
+class VideoFilter
+{
+    struct Stage
+    {
+        std::string description;
+        const char *traceName = nullptr;
+        AVFilterGraph *graph = nullptr;
+        AVFilterContext *src = nullptr;
+        AVFilterContext *sink = nullptr;
+        AVFrame *frame = av_frame_alloc(); // output of the stage
+        bool flushed = false;               // EOF sent to src
+        uint64_t us = 0;
+        uint64_t frames = 0;
+
+        ~Stage()
+        {
+            av_frame_free(&frame);
+            avfilter_graph_free(&graph);
+        }
+    };
+
+    std::string description;
+    int threads = 0;
+    int inWidth = 0;
+    int inHeight = 0;
+    int inFormat = AV_PIX_FMT_NONE;
+    AVRational inTimeBase{1, 0};
+    std::vector<std::unique_ptr<Stage>> stages{};
+
+    static std::vector<std::string> splitChain(const std::string &desc)
+    {
+        if (desc.find_first_of("[;") != std::string::npos)
+        {
+            return {desc};
+        }
+        std::vector<std::string> filters{};
+        std::string current{};
+        bool quoted = false;
+        for (size_t i = 0; i < desc.size(); i++)
+        {
+            char c = desc[i];
+            if (c == '\\' && i + 1 < desc.size())
+            {
+                current += c;
+                current += desc[++i];
+                continue;
+            }
+            if (c == '\'')
+            {
+                quoted = !quoted;
+            }
+            if (c == ',' && !quoted)
+            {
+                filters.push_back(current);
+                current.clear();
+                continue;
+            }
+            current += c;
+        }
+        filters.push_back(current);
+        return filters;
+    }
+
+    static void check(int ret, const std::string &what)
+    {
+        if (ret < 0)
+        {
+            char err[AV_ERROR_MAX_STRING_SIZE] = {0};
+            av_strerror(ret, err, sizeof(err));
+            std::string errMsg = "video filter: " + what + ": " + err;
+            logError("%s", errMsg.c_str());
+            throw std::runtime_error(errMsg);
+        }
+    }
+
+    static std::unique_ptr<Stage> makeStage(const std::string &desc, int threads, int width, int height,
+                                            int format, AVRational timeBase, AVRational sar)
+    {
+        std::unique_ptr<Stage> stage{new Stage()};
+        stage->description = desc;
+        stage->traceName = TraceRecorder::instance().intern("filter " + desc.substr(0, desc.find('=')));
+        stage->graph = avfilter_graph_alloc();
+        stage->graph->nb_threads = threads;
+
+        char args[256];
+        std::snprintf(args, sizeof(args), "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+                      width, height, format, timeBase.num, timeBase.den, sar.num, sar.den != 0 ? sar.den : 1);
+        check(avfilter_graph_create_filter(&stage->src, avfilter_get_by_name("buffer"), "in", args, nullptr,
+                                           stage->graph),
+              "buffer source");
+        check(avfilter_graph_create_filter(&stage->sink, avfilter_get_by_name("buffersink"), "out", nullptr,
+                                           nullptr, stage->graph),
+              "buffer sink");
+
+        // the open ends of the parsed description: its input is "in", its output "out".
+        AVFilterInOut *outputs = avfilter_inout_alloc();
+        AVFilterInOut *inputs = avfilter_inout_alloc();
+        outputs->name = av_strdup("in");
+        outputs->filter_ctx = stage->src;
+        outputs->pad_idx = 0;
+        outputs->next = nullptr;
+        inputs->name = av_strdup("out");
+        inputs->filter_ctx = stage->sink;
+        inputs->pad_idx = 0;
+        inputs->next = nullptr;
+        int ret = avfilter_graph_parse_ptr(stage->graph, desc.c_str(), &inputs, &outputs, nullptr);
+        avfilter_inout_free(&inputs);
+        avfilter_inout_free(&outputs);
+        check(ret, "\"" + desc + "\"");
+        check(avfilter_graph_config(stage->graph, nullptr), "\"" + desc + "\"");
+        return stage;
+    }
+
+    // 0: stages[i]->frame holds a frame, AVERROR(EAGAIN): more input needed, AVERROR_EOF: drained.
+    int pullStage(size_t i)
+    {
+        Stage &stage = *stages[i];
+        while (true)
+        {
+            int ret;
+            auto start = std::chrono::steady_clock::now();
+            {
+                TraceScope trace(stage.traceName);
+                ret = av_buffersink_get_frame(stage.sink, stage.frame);
+            }
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            stage.us += (uint64_t)us.count();
+            if (ret >= 0)
+            {
+                stage.frames++;
+                return 0;
+            }
+            if (ret != AVERROR(EAGAIN) || i == 0)
+            {
+                return ret;
+            }
+
+            // feed this stage from the one in front of it.
+            int prev = pullStage(i - 1);
+            if (prev == AVERROR(EAGAIN))
+            {
+                return prev;
+            }
+            if (prev == AVERROR_EOF)
+            {
+                if (stage.flushed)
+                {
+                    return AVERROR_EOF;
+                }
+                stage.flushed = true;
+                check(av_buffersrc_add_frame_flags(stage.src, nullptr, 0), "flush");
+                continue;
+            }
+            check(prev, "\"" + stages[i - 1]->description + "\"");
+            // moves the reference, stages[i - 1]->frame is reset.
+            check(av_buffersrc_add_frame_flags(stage.src, stages[i - 1]->frame, 0),
+                  "\"" + stage.description + "\"");
+        }
+    }
+
+    std::vector<std::unique_ptr<Stage>> build(int width, int height, int format, AVRational timeBase,
+                                              AVRational sar) const
+    {
+        std::vector<std::unique_ptr<Stage>> built{};
+        for (auto &d : splitChain(description))
+        {
+            built.push_back(makeStage(d, threads, width, height, format, timeBase, sar));
+            AVFilterContext *out = built.back()->sink;
+            width = av_buffersink_get_w(out);
+            height = av_buffersink_get_h(out);
+            format = av_buffersink_get_format(out);
+            timeBase = av_buffersink_get_time_base(out);
+            sar = av_buffersink_get_sample_aspect_ratio(out);
+        }
+        return built;
+    }
+
+    void rebuild(const AVFrame *frame)
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto built = build(frame->width, frame->height, frame->format, inTimeBase, frame->sample_aspect_ratio);
+        for (size_t i = 0; i < built.size() && i < stages.size(); i++)
+        {
+            built[i]->us = stages[i]->us;
+            built[i]->frames = stages[i]->frames;
+        }
+        stages = std::move(built);
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        logInfo("video filter: input %dx%d %s -> %dx%d %s, graphs rebuilt in %lldus, output %dx%d %s", inWidth,
+                inHeight, av_get_pix_fmt_name((AVPixelFormat)inFormat), frame->width, frame->height,
+                av_get_pix_fmt_name((AVPixelFormat)frame->format), (long long)us.count(), getWidth(), getHeight(),
+                av_get_pix_fmt_name(getFormat()));
+        inWidth = frame->width;
+        inHeight = frame->height;
+        inFormat = frame->format;
+    }
+
+public:
+    // the input: the decoder's frames, of that size, format, time base and pixel aspect.
+    VideoFilter(const std::string &desc, int threadCount, int width, int height, int format, AVRational timeBase,
+                AVRational sar)
+        : description(desc), threads(threadCount), inWidth(width), inHeight(height), inFormat(format),
+          inTimeBase(timeBase)
+    {
+        stages = build(width, height, format, timeBase, sar);
+        logInfo("video filter: \"%s\", %zu stage(s), output %dx%d %s, %s slice threads", desc.c_str(), stages.size(),
+                getWidth(), getHeight(), av_get_pix_fmt_name(getFormat()),
+                threads > 0 ? std::to_string(threads).c_str() : "auto");
+    }
+
+    VideoFilter(const VideoFilter &) = delete;
+    VideoFilter &operator=(const VideoFilter &) = delete;
+
+    ~VideoFilter()
+    {
+        for (auto &stage : stages)
+        {
+            logInfo("video filter \"%s\": frames = %llu, ms/frame = %.3f", stage->description.c_str(),
+                    (unsigned long long)stage->frames, stage->frames > 0 ? stage->us / 1000.0 / stage->frames : 0.0);
+        }
+    }
+
+    // a decoded frame into the first stage, referenced not copied: the caller may reuse its frame.
+    // nullptr marks the end of the stream, pull() then drains what the filters still hold.
+    // A frame of another size or pixel format than the input so far (a mid-stream change) gets
+    // new graphs built for it, the frames the old ones still held are dropped, as ffplay does.
+    void push(AVFrame *frame)
+    {
+        if (frame != nullptr && (frame->width != inWidth || frame->height != inHeight || frame->format != inFormat))
+        {
+            rebuild(frame);
+        }
+        Stage &first = *stages.front();
+        if (frame == nullptr)
+        {
+            if (first.flushed)
+            {
+                return;
+            }
+            first.flushed = true;
+        }
+        auto start = std::chrono::steady_clock::now();
+        int ret;
+        {
+            TraceScope trace(first.traceName);
+            ret = av_buffersrc_add_frame_flags(first.src, frame, AV_BUFFERSRC_FLAG_KEEP_REF);
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        first.us += (uint64_t)us.count();
+        check(ret, "\"" + first.description + "\"");
+    }
+
+    // the next filtered frame, owned by the filter and valid until the next pull(). nullptr when
+    // the filters need more input, or everything was drained after push(nullptr).
+    AVFrame *pull()
+    {
+        Stage &last = *stages.back();
+        av_frame_unref(last.frame);
+        int ret = pullStage(stages.size() - 1);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+        {
+            return nullptr;
+        }
+        check(ret, "\"" + last.description + "\"");
+        return last.frame;
+    }
+
+    // the output of the last stage.
+    int getWidth() const { return av_buffersink_get_w(stages.back()->sink); }
+    int getHeight() const { return av_buffersink_get_h(stages.back()->sink); }
+    AVPixelFormat getFormat() const { return (AVPixelFormat)av_buffersink_get_format(stages.back()->sink); }
+    AVRational getTimeBase() const { return av_buffersink_get_time_base(stages.back()->sink); }
+    const std::string &getDescription() const { return description; }
+};
+
+} // namespace ffmpegUtil
@@ -1,11 +1,287 @@
+#include "logger.h"
+#include "playOptions.h"
+
+#include <algorithm>
 #include <iostream>
+#include <string>
+#include <vector>
 using std::string;
 
-extern void playVideoWithAudio(const string &inputfile);
+extern void playVideoWithAudio(const string &inputfile, const PlayOptions &opts);
+extern void playMosaicInputs(const std::vector<string> &inputs, const PlayOptions &opts);
+extern void exportTensorFrames(const string &inputFile, const PlayOptions &opts);
+extern void decodeSegmentsParallel(const string &inputFile, const PlayOptions &opts);
+extern void extractClip(const string &inputFile, const PlayOptions &opts);
+
+namespace
+{
+// "1.5,3,10" -> {1.5, 3, 10}
+std::vector<double> parseList(const string &list)
+{
+    std::vector<double> values{};
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t comma = list.find(',', start);
+        string item = list.substr(start, comma == string::npos ? string::npos : comma - start);
+        if (!item.empty())
+        {
+            values.push_back(std::stod(item));
+        }
+        if (comma == string::npos)
+        {
+            break;
+        }
+        start = comma + 1;
+    }
+    return values;
+}
+
+void parseTriple(const string &list, float out[3])
+{
+    auto values = parseList(list);
+    for (int c = 0; c < 3; c++)
+    {
+        out[c] = (float)values.at(values.size() == 1 ? 0 : c);
+    }
+}
+} // namespace
 
-int main()
+// usage: player [-vn] [-an] [-vst index] [-ast index] [-trace file.json] [-lowlatency] [-latency-probe]
+//               [-vsink sdl|null|y4m:path] [-asink sdl|null|wav:path] [-review] [-cache-mb N]
+//               [-volume percent] [-no-frame-pool] [-hugepages] [-affinity role=cpus:...] [-rt-audio]
+//               [-overlay] [-export-shm name[:slots]] [-vf filters] [-filter-threads N]
+//               [-scenes] [-scene-threshold x] [-scene-out path] [-log-level debug|info|warn|error|off]
+//               [inputFile]
+//        player -mosaic [-mosaic-size WxH] input1 input2 ... (4 to 16 cameras, video only)
+//        player -tensor out.npy [-tensor-size WxH] [-tensor-format f32|u8] [-tensor-every N | -tensor-at s,s,...]
+//               [-tensor-batch N] [-tensor-mean r,g,b] [-tensor-std r,g,b] [-scenes ...] inputFile
+//               (headless, no SDL)
+//        player -parallel N [-parallel-mb N] [-vsink null|y4m:path] [-frame-hash] [-parallel-scaling] inputFile
+//               (headless, N decoders on segments of the file)
+//        player -clip out.mkv [-clip-start s] [-clip-end s] [-clip-reencode] [-vst N] [-ast N] [-vn] [-an] inputFile
+//               (headless stream copy, no decoding)
+// keys: up / down volume, o performance overlay
+// review keys: space pause / resume, left / right step one frame, r reverse playback
+int main(int argc, char *argv[])
 {
     string inputFile = "/Users/dql/Downloads/test.mp4";
-    playVideoWithAudio(inputFile);
+    PlayOptions opts{};
+    std::vector<string> inputs{};
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "-vn")
+        {
+            opts.disableVideo = true;
+        }
+        else if (arg == "-an")
+        {
+            opts.disableAudio = true;
+        }
+        else if (arg == "-vst" && i + 1 < argc)
+        {
+            opts.videoStream = std::stoi(argv[++i]);
+        }
+        else if (arg == "-ast" && i + 1 < argc)
+        {
+            opts.audioStream = std::stoi(argv[++i]);
+        }
+        else if (arg == "-lowlatency")
+        {
+            opts.lowLatency = true;
+        }
+        else if (arg == "-latency-probe")
+        {
+            opts.latencyProbe = true;
+        }
+        else if (arg == "-trace" && i + 1 < argc)
+        {
+            opts.tracePath = argv[++i];
+        }
+        else if (arg == "-vsink" && i + 1 < argc)
+        {
+            opts.videoSink = argv[++i];
+        }
+        else if (arg == "-asink" && i + 1 < argc)
+        {
+            opts.audioSink = argv[++i];
+        }
+        else if (arg == "-review")
+        {
+            opts.review = true;
+        }
+        else if (arg == "-cache-mb" && i + 1 < argc)
+        {
+            opts.cacheMb = std::stoi(argv[++i]);
+        }
+        else if (arg == "-volume" && i + 1 < argc)
+        {
+            opts.volume = std::stoi(argv[++i]);
+        }
+        else if (arg == "-no-frame-pool")
+        {
+            opts.framePool = false;
+        }
+        else if (arg == "-hugepages")
+        {
+            opts.hugePages = true;
+        }
+        else if (arg == "-log-level" && i + 1 < argc)
+        {
+            ffmpegUtil::Logger::instance().setLevel(ffmpegUtil::Logger::parseLevel(argv[++i]));
+        }
+        else if (arg == "-affinity" && i + 1 < argc)
+        {
+            opts.affinity = argv[++i];
+        }
+        else if (arg == "-rt-audio")
+        {
+            opts.realtimeAudio = true;
+        }
+        else if (arg == "-overlay")
+        {
+            opts.overlay = true;
+        }
+        else if (arg == "-export-shm" && i + 1 < argc)
+        {
+            // frames for other processes, read them with player_shm_reader.
+            string spec = argv[++i];
+            size_t colon = spec.find(':');
+            opts.exportShm = spec.substr(0, colon);
+            if (colon != string::npos)
+            {
+                opts.exportSlots = std::max(2, std::stoi(spec.substr(colon + 1)));
+            }
+        }
+        else if (arg == "-vf" && i + 1 < argc)
+        {
+            opts.videoFilter = argv[++i];
+        }
+        else if (arg == "-filter-threads" && i + 1 < argc)
+        {
+            opts.filterThreads = std::stoi(argv[++i]);
+        }
+        else if (arg == "-tensor" && i + 1 < argc)
+        {
+            opts.tensorPath = argv[++i];
+        }
+        else if (arg == "-tensor-size" && i + 1 < argc)
+        {
+            string size = argv[++i];
+            opts.tensorWidth = std::stoi(size.substr(0, size.find('x')));
+            opts.tensorHeight = std::stoi(size.substr(size.find('x') + 1));
+        }
+        else if (arg == "-tensor-format" && i + 1 < argc)
+        {
+            opts.tensorU8 = string(argv[++i]) == "u8";
+        }
+        else if (arg == "-tensor-every" && i + 1 < argc)
+        {
+            opts.tensorEvery = std::max(1, std::stoi(argv[++i]));
+        }
+        else if (arg == "-tensor-at" && i + 1 < argc)
+        {
+            for (double sec : parseList(argv[++i]))
+            {
+                opts.tensorAtMs.push_back((int64_t)(sec * 1000));
+            }
+            std::sort(opts.tensorAtMs.begin(), opts.tensorAtMs.end());
+        }
+        else if (arg == "-tensor-batch" && i + 1 < argc)
+        {
+            opts.tensorBatch = std::max(1, std::stoi(argv[++i]));
+        }
+        else if (arg == "-tensor-mean" && i + 1 < argc)
+        {
+            parseTriple(argv[++i], opts.tensorMean);
+        }
+        else if (arg == "-tensor-std" && i + 1 < argc)
+        {
+            parseTriple(argv[++i], opts.tensorStd);
+        }
+        else if (arg == "-scenes")
+        {
+            opts.sceneDetect = true;
+        }
+        else if (arg == "-scene-threshold" && i + 1 < argc)
+        {
+            opts.sceneDetect = true;
+            opts.sceneThreshold = std::stod(argv[++i]);
+        }
+        else if (arg == "-scene-out" && i + 1 < argc)
+        {
+            opts.sceneDetect = true;
+            opts.sceneOut = argv[++i];
+        }
+        else if (arg == "-parallel" && i + 1 < argc)
+        {
+            opts.parallel = std::max(1, std::stoi(argv[++i]));
+        }
+        else if (arg == "-parallel-mb" && i + 1 < argc)
+        {
+            opts.parallelMb = std::max(1, std::stoi(argv[++i]));
+        }
+        else if (arg == "-parallel-scaling")
+        {
+            opts.parallelScaling = true;
+        }
+        else if (arg == "-frame-hash")
+        {
+            opts.frameHash = true;
+        }
+        else if (arg == "-clip" && i + 1 < argc)
+        {
+            opts.clipPath = argv[++i];
+        }
+        else if (arg == "-clip-start" && i + 1 < argc)
+        {
+            opts.clipStartMs = (int64_t)(std::stod(argv[++i]) * 1000);
+        }
+        else if (arg == "-clip-end" && i + 1 < argc)
+        {
+            opts.clipEndMs = (int64_t)(std::stod(argv[++i]) * 1000);
+        }
+        else if (arg == "-clip-reencode")
+        {
+            opts.clipReencode = true;
+        }
+        else if (arg == "-mosaic")
+        {
+            opts.mosaic = true;
+        }
+        else if (arg == "-mosaic-size" && i + 1 < argc)
+        {
+            string size = argv[++i];
+            opts.mosaicWidth = std::stoi(size.substr(0, size.find('x')));
+            opts.mosaicHeight = std::stoi(size.substr(size.find('x') + 1));
+        }
+        else
+        {
+            inputFile = arg;
+            inputs.push_back(arg);
+        }
+    }
+    if (opts.mosaic)
+    {
+        playMosaicInputs(inputs, opts);
+        return 0;
+    }
+    if (!opts.clipPath.empty())
+    {
+        extractClip(inputFile, opts);
+        return 0;
+    }
+    if (opts.parallel > 0 || opts.parallelScaling)
+    {
+        decodeSegmentsParallel(inputFile, opts);
+        return 0;
+    }
+    if (!opts.tensorPath.empty())
+    {
+        exportTensorFrames(inputFile, opts);
+        return 0;
+    }
+    playVideoWithAudio(inputFile, opts);
     return 0;
-}
\ No newline at end of file
+}
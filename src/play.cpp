@@ -1,90 +1,341 @@
+#include "clipExtractor.h"
 #include "ffmpegUtil.h"
+#include "frameCache.h"
 #include "mediaProcessor.hpp"
+#include "playOptions.h"
+#include "playbackStats.h"
+#include "playerClock.h"
+#include "sdlSink.h"
+#include "segmentDecoder.h"
+#include "tensorSink.h"
+#include "threadPolicy.h"
+#include "traceRecorder.h"
 
+#include <cmath>
+#include <cstdio>
+#include <ctime>
 #include <iostream>
 #include <string>
 #include <list>
 #include <memory>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <future>
+#include <vector>
 
-extern "C"
-{
-#include "SDL2/SDL.h"
-};
-
-extern void startSdlAudio(SDL_AudioDeviceID &audioDeviceID, AudioProcessor &aProcessor);
-extern void playSdlVideo(VideoProcessor &vProcessor, AudioProcessor *audio = nullptr);
+extern bool openSdlAudio(SdlAudioSink &sink, AudioProcessor &aProcessor, const std::atomic<bool> *stop);
+extern void startSdlAudio(std::atomic<bool> &stop, SdlAudioSink &sink, AudioProcessor &aProcessor);
+extern void runVirtualAudio(std::atomic<bool> &stop, AudioProcessor &aProcessor);
+extern void playSdlVideo(VideoProcessor &vProcessor, AudioProcessor *audio, VideoSink &sink,
+                         ffmpegUtil::FrameCache *cache, const PlayOptions &opts);
+extern void requestSdlRefresh();
+extern void playSdlMosaic(const std::vector<VideoProcessor *> &processors, const std::vector<SDL_Rect> &rects,
+                          int width, int height);
 
 namespace
 {
 
 using namespace ffmpegUtil;
 
-using std::cout;
-using std::endl;
 
 void pktReader(PacketGrabber &pGrabber, AudioProcessor *aProcessor,
                VideoProcessor *vProcessor)
 {
     const int CHECK_PERIOD = 10;
 
-    cout << "INFO: pkt Reader thread started." << endl;
-    int audioIndex = aProcessor->getAudioIndex();
-    int videoIndex = vProcessor->getVideoIndex();
+    logInfo("pkt Reader thread started.");
+    ThreadPolicy::instance().apply(ThreadPolicy::READER, "packet reader");
+    int audioIndex = aProcessor != nullptr ? aProcessor->getAudioIndex() : -1;
+    int videoIndex = vProcessor != nullptr ? vProcessor->getVideoIndex() : -1;
+
+    auto isClosed = [&]() {
+        return (aProcessor != nullptr && aProcessor->isClosed()) ||
+               (vProcessor != nullptr && vProcessor->isClosed());
+    };
+    auto needPacket = [&]() {
+        return (aProcessor != nullptr && aProcessor->needPacket()) ||
+               (vProcessor != nullptr && vProcessor->needPacket());
+    };
 
-    while (!pGrabber.isFileEnd() && !aProcessor->isClosed() && !vProcessor->isClosed())
+    while (!pGrabber.isFileEnd() && !isClosed())
     {
-        while (aProcessor->needPacket() || vProcessor->needPacket())
+        while (needPacket())
         {
-            AVPacket *packet = (AVPacket *)av_malloc(sizeof(AVPacket));
-            int t = pGrabber.grabPacket(packet);
+            PacketPtr packet{av_packet_alloc()};
+            int t;
+            {
+                TraceScope trace("packet read");
+                t = pGrabber.grabPacket(packet.get());
+            }
             if (t == -1)
             {
-                cout << "INFO: file finish." << endl;
-                aProcessor->pushPkt(nullptr);
-                vProcessor->pushPkt(nullptr);
+                logInfo("file finish.");
+                if (aProcessor != nullptr)
+                {
+                    aProcessor->pushPkt(nullptr);
+                }
+                if (vProcessor != nullptr)
+                {
+                    vProcessor->pushPkt(nullptr);
+                }
                 break;
             }
             else if (t == audioIndex && aProcessor != nullptr)
             {
-                unique_ptr<AVPacket> uPacket(packet);
-                aProcessor->pushPkt(std::move(uPacket));
+                aProcessor->pushPkt(std::move(packet));
             }
             else if (t == videoIndex && vProcessor != nullptr)
             {
-                unique_ptr<AVPacket> uPacket(packet);
-                vProcessor->pushPkt(std::move(uPacket));
+                vProcessor->pushPkt(std::move(packet));
             }
             else
             {
-                av_packet_free(&packet);
-                cout << "WARNING: unknown streamIndex: [" << t << "]" << endl;
+                logWarn("unknown streamIndex: [%d]", t);
+            }
+        }
+        PlayerClock::get().sleepForMs(CHECK_PERIOD);
+    }
+    logInfo("[THREAD] pkt Reader thread finished.");
+}
+
+// "kind" or "kind:path"
+void splitSinkSpec(const string &spec, string &kind, string &path)
+{
+    auto colon = spec.find(':');
+    kind = spec.substr(0, colon);
+    path = colon == string::npos ? "-" : spec.substr(colon + 1);
+}
+
+bool writesStdout(const string &sinkSpec)
+{
+    string kind, path;
+    splitSinkSpec(sinkSpec, kind, path);
+    return (kind == "y4m" || kind == "wav") && path == "-";
+}
+
+// stdout carries at most one stream: two writers would interleave into one unreadable pipe.
+void checkStdoutUsers(bool video, bool audio, const PlayOptions &opts)
+{
+    int users = (video && writesStdout(opts.videoSink)) + (audio && writesStdout(opts.audioSink)) +
+                (opts.sceneDetect && opts.sceneOut == "-");
+    if (users > 1)
+    {
+        string errMsg = "Only one of -vsink, -asink and -scene-out can write to stdout, give the others a path.";
+        logError("%s", errMsg.c_str());
+        throw std::runtime_error(errMsg);
+    }
+}
+
+unique_ptr<VideoSink> makeVideoSink(const string &spec)
+{
+    string kind, path;
+    splitSinkSpec(spec, kind, path);
+    if (kind == "sdl")
+    {
+        return unique_ptr<VideoSink>{new SdlVideoSink()};
+    }
+    else if (kind == "null")
+    {
+        return unique_ptr<VideoSink>{new NullVideoSink()};
+    }
+    else if (kind == "y4m")
+    {
+        return unique_ptr<VideoSink>{new Y4mVideoSink(path)};
+    }
+    string errMsg = "Unknown video sink: ";
+    errMsg += spec;
+    logError("%s", errMsg.c_str());
+    throw std::runtime_error(errMsg);
+}
+
+// the SDL audio sink is created by the caller, it needs the AudioProcessor.
+unique_ptr<AudioSink> makeAudioSink(const string &spec)
+{
+    string kind, path;
+    splitSinkSpec(spec, kind, path);
+    if (kind == "null")
+    {
+        return unique_ptr<AudioSink>{new NullAudioSink()};
+    }
+    else if (kind == "wav")
+    {
+        return unique_ptr<AudioSink>{new WavAudioSink(path)};
+    }
+    string errMsg = "Unknown audio sink: ";
+    errMsg += spec;
+    logError("%s", errMsg.c_str());
+    throw std::runtime_error(errMsg);
+}
+
+// Feeds a non-realtime sink as fast as the processor produces data, until the stream is
+// finished or stop is set. onFed runs after every write (stats).
+template <typename Processor, typename Sink>
+void drainToSink(Processor &processor, Sink &sink, const std::atomic<bool> &stop, const char *threadName,
+                 const std::function<void()> &onFed)
+{
+    ThreadPolicy::instance().apply(ThreadPolicy::SINK, threadName);
+    while (!stop.load())
+    {
+        if (processor.waitDataReady(50))
+        {
+            if (processor.feed(sink))
+            {
+                onFed();
             }
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(CHECK_PERIOD));
+        else if (processor.isStreamFinished())
+        {
+            break;
+        }
     }
-    cout << "[THREAD] INFO: pkt Reader thread finished." << endl;
+    logInfo("[THREAD] %s thread finished.", threadName);
 }
 
-int play(const string &inputFile)
+// audio-only playback, there is no window, just keep the events flowing until the
+// audio stream is drained or we are asked to quit.
+void waitSdlAudio(AudioProcessor &aProcessor)
 {
+    SDL_Event event;
+    while (!aProcessor.isStreamFinished())
+    {
+        if (SDL_WaitEventTimeout(&event, 100) && event.type == SDL_QUIT)
+        {
+            logInfo("SDL got a SDL_QUIT.");
+            return;
+        }
+    }
+    // the last callback has taken the tail, let the device play it before it is closed.
+    int64_t bufferUs = PlaybackStats::instance().audioDeviceBufferUs.load(std::memory_order_relaxed);
+    std::this_thread::sleep_for(std::chrono::microseconds(bufferUs));
+}
+
+int play(const string &inputFile, const PlayOptions &opts)
+{
+    if (!opts.tracePath.empty())
+    {
+        TraceRecorder::instance().setEnabled(true);
+    }
+    auto &threadPolicy = ThreadPolicy::instance();
+    threadPolicy.configure(opts.affinity);
+    threadPolicy.setRealtimeAudio(opts.realtimeAudio);
+    threadPolicy.apply(ThreadPolicy::RENDER, "render");
+
+    FramePool::instance().setEnabled(opts.framePool);
+    FramePool::instance().setHugePages(opts.hugePages);
+
+    auto &clock = PlayerClock::get();
+    auto &stats = PlaybackStats::instance();
+    stats.openStartUs = clock.nowUs();
+    stats.firstVideoUs = -1;
+    stats.firstAudioUs = -1;
+
     // create packet grabber
-    PacketGrabber packetGrabber{inputFile};
+    PacketGrabber packetGrabber{inputFile, opts.lowLatency};
     auto formatCtx = packetGrabber.getFormatCtx();
     av_dump_format(formatCtx, 0, "", 0); //print
+    int64_t probeUs = clock.nowUs() - stats.openStartUs;
+
+    // select the tracks, all the other streams are discarded by the demuxer
+    int videoIndex = -1;
+    if (!opts.disableVideo)
+    {
+        videoIndex = opts.videoStream >= 0 ? opts.videoStream : packetGrabber.getVideoIndex();
+    }
+    int audioIndex = -1;
+    if (!opts.disableAudio)
+    {
+        audioIndex = opts.audioStream >= 0 ? opts.audioStream : packetGrabber.getAudioIndex();
+    }
+
+    // the frame cache reopens the input, and stepping needs a window.
+    bool review = opts.review && videoIndex >= 0 && opts.videoSink == "sdl";
+    if (opts.review && (!review || opts.lowLatency))
+    {
+        logWarn("review mode needs a file input with video on the sdl sink, ignored.");
+        review = false;
+    }
+    if (review && audioIndex >= 0)
+    {
+        logInfo("review mode: audio disabled.");
+        audioIndex = -1;
+    }
+    if (videoIndex < 0 && audioIndex < 0)
+    {
+        string errMsg = "No video or audio stream selected in:";
+        errMsg += inputFile;
+        logError("%s", errMsg.c_str());
+        throw std::runtime_error(errMsg);
+    }
+    packetGrabber.selectStreams(videoIndex, audioIndex);
 
-    // create VideoProcessor
-    VideoProcessor videoProcessor(formatCtx);
-    videoProcessor.start();
+    // with a virtual clock the audio callback is paced by the clock, not by a device.
+    bool realtimeAudio = PlayerClock::get().isRealtime();
+    bool sdlVideo = videoIndex >= 0 && opts.videoSink == "sdl";
+    bool sdlAudio = audioIndex >= 0 && opts.audioSink == "sdl";
 
-    // create AudioProcessor
-    AudioProcessor audioProcessor(formatCtx);
-    audioProcessor.start();
+    // created here, so a bad sink spec fails before anything is opened.
+    checkStdoutUsers(videoIndex >= 0, audioIndex >= 0, opts);
+    unique_ptr<VideoSink> videoSink{};
+    if (videoIndex >= 0)
+    {
+        videoSink = makeVideoSink(opts.videoSink);
+    }
+    unique_ptr<AudioSink> audioSink{};
+    if (audioIndex >= 0 && !sdlAudio)
+    {
+        audioSink = makeAudioSink(opts.audioSink);
+    }
+    SdlAudioSink *sdlAudioSink = nullptr;
 
-    // start pkt reader
-    std::thread readerThread{pktReader, std::ref(packetGrabber), &audioProcessor,
-                             &videoProcessor};
+    // Everything below only needs the stream parameters, so it runs at the same time:
+    // video codec open | audio codec open + audio device open | SDL init + window.
+    std::promise<void> sdlReady{};
+    std::shared_future<void> sdlReadyFuture = sdlReady.get_future().share();
+    int64_t videoCodecUs = 0;
+    int64_t audioCodecUs = 0;
+
+    std::future<unique_ptr<VideoProcessor>> videoTask{};
+    if (videoIndex >= 0)
+    {
+        videoTask = std::async(std::launch::async, [&]() {
+            int64_t t = clock.nowUs();
+            unique_ptr<VideoProcessor> v{new VideoProcessor(formatCtx, videoIndex, opts.lowLatency)};
+            if (!opts.videoFilter.empty())
+            {
+                v->setFilter(opts.videoFilter, opts.filterThreads);
+            }
+            videoCodecUs = clock.nowUs() - t;
+            return v;
+        });
+    }
+
+    std::future<unique_ptr<AudioProcessor>> audioTask{};
+    if (audioIndex >= 0)
+    {
+        audioTask = std::async(std::launch::async, [&]() {
+            int64_t t = clock.nowUs();
+            unique_ptr<AudioProcessor> a{new AudioProcessor(formatCtx, audioIndex, opts.lowLatency)};
+            audioCodecUs = clock.nowUs() - t;
+            if (sdlAudio)
+            {
+                sdlAudioSink = new SdlAudioSink(*a);
+                audioSink.reset(sdlAudioSink);
+                if (realtimeAudio && a->getCodecFrameSize() > 0)
+                {
+                    sdlReadyFuture.get();
+                    openSdlAudio(*sdlAudioSink, *a, nullptr);
+                }
+            }
+            else
+            {
+                audioSink->open(a->getOutAudioInfo(), a->getCodecFrameSize());
+            }
+            return a;
+        });
+    }
 
     //尝试解决缓冲区下溢问题
     if (!(SDL_getenv("SDL_AUDIO_ALSA_SET_BUFFER_SIZE")))
@@ -92,45 +343,711 @@ int play(const string &inputFile)
         SDL_setenv("SDL_AUDIO_ALSA_SET_BUFFER_SIZE", "1", 1);
     }
 
-    //初始化SDL系统
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER))
+    //初始化SDL系统, 只初始化用到的子系统
+    int64_t sdlStartUs = clock.nowUs();
+    Uint32 sdlFlags = SDL_INIT_TIMER | SDL_INIT_EVENTS;
+    if (sdlVideo)
+    {
+        sdlFlags |= SDL_INIT_VIDEO;
+    }
+    if (sdlAudio && realtimeAudio)
+    {
+        sdlFlags |= SDL_INIT_AUDIO;
+    }
+    std::exception_ptr startupError{};
+    if (!sdlVideo && !sdlAudio)
+    {
+        // file / null sinks only, no SDL at all.
+        sdlReady.set_value();
+    }
+    else if (SDL_Init(sdlFlags))
     {
         //初始化失败
         string errMsg = "Could not initialize SDL - ";
         errMsg += SDL_GetError();
-        cout << errMsg << endl;
-        throw std::runtime_error(errMsg);
+        logError("%s", errMsg.c_str());
+        startupError = std::make_exception_ptr(std::runtime_error(errMsg));
+        sdlReady.set_exception(startupError);
+    }
+    else
+    {
+        sdlReady.set_value();
+    }
+    int64_t sdlInitUs = clock.nowUs() - sdlStartUs;
+
+    // window, renderer and texture have to be created on the main thread.
+    int64_t windowStartUs = clock.nowUs();
+    if (!startupError && videoSink != nullptr)
+    {
+        try
+        {
+            auto stream = formatCtx->streams[videoIndex];
+            videoSink->open(stream->codecpar->width, stream->codecpar->height, stream->avg_frame_rate);
+        }
+        catch (...)
+        {
+            startupError = std::current_exception();
+        }
+    }
+    int64_t windowUs = clock.nowUs() - windowStartUs;
+
+    unique_ptr<VideoProcessor> videoProcessor{};
+    unique_ptr<AudioProcessor> audioProcessor{};
+    try
+    {
+        if (videoTask.valid())
+        {
+            videoProcessor = videoTask.get();
+        }
+    }
+    catch (...)
+    {
+        startupError = std::current_exception();
+    }
+    try
+    {
+        if (audioTask.valid())
+        {
+            audioProcessor = audioTask.get();
+        }
+    }
+    catch (...)
+    {
+        startupError = std::current_exception();
+    }
+    if (startupError)
+    {
+        // the SDL device still references the AudioProcessor.
+        if (audioSink != nullptr)
+        {
+            audioSink->close();
+        }
+        if (videoSink != nullptr)
+        {
+            videoSink->close();
+        }
+        std::rethrow_exception(startupError);
+    }
+
+    logInfo("startup: probe = %lldms, video codec = %lldms, audio codec = %lldms, sdl init = %lldms, window = %lldms "
+            "(codecs / sdl / window in parallel)",
+            (long long)probeUs / 1000, (long long)videoCodecUs / 1000, (long long)audioCodecUs / 1000,
+            (long long)sdlInitUs / 1000, (long long)windowUs / 1000);
+
+    bool realtimeVideo = videoSink != nullptr && videoSink->isRealtime();
+    if (videoProcessor != nullptr && realtimeVideo)
+    {
+        // the first frame (every frame in low latency mode) is presented as soon as it is decoded.
+        // Low latency has no refresh timer: the callback at the end of the stream wakes the loop.
+        bool lowLatency = opts.lowLatency;
+        std::shared_ptr<std::atomic<bool>> firstFrame{new std::atomic<bool>(true)};
+        videoProcessor->setDataReadyCallback([lowLatency, firstFrame]() {
+            if (lowLatency || firstFrame->exchange(false))
+            {
+                requestSdlRefresh();
+            }
+        });
+    }
+    if (videoProcessor != nullptr && realtimeVideo && opts.exportShm.empty())
+    {
+        // the window takes frames of any size, the export slots and the file sinks keep the first one.
+        videoProcessor->setFollowSource(true);
+    }
+    unique_ptr<ShmFrameWriter> frameExport{};
+    if (videoProcessor != nullptr && !opts.exportShm.empty())
+    {
+        frameExport.reset(new ShmFrameWriter(opts.exportShm, opts.exportSlots, videoProcessor->getWidth(),
+                                             videoProcessor->getHeight()));
+        videoProcessor->setFrameExport(frameExport.get());
     }
+    unique_ptr<SceneDetector> sceneDetector{};
+    if (videoProcessor != nullptr && opts.sceneDetect)
+    {
+        sceneDetector.reset(new SceneDetector(opts.sceneThreshold, opts.sceneOut));
+        videoProcessor->setSceneDetector(sceneDetector.get());
+    }
+    if (videoProcessor != nullptr)
+    {
+        if (opts.lowLatency)
+        {
+            videoProcessor->setPacketWaitingSize(1);
+        }
+        videoProcessor->start();
+    }
+
+    if (audioProcessor != nullptr)
+    {
+        audioProcessor->setVolume(opts.volume / 100.0f);
+        if (opts.lowLatency)
+        {
+            audioProcessor->setPacketWaitingSize(1);
+        }
+        audioProcessor->start();
+    }
+
+    unique_ptr<FrameCache> frameCache{};
+    if (review)
+    {
+        frameCache.reset(new FrameCache(inputFile, videoIndex, (size_t)opts.cacheMb * 1024 * 1024));
+    }
+
+    // start pkt reader
+    std::thread readerThread{pktReader, std::ref(packetGrabber), audioProcessor.get(),
+                             videoProcessor.get()};
 
-    SDL_AudioDeviceID audioDeviceID;
+    std::atomic<bool> stopAudioThread{false};
+    std::thread startAudioThread{};
+    if (sdlAudioSink != nullptr && realtimeAudio)
+    {
+        // opens the device when there is no fixed frame size, unpauses it on the first data.
+        startAudioThread = std::thread(startSdlAudio, std::ref(stopAudioThread), std::ref(*sdlAudioSink),
+                                       std::ref(*audioProcessor));
+    }
+    else if (sdlAudioSink != nullptr && !realtimeAudio)
+    {
+        startAudioThread = std::thread(runVirtualAudio, std::ref(stopAudioThread),
+                                       std::ref(*audioProcessor));
+    }
 
-    std::thread startAudioThread(startSdlAudio, std::ref(audioDeviceID),
-                                 std::ref(audioProcessor));
+    // non-realtime sinks are not paced, they take the data as soon as it is decoded.
+    std::atomic<bool> stopSinks{false};
+    std::thread videoSinkThread{};
+    if (videoProcessor != nullptr && !realtimeVideo)
+    {
+        VideoProcessor &v = *videoProcessor;
+        videoSinkThread = std::thread([&]() {
+            drainToSink(v, *videoSink, stopSinks, "video sink", [&]() {
+                int64_t unset = -1;
+                stats.firstVideoUs.compare_exchange_strong(unset, clock.nowUs());
+                stats.framesPresented.fetch_add(1, std::memory_order_relaxed);
+                stats.videoPtsMs.store(v.getPts(), std::memory_order_relaxed);
+            });
+        });
+    }
+    std::thread audioSinkThread{};
+    if (audioProcessor != nullptr && sdlAudioSink == nullptr)
+    {
+        AudioProcessor &a = *audioProcessor;
+        audioSinkThread = std::thread([&]() {
+            drainToSink(a, *audioSink, stopSinks, "audio sink", [&]() {
+                int64_t unset = -1;
+                stats.firstAudioUs.compare_exchange_strong(unset, clock.nowUs());
+                stats.audioPtsMs.store(a.getPts(), std::memory_order_relaxed);
+            });
+        });
+    }
 
-    playSdlVideo(videoProcessor, &audioProcessor);
+    if (videoProcessor != nullptr && realtimeVideo)
+    {
+        // A/V sync only makes sense against an audio device.
+        playSdlVideo(*videoProcessor, sdlAudioSink != nullptr ? audioProcessor.get() : nullptr, *videoSink,
+                     frameCache.get(), opts);
+        stopSinks = !videoProcessor->isStreamFinished(); // closed by the user
+    }
+    else if (sdlAudioSink != nullptr)
+    {
+        waitSdlAudio(*audioProcessor);
+        stopSinks = !audioProcessor->isStreamFinished();
+    }
+    if (videoSinkThread.joinable())
+    {
+        videoSinkThread.join();
+    }
+    if (audioSinkThread.joinable())
+    {
+        audioSinkThread.join();
+    }
 
-    SDL_PauseAudioDevice(audioDeviceID, 1);
-    SDL_CloseAudio();
+    if (startAudioThread.joinable())
+    {
+        stopAudioThread = true;
+        startAudioThread.join();
+    }
+    if (audioSink != nullptr)
+    {
+        audioSink->close();
+    }
 
     bool r;
-    r = audioProcessor.close();
-    cout << "audioProcessor closed: " << r << endl;
-    r = videoProcessor.close();
-    cout << "videoProcessor closed: " << r << endl;
+    if (audioProcessor != nullptr)
+    {
+        r = audioProcessor->close();
+        logInfo("audioProcessor closed: %d", r);
+    }
+    if (videoProcessor != nullptr)
+    {
+        r = videoProcessor->close();
+        logInfo("videoProcessor closed: %d", r);
+        if (!r && frameExport != nullptr)
+        {
+            // the decoder thread may still publish, keep the ring mapped.
+            frameExport.release();
+        }
+        if (!r && sceneDetector != nullptr)
+        {
+            sceneDetector.release(); // same for the frames it still submits
+        }
+    }
+    frameExport.reset();
+    sceneDetector.reset(); // analyzes what is queued, reports the cuts
 
     std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
     readerThread.join();
-    startAudioThread.join();
-    cout << "Pause and Close audio" << endl;
+    if (videoSink != nullptr)
+    {
+        videoSink->close();
+    }
+
+    auto sinceOpenMs = [&](int64_t us) { return us < 0 ? -1 : (us - stats.openStartUs) / 1000; };
+    logInfo("time to first frame = %lldms, time to first audio = %lldms (-1: never)",
+            (long long)sinceOpenMs(stats.firstVideoUs), (long long)sinceOpenMs(stats.firstAudioUs));
+
+    if (stats.formatSwitches.load() > 0)
+    {
+        uint64_t switches = stats.formatSwitches.load();
+        uint64_t textures = stats.textureRecreates.load();
+        logInfo("source format switches = %llu (%llu cached), %gms per switch, texture re-created = %llu, %gms each",
+                (unsigned long long)switches, (unsigned long long)stats.formatSwitchesCached.load(),
+                stats.formatSwitchUs.load() / 1000.0 / switches, (unsigned long long)textures,
+                textures > 0 ? stats.textureRecreateUs.load() / 1000.0 / textures : 0.0);
+    }
+
+    auto pool = FramePool::instance().getStats();
+    logInfo("frame pool: requests = %llu, allocations = %llu, pools = %d, memory = %lluMB (huge pages %lluMB)",
+            (unsigned long long)pool.requests, (unsigned long long)pool.allocations, pool.pools,
+            (unsigned long long)pool.bytes / (1024 * 1024), (unsigned long long)pool.hugePageBytes / (1024 * 1024));
+
+    if (!opts.tracePath.empty())
+    {
+        TraceRecorder::instance().setEnabled(false);
+        TraceRecorder::instance().writeChromeTrace(opts.tracePath);
+    }
+
+    return 0;
+}
+
+// -mosaic: every input gets its own demuxer, reader thread and decoder thread (so N inputs use
+// up to N cores), its decoder scales straight to the tile size. Video only, no A/V sync: each
+// tile runs on its own clock in playSdlMosaic.
+int playMosaic(const std::vector<string> &inputs, const PlayOptions &opts)
+{
+    if (!opts.tracePath.empty())
+    {
+        TraceRecorder::instance().setEnabled(true);
+    }
+    auto &threadPolicy = ThreadPolicy::instance();
+    threadPolicy.configure(opts.affinity);
+    threadPolicy.apply(ThreadPolicy::RENDER, "render");
+    FramePool::instance().setEnabled(opts.framePool);
+    FramePool::instance().setHugePages(opts.hugePages);
+
+    int count = (int)inputs.size();
+    if (count == 0)
+    {
+        string errMsg = "mosaic: no input.";
+        logError("%s", errMsg.c_str());
+        throw std::runtime_error(errMsg);
+    }
+    int cols = (int)std::ceil(std::sqrt((double)count));
+    int rows = (count + cols - 1) / cols;
+    // IYUV texture updates need even rectangles.
+    int tileW = opts.mosaicWidth / cols & ~1;
+    int tileH = opts.mosaicHeight / rows & ~1;
+    logInfo("mosaic: %d inputs, %dx%d tiles of %dx%d", count, cols, rows, tileW, tileH);
+
+    // inputs are opened in parallel, a slow camera does not hold up the others.
+    struct Input
+    {
+        unique_ptr<PacketGrabber> grabber;
+        unique_ptr<VideoProcessor> processor;
+    };
+    std::vector<std::future<Input>> opening{};
+    for (auto &url : inputs)
+    {
+        opening.push_back(std::async(std::launch::async, [&url, &opts]() {
+            Input in{};
+            in.grabber.reset(new PacketGrabber(url, opts.lowLatency));
+            int videoIndex = in.grabber->getVideoIndex();
+            if (videoIndex < 0)
+            {
+                string errMsg = "No video stream in:";
+                errMsg += url;
+                logError("%s", errMsg.c_str());
+                throw std::runtime_error(errMsg);
+            }
+            in.grabber->selectStreams(videoIndex, -1);
+            in.processor.reset(new VideoProcessor(in.grabber->getFormatCtx(), videoIndex, opts.lowLatency));
+            if (!opts.videoFilter.empty())
+            {
+                in.processor->setFilter(opts.videoFilter, opts.filterThreads);
+            }
+            return in;
+        }));
+    }
+    std::vector<Input> opened{};
+    for (auto &f : opening)
+    {
+        opened.push_back(f.get());
+    }
+
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_EVENTS))
+    {
+        string errMsg = "Could not initialize SDL - ";
+        errMsg += SDL_GetError();
+        logError("%s", errMsg.c_str());
+        throw std::runtime_error(errMsg);
+    }
+
+    std::vector<VideoProcessor *> processors{};
+    std::vector<SDL_Rect> rects{};
+    std::vector<std::thread> readers{};
+    for (int i = 0; i < count; i++)
+    {
+        VideoProcessor *p = opened[i].processor.get();
+        p->setOutputSize(tileW, tileH);
+        p->start();
+        processors.push_back(p);
+        rects.push_back(SDL_Rect{i % cols * tileW, i / cols * tileH, tileW, tileH});
+        readers.emplace_back(pktReader, std::ref(*opened[i].grabber), nullptr, p);
+    }
+
+    playSdlMosaic(processors, rects, tileW * cols, tileH * rows);
+
+    for (auto &in : opened)
+    {
+        if (!in.processor->close())
+        {
+            // its decoder thread still runs on it: leaked, not freed under the thread.
+            logWarn("mosaic: a video decoder did not stop, its processor is not freed");
+            in.processor.release();
+        }
+    }
+    for (auto &t : readers)
+    {
+        t.join();
+    }
+
+    if (!opts.tracePath.empty())
+    {
+        TraceRecorder::instance().setEnabled(false);
+        TraceRecorder::instance().writeChromeTrace(opts.tracePath);
+    }
+    return 0;
+}
+
+// -tensor: headless sampling for inference. The decoder scales to the tensor size and drops the
+// frames not sampled before any conversion; the sink converts the rest straight into the mapped
+// .npy file. Unthrottled, no SDL. Reports frames per second per core (process CPU time).
+int exportTensors(const string &inputFile, const PlayOptions &opts)
+{
+    if (!opts.tracePath.empty())
+    {
+        TraceRecorder::instance().setEnabled(true);
+    }
+    ThreadPolicy::instance().configure(opts.affinity);
+    FramePool::instance().setEnabled(opts.framePool);
+    FramePool::instance().setHugePages(opts.hugePages);
+
+    // on the heap: left behind if the decoder thread does not stop, see below.
+    unique_ptr<PacketGrabber> grabber{new PacketGrabber(inputFile)};
+    int videoIndex = opts.videoStream >= 0 ? opts.videoStream : grabber->getVideoIndex();
+    if (videoIndex < 0)
+    {
+        string errMsg = "No video stream in:";
+        errMsg += inputFile;
+        logError("%s", errMsg.c_str());
+        throw std::runtime_error(errMsg);
+    }
+    grabber->selectStreams(videoIndex, -1);
+    unique_ptr<VideoProcessor> video{new VideoProcessor(grabber->getFormatCtx(), videoIndex)};
+    if (!opts.videoFilter.empty())
+    {
+        video->setFilter(opts.videoFilter, opts.filterThreads);
+    }
+    video->setOutputSize(opts.tensorWidth, opts.tensorHeight);
+
+    // -tensor-at: the first frame at or after each time, then stop. Otherwise every Nth frame.
+    // The selector runs before the conversion: done once the sink wrote every accepted frame.
+    std::vector<int64_t> atMs = opts.tensorAtMs;
+    std::shared_ptr<std::atomic<bool>> allTaken{new std::atomic<bool>(false)};
+    std::shared_ptr<std::atomic<uint64_t>> accepted{new std::atomic<uint64_t>(0)};
+    if (!atMs.empty())
+    {
+        std::shared_ptr<size_t> next{new size_t(0)};
+        video->setFrameSelector([atMs, next, allTaken, accepted](int64_t ptsMs) {
+            if (*next >= atMs.size() || ptsMs < atMs[*next])
+            {
+                return false;
+            }
+            while (*next < atMs.size() && atMs[*next] <= ptsMs)
+            {
+                (*next)++;
+            }
+            accepted->fetch_add(1);
+            allTaken->store(*next >= atMs.size());
+            return true;
+        });
+    }
+    else if (opts.tensorEvery > 1)
+    {
+        int every = opts.tensorEvery;
+        std::shared_ptr<int64_t> decoded{new int64_t(0)};
+        video->setFrameSelector([every, decoded](int64_t) { return (*decoded)++ % every == 0; });
+    }
+
+    TensorConvert::Norm norm{};
+    for (int c = 0; c < 3; c++)
+    {
+        norm.mean[c] = opts.tensorMean[c];
+        norm.std[c] = opts.tensorStd[c];
+    }
+    TensorVideoSink sink{opts.tensorPath, opts.tensorU8 ? TensorConvert::NHWC_U8 : TensorConvert::PLANAR_F32, norm,
+                         opts.tensorBatch};
+    sink.open(opts.tensorWidth, opts.tensorHeight, grabber->getFormatCtx()->streams[videoIndex]->avg_frame_rate);
+
+    auto &stats = PlaybackStats::instance();
+    stats.reset();
+    auto &clock = PlayerClock::get();
+    int64_t startUs = clock.nowUs();
+    std::clock_t startCpu = std::clock();
 
+    // -scenes: all decoded frames, also the ones not sampled.
+    unique_ptr<SceneDetector> sceneDetector{};
+    if (opts.sceneDetect)
+    {
+        sceneDetector.reset(new SceneDetector(opts.sceneThreshold, opts.sceneOut));
+        video->setSceneDetector(sceneDetector.get());
+    }
+
+    video->start();
+    std::thread reader{pktReader, std::ref(*grabber), nullptr, video.get()};
+    while (!allTaken->load() || sink.getFrames() < accepted->load())
+    {
+        if (video->waitDataReady(50))
+        {
+            video->feed(sink);
+        }
+        else if (video->isStreamFinished())
+        {
+            break;
+        }
+    }
+    // headless, so wait for the decoder thread a while (close() waits about 100ms). If it does
+    // not stop it may still use the processor, the grabber (through the reader) and the scene
+    // detector: they are leaked, not freed under it, and the export fails.
+    const int closeAttempts = 50;
+    bool closed = video->close();
+    for (int i = 1; i < closeAttempts && !closed; i++)
+    {
+        logWarn("tensor export: waiting for the video decoder to stop");
+        closed = video->close();
+    }
+    if (!closed)
+    {
+        video.release();
+        grabber.release();
+        sceneDetector.release();
+        reader.detach();
+        string errMsg = "tensor export: the video decoder did not stop";
+        logError("%s", errMsg.c_str());
+        throw std::runtime_error(errMsg);
+    }
+    reader.join();
+    sink.close();
+    sceneDetector.reset();
+
+    double wallSec = (clock.nowUs() - startUs) / 1e6;
+    double cpuSec = (double)(std::clock() - startCpu) / CLOCKS_PER_SEC;
+    uint64_t decoded = stats.videoFramesDecoded.load();
+    uint64_t exported = sink.getFrames();
+    logInfo("tensor export: decoded = %llu, exported = %llu in %gs, cpu = %gs (%g cores)", (unsigned long long)decoded,
+            (unsigned long long)exported, wallSec, cpuSec, wallSec > 0 ? cpuSec / wallSec : 0);
+    logInfo("tensor export: %g fps, %g fps per core (decode %g fps per core)", wallSec > 0 ? exported / wallSec : 0,
+            cpuSec > 0 ? exported / cpuSec : 0, cpuSec > 0 ? decoded / cpuSec : 0);
+
+    if (!opts.tracePath.empty())
+    {
+        TraceRecorder::instance().setEnabled(false);
+        TraceRecorder::instance().writeChromeTrace(opts.tracePath);
+    }
+    return 0;
+}
+
+// -parallel N: the whole file decoded by N SegmentDecoder workers into a headless sink, in frame
+// order. -parallel-scaling runs it with 1, 2, 4 ... N workers into the null sink and compares the
+// output hash of every run with the single decoder's.
+int decodeParallel(const string &inputFile, const PlayOptions &opts)
+{
+    if (!opts.tracePath.empty())
+    {
+        TraceRecorder::instance().setEnabled(true);
+    }
+    ThreadPolicy::instance().configure(opts.affinity);
+    FramePool::instance().setEnabled(opts.framePool);
+    FramePool::instance().setHugePages(opts.hugePages);
+
+    int videoIndex = opts.videoStream;
+    if (videoIndex < 0)
+    {
+        PacketGrabber probe{inputFile};
+        videoIndex = probe.getVideoIndex();
+    }
+    if (videoIndex < 0)
+    {
+        string errMsg = "No video stream in:";
+        errMsg += inputFile;
+        logError("%s", errMsg.c_str());
+        throw std::runtime_error(errMsg);
+    }
+    auto keyframes = SegmentDecoder::scanKeyframes(inputFile, videoIndex);
+    int maxWorkers = opts.parallel > 0 ? opts.parallel : (int)std::max(1u, std::thread::hardware_concurrency());
+
+    if (!opts.parallelScaling)
+    {
+        unique_ptr<VideoSink> sink = makeVideoSink(opts.videoSink);
+        if (sink->isRealtime())
+        {
+            logWarn("-parallel is headless, %s replaced by the null sink", opts.videoSink.c_str());
+            sink.reset(new NullVideoSink());
+        }
+        SegmentDecoder decoder{inputFile, videoIndex, keyframes, maxWorkers, opts.parallelMb};
+        auto r = decoder.run(*sink, opts.frameHash);
+        logInfo("parallel decode: %llu frames (%llu decoded) in %gs, %g fps, cpu = %gs (%g cores)",
+                (unsigned long long)r.frames, (unsigned long long)r.decoded, r.wallSec,
+                r.wallSec > 0 ? r.frames / r.wallSec : 0, r.cpuSec, r.wallSec > 0 ? r.cpuSec / r.wallSec : 0);
+        if (opts.frameHash)
+        {
+            logInfo("parallel decode: frame hash %016llx", (unsigned long long)r.hash);
+        }
+    }
+    else
+    {
+        std::vector<int> counts{};
+        for (int n = 1; n < maxWorkers; n *= 2)
+        {
+            counts.push_back(n);
+        }
+        counts.push_back(maxWorkers);
+
+        SegmentDecoder::Result sequential{};
+        bool allEqual = true;
+        std::vector<string> rows{};
+        for (int n : counts)
+        {
+            NullVideoSink sink{};
+            SegmentDecoder decoder{inputFile, videoIndex, keyframes, n, opts.parallelMb};
+            auto r = decoder.run(sink, true);
+            if (n == 1)
+            {
+                sequential = r;
+            }
+            bool equal = r.hash == sequential.hash && r.frames == sequential.frames;
+            allEqual = allEqual && equal;
+            double fps = r.wallSec > 0 ? r.frames / r.wallSec : 0;
+            double sequentialFps = sequential.wallSec > 0 ? sequential.frames / sequential.wallSec : 0;
+            char row[160];
+            std::snprintf(row, sizeof(row), "%7d %8zu %9.1f %7.2fx %6.2f %9.1f%% %016llx %s", n, r.segments, fps,
+                          sequentialFps > 0 ? fps / sequentialFps : 0, r.wallSec > 0 ? r.cpuSec / r.wallSec : 0,
+                          r.frames > 0 ? 100.0 * (r.decoded - r.frames) / r.frames : 0,
+                          (unsigned long long)r.hash, equal ? "same" : "DIFFERENT");
+            rows.push_back(row);
+        }
+        logInfo("parallel decode scaling, %llu packets, keyframe scan %gs:", (unsigned long long)keyframes.packets,
+                keyframes.seconds);
+        logInfo("workers segments       fps speedup  cores  redecoded hash             output");
+        for (auto &row : rows)
+        {
+            logInfo("%s", row.c_str());
+        }
+        if (!allEqual)
+        {
+            logWarn("parallel decode output differs from the single decoder's");
+        }
+    }
+
+    if (!opts.tracePath.empty())
+    {
+        TraceRecorder::instance().setEnabled(false);
+        TraceRecorder::instance().writeChromeTrace(opts.tracePath);
+    }
+    return 0;
+}
+
+// -clip out.mkv: [-clip-start, -clip-end) of the selected streams into a new file by stream copy, see
+// ClipExtractor. Headless; nothing is decoded unless -clip-reencode asks for an exact start.
+int cutClip(const string &inputFile, const PlayOptions &opts)
+{
+    if (!opts.tracePath.empty())
+    {
+        TraceRecorder::instance().setEnabled(true);
+    }
+
+    PacketGrabber grabber{inputFile};
+    int videoIndex = -1;
+    if (!opts.disableVideo)
+    {
+        videoIndex = opts.videoStream >= 0 ? opts.videoStream : grabber.getVideoIndex();
+    }
+    int audioIndex = -1;
+    if (!opts.disableAudio)
+    {
+        audioIndex = opts.audioStream >= 0 ? opts.audioStream : grabber.getAudioIndex();
+    }
+    if (videoIndex < 0 && audioIndex < 0)
+    {
+        string errMsg = "No video or audio stream selected in:";
+        errMsg += inputFile;
+        logError("%s", errMsg.c_str());
+        throw std::runtime_error(errMsg);
+    }
+    grabber.selectStreams(videoIndex, audioIndex);
+
+    ClipExtractor clip{grabber, opts.clipPath, opts.clipStartMs, opts.clipEndMs, opts.clipReencode};
+    auto r = clip.run();
+    const double mb = 1024.0 * 1024.0;
+    logInfo("clip: %s starts at %gs (%gs asked), %llu packets, %llu frames encoded again in %gs",
+            opts.clipPath.c_str(), r.startMs / 1000.0, opts.clipStartMs / 1000.0, (unsigned long long)r.packets,
+            (unsigned long long)r.headFrames, r.headSec);
+    logInfo("clip: read %.1fMB, wrote %.1fMB in %gs, %.1f MB/s", r.readBytes / mb, r.writtenBytes / mb, r.wallSec,
+            r.wallSec > 0 ? r.readBytes / mb / r.wallSec : 0);
+
+    if (!opts.tracePath.empty())
+    {
+        TraceRecorder::instance().setEnabled(false);
+        TraceRecorder::instance().writeChromeTrace(opts.tracePath);
+    }
     return 0;
 }
 
 } // namespace
 
-void playVideoWithAudio(const string &inputFile)
+void playVideoWithAudio(const string &inputFile, const PlayOptions &opts)
+{
+    ffmpegUtil::logInfo("playVideoWithAudio: %s", inputFile.c_str());
+    play(inputFile, opts);
+}
+
+void playMosaicInputs(const std::vector<string> &inputs, const PlayOptions &opts)
 {
-    std::cout << "playVideoWithAudio: " << inputFile << std::endl;
-    play(inputFile);
-}
\ No newline at end of file
+    ffmpegUtil::logInfo("playMosaicInputs: %zu inputs", inputs.size());
+    playMosaic(inputs, opts);
+}
+
+void exportTensorFrames(const string &inputFile, const PlayOptions &opts)
+{
+    ffmpegUtil::logInfo("exportTensorFrames: %s -> %s", inputFile.c_str(), opts.tensorPath.c_str());
+    exportTensors(inputFile, opts);
+}
+
+void decodeSegmentsParallel(const string &inputFile, const PlayOptions &opts)
+{
+    ffmpegUtil::logInfo("decodeSegmentsParallel: %s", inputFile.c_str());
+    decodeParallel(inputFile, opts);
+}
+
+void extractClip(const string &inputFile, const PlayOptions &opts)
+{
+    ffmpegUtil::logInfo("extractClip: %s -> %s", inputFile.c_str(), opts.clipPath.c_str());
+    cutClip(inputFile, opts);
+}
@@ -1,28 +1,86 @@
 #include "ffmpegUtil.h"
+#include "logger.h"
 #include "mediaProcessor.hpp"
+#include "playerClock.h"
+#include "playbackStats.h"
+#include "sdlSink.h"
+#include "threadPolicy.h"
+#include "traceRecorder.h"
 
-extern "C"
+#include <atomic>
+#include <vector>
+
+using ffmpegUtil::logInfo;
+
+namespace
 {
-#include "SDL2/SDL.h"
-};
+// The SDL device thread, recorded by its first callback. startSdlAudio applies the thread
+// policy to it and reserves its trace buffer and log ring: the callback itself must not lock,
+// allocate or make scheduler calls, it only logs into the ring it adopted.
+std::atomic<bool> audioThreadKnown{false};
+ffmpegUtil::ThreadPolicy::ThreadHandle audioThread{};
+ffmpegUtil::TraceRecorder::ThreadBuffer *audioTraceBuffer = nullptr;
+ffmpegUtil::Logger::Ring *audioLogRing = nullptr;
+bool audioLogRingReserved = false;
 
-using std::cout;
-using std::endl;
+void reserveAudioLogRing()
+{
+    if (!audioLogRingReserved)
+    {
+        audioLogRing = ffmpegUtil::Logger::instance().reserveThreadRing();
+        audioLogRingReserved = true;
+    }
+}
+} // namespace
 
 void sdlAudioCallback(void *userdata, Uint8 *stream, int len)
 {
+    static thread_local int64_t lastCallbackUs = -1;
+    if (!audioThreadKnown.load(std::memory_order_relaxed))
+    {
+        audioThread = ffmpegUtil::ThreadPolicy::currentThread();
+        ffmpegUtil::TraceRecorder::instance().adoptThreadBuffer(audioTraceBuffer);
+        ffmpegUtil::Logger::instance().adoptThreadRing(audioLogRing);
+        audioThreadKnown.store(true, std::memory_order_release);
+    }
+    ffmpegUtil::TraceScope trace("audio callback");
     AudioProcessor *receiver = (AudioProcessor *)userdata;
-    receiver->writeAudioData(stream, len);
+    bool written = receiver->writeAudioData(stream, len);
+
+    auto &stats = ffmpegUtil::PlaybackStats::instance();
+    int64_t unset = -1;
+    if (written && stats.firstAudioUs.load(std::memory_order_relaxed) < 0)
+    {
+        stats.firstAudioUs.compare_exchange_strong(unset, ffmpegUtil::PlayerClock::get().nowUs());
+    }
+    stats.audioCallbacks.fetch_add(1, std::memory_order_relaxed);
+    stats.audioPtsMs.store(receiver->getPts(), std::memory_order_relaxed);
+
+    // the measured device period, the buffer size alone does not show backend jitter.
+    int64_t nowUs = ffmpegUtil::PlayerClock::get().nowUs();
+    if (lastCallbackUs >= 0)
+    {
+        uint64_t gapUs = (uint64_t)(nowUs - lastCallbackUs);
+        stats.audioCallbackGapUs.fetch_add(gapUs, std::memory_order_relaxed);
+        if (gapUs > stats.audioCallbackMaxGapUs.load(std::memory_order_relaxed))
+        {
+            stats.audioCallbackMaxGapUs.store(gapUs, std::memory_order_relaxed);
+        }
+    }
+    lastCallbackUs = nowUs;
 }
 
-void startSdlAudio(SDL_AudioDeviceID &audioDeviceID, AudioProcessor &aProcessor)
+void setAudioDeviceOutput(AudioProcessor &source, int sampleRate, AVSampleFormat format, int channels, int samples)
 {
-    // audio specs containers
-    SDL_AudioSpec wanted_specs; // desired output format
-    SDL_AudioSpec specs;        // actual output format
+    source.setDeviceOutput(sampleRate, format, channels, samples);
+}
 
+namespace
+{
+int waitAudioSamples(AudioProcessor &aProcessor, const std::atomic<bool> *stop = nullptr)
+{
     int samples = -1;
-    while (true)
+    while (stop == nullptr || !stop->load())
     {
         samples = aProcessor.getSamples();
         if (samples <= 0)
@@ -31,48 +89,92 @@ void startSdlAudio(SDL_AudioDeviceID &audioDeviceID, AudioProcessor &aProcessor)
         }
         else
         {
-            cout << "get audio samples:" << samples << endl;
+            logInfo("get audio samples:%d", samples);
             break;
         }
     }
+    return samples;
+}
+} // namespace
 
-    // set audio settings from codec info
-    wanted_specs.freq = aProcessor.getOutSampleRate();
-    wanted_specs.format = AUDIO_S16SYS;
-    wanted_specs.channels = aProcessor.getOutChannels();
-    wanted_specs.samples = samples;
-    wanted_specs.silence = 0;
-    wanted_specs.callback = sdlAudioCallback;
-    wanted_specs.userdata = &aProcessor;
-
-    // open audio device
-    audioDeviceID = SDL_OpenAudioDevice(nullptr, 0, &wanted_specs, &specs, 0);
-
-    // SDL_OpenAudioDevice returns a valid device ID that is > 0 on success or 0 on failure
-    if (audioDeviceID == 0)
+// Used instead of an SDL device when a virtual PlayerClock is installed: the audio callback
+// is called at the rate the clock dictates, as the device thread would do in real time.
+void runVirtualAudio(std::atomic<bool> &stop, AudioProcessor &aProcessor)
+{
+    ffmpegUtil::ThreadPolicy::instance().apply(ffmpegUtil::ThreadPolicy::AUDIO_OUTPUT, "virtual audio");
+    reserveAudioLogRing(); // adopted by the first callback, as on the device thread
+    int samples = waitAudioSamples(aProcessor, &stop);
+    if (samples <= 0)
     {
-        string errMsg = "Failed to open audio device:";
-        errMsg += SDL_GetError();
-        cout << errMsg << endl;
-        throw std::runtime_error(errMsg);
+        return;
     }
 
-    cout << "wanted_specs.freq:" << wanted_specs.freq << endl;
-    std::printf("wanted_specs.format: Ox%X\n", wanted_specs.format);
-    cout << "wanted_specs.channels:" << (int)wanted_specs.channels << endl;
-    cout << "wanted_specs.silence:" << (int)wanted_specs.silence << endl;
-    cout << "wanted_specs.samples:" << (int)wanted_specs.samples << endl;
-
-    cout << "------------------------------------------------" << endl;
-
-    cout << "specs.freq:" << specs.freq << endl;
-    std::printf("specs.format: Ox%X\n", specs.format);
-    cout << "specs.channels:" << (int)specs.channels << endl;
-    cout << "specs.silence:" << (int)specs.silence << endl;
-    cout << "specs.samples:" << (int)specs.samples << endl;
+    int len = samples * aProcessor.getOutFrameBytes();
+    std::vector<uint8_t> buffer(len);
+    auto &clock = ffmpegUtil::PlayerClock::get();
+    int64_t startUs = clock.nowUs();
+    int64_t played = 0;
+    while (!stop.load())
+    {
+        sdlAudioCallback(&aProcessor, buffer.data(), len);
+        played += samples;
+        int64_t dueUs = startUs + played * 1000000 / aProcessor.getOutSampleRate();
+        clock.sleepForUs(dueUs - clock.nowUs());
+    }
+    logInfo("[THREAD] virtual audio thread finish.");
+}
 
-    cout << "------------------------------------------------" << endl;
+// Opens the device as soon as the codec is open: the spec comes from the codec parameters,
+// only codecs without a fixed frame size make us wait for the first decoded frame.
+// Returns false when stopped before that.
+bool openSdlAudio(SdlAudioSink &sink, AudioProcessor &aProcessor, const std::atomic<bool> *stop)
+{
+    int samples = aProcessor.getCodecFrameSize();
+    if (samples <= 0)
+    {
+        samples = waitAudioSamples(aProcessor, stop);
+    }
+    if (samples <= 0)
+    {
+        return false;
+    }
+    sink.open(aProcessor.getOutAudioInfo(), samples);
+    return true;
+}
 
-    SDL_PauseAudioDevice(audioDeviceID, 0);
-    cout << "[THREAD] audio start thread finish." << endl;
-}
\ No newline at end of file
+// Opens the device if that could not be done at startup, then starts it once the
+// AudioProcessor has the first callback's worth of data (or the stream has ended) and
+// applies the thread policy to the device thread once it runs.
+void startSdlAudio(std::atomic<bool> &stop, SdlAudioSink &sink, AudioProcessor &aProcessor)
+{
+    if (!sink.isOpen() && !openSdlAudio(sink, aProcessor, &stop))
+    {
+        return;
+    }
+    bool ready = false;
+    while (!ready && !stop.load())
+    {
+        ready = aProcessor.waitDataReady(50) || aProcessor.isStreamFinished();
+    }
+    if (stop.load())
+    {
+        return;
+    }
+    audioThreadKnown = false;
+    if (audioTraceBuffer == nullptr)
+    {
+        audioTraceBuffer = ffmpegUtil::TraceRecorder::instance().reserveThreadBuffer("sdl audio callback");
+    }
+    reserveAudioLogRing();
+    sink.resume();
+    while (!stop.load() && !audioThreadKnown.load(std::memory_order_acquire))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    if (audioThreadKnown.load(std::memory_order_acquire))
+    {
+        ffmpegUtil::ThreadPolicy::instance().applyTo(audioThread, ffmpegUtil::ThreadPolicy::AUDIO_OUTPUT,
+                                                     "sdl audio callback");
+    }
+    logInfo("[THREAD] audio start thread finish.");
+}
@@ -0,0 +1,174 @@
+#include "ffmpegUtil.h"
+#include "mediaProcessor.hpp"
+#include "playerClock.h"
+#include "traceRecorder.h"
+
+#include <algorithm>
+#include <vector>
+
+extern "C"
+{
+#include "SDL2/SDL.h"
+};
+
+using ffmpegUtil::logError;
+using ffmpegUtil::logInfo;
+
+namespace
+{
+// one input of the mosaic. The VideoProcessor outputs frames at the tile size already.
+struct MosaicTile
+{
+    VideoProcessor *processor;
+    SDL_Rect rect;
+    int64_t frameUs = 40000; // frame duration, for the late check
+    int64_t startUs = -1;    // PlayerClock time of the first frame, its own clock per tile
+    int64_t firstPts = 0;
+    int64_t lastShownUs = 0;
+    uint64_t shown = 0;
+    uint64_t dropped = 0;
+};
+
+// a tile that falls that far behind (stalled stream, slow decoder) restarts its clock instead of
+// dropping everything from now on.
+const int64_t RESYNC_US = 1000000;
+// late frames are still shown when the tile has not changed for that long.
+const int64_t MIN_UPDATE_US = 200000;
+
+// true when the tile's texture region was updated.
+bool updateTile(MosaicTile &tile, SDL_Texture *texture, int64_t nowUs)
+{
+    VideoProcessor &p = *tile.processor;
+    if (p.getReadyFrames() == 0)
+    {
+        return false;
+    }
+    AVFrame *frame = p.getFrame();
+    int64_t pts = (int64_t)p.getPts();
+    if (tile.startUs < 0)
+    {
+        tile.startUs = nowUs;
+        tile.firstPts = pts;
+    }
+    int64_t dueUs = tile.startUs + (pts - tile.firstPts) * 1000;
+    if (dueUs > nowUs)
+    {
+        return false; // kept until its time
+    }
+    int64_t lateUs = nowUs - dueUs;
+    if (lateUs > RESYNC_US)
+    {
+        tile.startUs = nowUs - (pts - tile.firstPts) * 1000;
+    }
+    else if (lateUs > tile.frameUs && nowUs - tile.lastShownUs < MIN_UPDATE_US)
+    {
+        tile.dropped++;
+        p.refreshFrame();
+        return false;
+    }
+
+    SDL_UpdateYUVTexture(texture, &tile.rect, frame->data[0], frame->linesize[0], frame->data[1],
+                         frame->linesize[1], frame->data[2], frame->linesize[2]);
+    tile.shown++;
+    tile.lastShownUs = nowUs;
+    p.refreshFrame();
+    return true;
+}
+} // namespace
+
+// Mosaic render loop: one window, one streaming IYUV texture covering it, one present per vsync.
+// Every tile only uploads its own rectangle of the texture when it has a new frame due, frames are
+// never composed on the CPU. Returns when every input is finished or the window is closed (q, esc).
+// rects[i] is the tile of processors[i], the processors output frames of that size.
+void playSdlMosaic(const std::vector<VideoProcessor *> &processors, const std::vector<SDL_Rect> &rects, int width,
+                   int height)
+{
+    std::vector<MosaicTile> tiles(processors.size());
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        tiles[i].processor = processors[i];
+        tiles[i].rect = rects[i];
+        double frameRate = processors[i]->getFrameRate();
+        if (frameRate > 0)
+        {
+            tiles[i].frameUs = (int64_t)(1000000 / frameRate);
+        }
+    }
+
+    SDL_Window *window = SDL_CreateWindow(":-D Player mosaic", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                          width, height, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+    if (!window)
+    {
+        string errMsg = "SDL: could not create window - exiting:";
+        errMsg += SDL_GetError();
+        logError("%s", errMsg.c_str());
+        throw std::runtime_error(errMsg);
+    }
+    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC);
+    SDL_Texture *texture =
+        SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, width, height);
+
+    // black background for the unused cells.
+    std::vector<uint8_t> black((size_t)width * height * 3 / 2, 128);
+    std::fill(black.begin(), black.begin() + (size_t)width * height, 16);
+    SDL_UpdateYUVTexture(texture, nullptr, black.data(), width, black.data() + width * height, width / 2,
+                         black.data() + width * height * 5 / 4, width / 2);
+
+    auto &clock = ffmpegUtil::PlayerClock::get();
+    const int64_t vsyncUs = 1000000 / 60;
+    bool quit = false;
+    uint64_t presents = 0;
+    while (!quit)
+    {
+        int64_t loopStartUs = clock.nowUs();
+        SDL_Event event;
+        while (SDL_PollEvent(&event))
+        {
+            if (event.type == SDL_QUIT ||
+                (event.type == SDL_KEYDOWN && (event.key.keysym.sym == SDLK_q || event.key.keysym.sym == SDLK_ESCAPE)))
+            {
+                logInfo("mosaic: window closed.");
+                quit = true;
+            }
+        }
+
+        bool finished = true;
+        {
+            ffmpegUtil::TraceScope trace("mosaic tiles");
+            for (auto &tile : tiles)
+            {
+                updateTile(tile, texture, loopStartUs);
+                finished = finished && tile.processor->isStreamFinished() && tile.processor->getReadyFrames() == 0;
+            }
+        }
+        if (finished)
+        {
+            break;
+        }
+
+        {
+            ffmpegUtil::TraceScope trace("present");
+            SDL_RenderClear(renderer);
+            SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+            SDL_RenderPresent(renderer); // blocks until the vsync
+        }
+        presents++;
+
+        // no vsync (dummy driver, vsync off in the driver): pace the loop ourselves.
+        int64_t spentUs = clock.nowUs() - loopStartUs;
+        if (spentUs < vsyncUs / 2)
+        {
+            clock.sleepForMs((int)((vsyncUs - spentUs) / 1000));
+        }
+    }
+
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    logInfo("mosaic: render loop finished, presents = %llu", (unsigned long long)presents);
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        logInfo("mosaic tile #%zu: shown = %llu, dropped = %llu", i, (unsigned long long)tiles[i].shown,
+                (unsigned long long)tiles[i].dropped);
+    }
+}
@@ -1,21 +1,30 @@
 #include "ffmpegUtil.h"
+#include "frameCache.h"
 #include "mediaProcessor.hpp"
+#include "latencyStamp.h"
+#include "playOptions.h"
+#include "playerClock.h"
+#include "playbackStats.h"
+#include "sdlSink.h"
+#include "threadPolicy.h"
+#include "traceRecorder.h"
 
-extern "C"
-{
-#include "SDL2/SDL.h"
-};
+#include <algorithm>
+#include <memory>
+#include <vector>
 
-using std::cout;
-using std::endl;
+using ffmpegUtil::logInfo;
+using ffmpegUtil::logWarn;
 
 // Refresh Event
 #define REFRESH_EVENT (SDL_USEREVENT + 1)
 #define BREAK_EVENT (SDL_USEREVENT + 2)
+#define CACHE_EVENT (SDL_USEREVENT + 3) // the FrameCache decoded a GOP
 
 void refreshPicture(int timeInterval, bool &exitRefresh, bool &faster)
 {
-    cout << "picRefresher timeInterval [" << timeInterval << "]" << endl;
+    ffmpegUtil::ThreadPolicy::instance().apply(ffmpegUtil::ThreadPolicy::REFRESH, "refresh timer");
+    logInfo("picRefresher timeInterval [%d]", timeInterval);
     while (!exitRefresh)
     {
         SDL_Event event;
@@ -23,77 +32,308 @@ void refreshPicture(int timeInterval, bool &exitRefresh, bool &faster)
         SDL_PushEvent(&event);
         if (faster)
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(timeInterval / 2));
+            ffmpegUtil::PlayerClock::get().sleepForMs(timeInterval / 2);
         }
         else
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(timeInterval));
+            ffmpegUtil::PlayerClock::get().sleepForMs(timeInterval);
         }
     }
-    cout << "[THREAD] picRefresher thread finished." << endl;
+    logInfo("[THREAD] picRefresher thread finished.");
+}
+
+// ask the video loop to present the next frame, safe to call from any thread.
+void requestSdlRefresh()
+{
+    SDL_Event event;
+    event.type = REFRESH_EVENT;
+    SDL_PushEvent(&event);
+}
+
+namespace
+{
+void printLatency(std::vector<int64_t> &latencyUs)
+{
+    if (latencyUs.empty())
+    {
+        logInfo("latency probe: no stamped frame received.");
+        return;
+    }
+    std::sort(latencyUs.begin(), latencyUs.end());
+    auto at = [&](double q) { return latencyUs[(size_t)(q * (latencyUs.size() - 1))] / 1000.0; };
+    logInfo("latency probe: frames = %zu, min = %gms, p50 = %gms, p95 = %gms, max = %gms", latencyUs.size(), at(0),
+            at(0.5), at(0.95), at(1));
 }
 
-void playSdlVideo(VideoProcessor &vProcessor, AudioProcessor *audio = nullptr)
+// -review: pause, frame step and reverse playback. Frames behind the live position come from
+// the FrameCache, the live ones from the VideoProcessor as usual. A step the cache has to decode
+// for waits for its CACHE_EVENT, the render loop goes on meanwhile.
+class ReviewControl
 {
-    auto width = vProcessor.getWidth();
-    auto height = vProcessor.getHeight();
+    ffmpegUtil::FrameCache &cache;
+    VideoSink &sink;
+    bool paused = false;
+    bool reverse = false;
+    bool stepLive = false;
+    bool waitingBack = false;
+    bool waitingForward = false;
+    ffmpegUtil::FramePtr shown{}; // cache frame on screen, null while it is the last live frame
+    int64_t shownPts = 0;
+    int64_t livePts = 0;
 
-    // create SDL_Window
-    SDL_Window *screen;
-    // SDL 2.0 Support for multiple windows
-    screen = SDL_CreateWindow(":-D Player", SDL_WINDOWPOS_UNDEFINED,
-                              SDL_WINDOWPOS_UNDEFINED, width, height,
-                              SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
-    if (!screen)
+    void present(ffmpegUtil::FramePtr frame)
     {
-        string errMsg = "SDL: could not create window - exiting:";
-        errMsg += SDL_GetError();
-        cout << errMsg << endl;
-        throw std::runtime_error(errMsg);
+        shownPts = frame->pts;
+        {
+            ffmpegUtil::TraceScope trace("present");
+            sink.write(frame.get(), shownPts);
+        }
+        shown = std::move(frame);
     }
 
-    //创建渲染器SDL_Renderer
-    SDL_Renderer *sdlRenderer = SDL_CreateRenderer(screen, -1, 0);
+    // false at the start of the stream.
+    bool stepBack()
+    {
+        bool decoding = false;
+        auto frame = cache.frameBefore(shownPts, decoding);
+        if (frame == nullptr)
+        {
+            waitingBack = decoding;
+            return decoding;
+        }
+        present(std::move(frame));
+        cache.prefetchBefore(shownPts);
+        return true;
+    }
 
-    //创建纹理SDL_Texture
-    Uint32 pixFmt = SDL_PIXELFORMAT_IYUV;
+    // false when the next frame is the live one.
+    bool stepForward()
+    {
+        if (shown == nullptr)
+        {
+            return false;
+        }
+        bool decoding = false;
+        auto frame = cache.frameAfter(shownPts, decoding);
+        if (frame == nullptr && decoding)
+        {
+            waitingForward = true;
+            return true;
+        }
+        if (frame == nullptr || frame->pts > livePts)
+        {
+            shown.reset();
+            return false;
+        }
+        present(std::move(frame));
+        return true;
+    }
 
-    SDL_Texture *sdlTexture =
-        SDL_CreateTexture(sdlRenderer, pixFmt, SDL_TEXTUREACCESS_STREAMING, width, height);
+public:
+    ReviewControl(ffmpegUtil::FrameCache &c, VideoSink &s) : cache(c), sink(s)
+    {
+        cache.setDecodedCallback([]() {
+            SDL_Event event;
+            event.type = CACHE_EVENT;
+            SDL_PushEvent(&event);
+        });
+    }
 
+    void onLivePresented(int64_t pts)
+    {
+        livePts = pts;
+        shownPts = pts;
+        shown.reset();
+        waitingBack = false;
+        waitingForward = false;
+    }
+
+    // the step that waited for the cache is taken now. true when the next live frame should be
+    // requested right away.
+    bool onCacheDecoded()
+    {
+        if (waitingBack)
+        {
+            waitingBack = false;
+            if (!stepBack())
+            {
+                logInfo("review: start of stream, paused.");
+                reverse = false;
+                paused = true;
+            }
+        }
+        else if (waitingForward)
+        {
+            waitingForward = false;
+            if (!stepForward() && paused)
+            {
+                stepLive = true;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // true when the refresh tick was handled here, false when the next live frame is due.
+    bool onRefresh(bool liveFinished)
+    {
+        if (stepLive)
+        {
+            stepLive = false;
+            return liveFinished;
+        }
+        if (waitingBack || waitingForward)
+        {
+            return true;
+        }
+        if (reverse)
+        {
+            if (!stepBack())
+            {
+                logInfo("review: start of stream, paused.");
+                reverse = false;
+                paused = true;
+            }
+            return true;
+        }
+        if (paused || stepForward()) // after stepping back, catch up from the cache first.
+        {
+            return true;
+        }
+        if (liveFinished)
+        {
+            logInfo("review: end of stream, paused.");
+            paused = true;
+            cache.prefetch(livePts);
+            return true;
+        }
+        return false;
+    }
+
+    // true when the next live frame should be requested right away.
+    bool onKey(SDL_Keycode key)
+    {
+        switch (key)
+        {
+        case SDLK_SPACE:
+            paused = !paused;
+            reverse = false;
+            if (paused)
+            {
+                // the first step back is then a hit.
+                cache.prefetch(shownPts);
+            }
+            logInfo("review: %s at %lldms", paused ? "paused" : "playing", (long long)shownPts);
+            return false;
+        case SDLK_LEFT:
+            paused = true;
+            reverse = false;
+            stepBack();
+            return false;
+        case SDLK_RIGHT:
+            paused = true;
+            reverse = false;
+            if (!stepForward())
+            {
+                stepLive = true;
+                return true;
+            }
+            return false;
+        case SDLK_r:
+            reverse = !reverse;
+            paused = false;
+            logInfo("review: %s playback", reverse ? "reverse" : "forward");
+            return false;
+        default:
+            return false;
+        }
+    }
+};
+} // namespace
+
+// opts.lowLatency: frames are presented as soon as they are decoded (the VideoProcessor calls
+// requestSdlRefresh), there is no refresh timer and no A/V sync wait.
+// The first frame is always presented as soon as it is decoded.
+// sink is the realtime sink the frames are presented on (SdlVideoSink), audio the A/V sync master.
+// With a cache (review mode) the loop keeps running at the end of the stream, until the window is closed.
+void playSdlVideo(VideoProcessor &vProcessor, AudioProcessor *audio, VideoSink &sink,
+                  ffmpegUtil::FrameCache *cache, const PlayOptions &opts)
+{
     SDL_Event event;
     auto frameRate = vProcessor.getFrameRate();
-    cout << "frame rate [" << frameRate << "]" << endl;
+    logInfo("frame rate [%g]", frameRate);
+
+    if (frameRate <= 0)
+    {
+        frameRate = 25;
+    }
 
     bool exitRefresh = false;
     bool faster = false;
-    std::thread refreshThread{refreshPicture, (int)(1000 / frameRate), std::ref(exitRefresh),
-                              std::ref(faster)};
+    std::thread refreshThread{};
+    if (opts.lowLatency)
+    {
+        // a frame may have been ready before the event queue existed.
+        requestSdlRefresh();
+    }
+    else
+    {
+        refreshThread = std::thread(refreshPicture, (int)(1000 / frameRate), std::ref(exitRefresh),
+                                    std::ref(faster));
+    }
+    std::vector<int64_t> latencyUs{};
+    std::unique_ptr<ReviewControl> review{};
+    if (cache != nullptr)
+    {
+        review.reset(new ReviewControl(*cache, sink));
+    }
+
+    // the overlay lives in the SDL sink, the loop feeds it and toggles it.
+    auto sdlSink = dynamic_cast<SdlVideoSink *>(&sink);
+    StatsOverlay *overlay = sdlSink != nullptr ? sdlSink->getOverlay() : nullptr;
+    if (overlay != nullptr)
+    {
+        overlay->setVisible(opts.overlay);
+    }
 
+    auto &stats = ffmpegUtil::PlaybackStats::instance();
     int failCount = 0;
     int fastCount = 0;
     int slowCount = 0;
-    while (!vProcessor.isStreamFinished())
+    while (!vProcessor.isStreamFinished() || review != nullptr)
     {
         SDL_WaitEvent(&event); //等待一个事件
 
         if (event.type == REFRESH_EVENT)
         {
+            if (overlay != nullptr && overlay->isVisible())
+            {
+                overlay->update({vProcessor.getPacketQueueSize(), audio != nullptr ? audio->getPacketQueueSize() : 0,
+                                 vProcessor.getReadyFrames(), audio != nullptr ? audio->getReadyFrames() : 0});
+            }
+            if (review != nullptr && review->onRefresh(vProcessor.isStreamFinished()))
+            {
+                continue;
+            }
             if (vProcessor.isStreamFinished())
             {
                 exitRefresh = true;
                 continue; // skip REFRESH event.
             }
 
-            if (audio != nullptr)
+            bool firstFrame = stats.firstVideoUs.load(std::memory_order_relaxed) < 0;
+            if (audio != nullptr && !opts.lowLatency && !firstFrame)
             {
                 auto vTs = vProcessor.getPts();
                 auto aTs = audio->getPts();
+                stats.avOffsetMs.store((int64_t)vTs - (int64_t)aTs, std::memory_order_relaxed);
                 if (vTs > aTs && vTs - aTs > 30)
                 {
                     // cout << "VIDEO FASTER ======== vTs - aTs [" << (vTs - aTs) << "]ms, SKIP A EVENT" << endl;
                     faster = false;
                     slowCount++;
+                    stats.framesSkipped.fetch_add(1, std::memory_order_relaxed);
+                    ffmpegUtil::TraceRecorder::instance().instant("sync skip");
                     continue; // skip a REFRESH_EVENT
                 }
                 else if (vTs < aTs && aTs - vTs > 30)
@@ -112,37 +352,88 @@ void playSdlVideo(VideoProcessor &vProcessor, AudioProcessor *audio = nullptr)
 
             if (frame != nullptr)
             {
-                SDL_UpdateYUVTexture(sdlTexture, NULL, frame->data[0],
-                                     frame->linesize[0], frame->data[1], frame->linesize[1],
-                                     frame->data[2], frame->linesize[2]); //设置纹理的数据
-                SDL_RenderClear(sdlRenderer);                             //渲染器clear
-                SDL_RenderCopy(sdlRenderer, sdlTexture, NULL, NULL);      //将纹理的数据拷贝给渲染器
-                SDL_RenderPresent(sdlRenderer);                           //显示
+                auto presentStart = ffmpegUtil::PlayerClock::get().nowUs();
+                {
+                    ffmpegUtil::TraceScope trace("present");
+                    sink.write(frame, vProcessor.getPts());
+                }
+                stats.presentUs.fetch_add(ffmpegUtil::PlayerClock::get().nowUs() - presentStart,
+                                          std::memory_order_relaxed);
+
+                int64_t stampUs;
+                if (opts.latencyProbe && ffmpegUtil::LatencyStamp::read(frame, stampUs))
+                {
+                    latencyUs.push_back(ffmpegUtil::LatencyStamp::wallClockUs() - stampUs);
+                }
 
                 if (!vProcessor.refreshFrame())
                 {
-                    cout << "WARNING: vProcessor.refreshFrame false" << endl;
+                    logWarn("vProcessor.refreshFrame false");
+                }
+                stats.framesPresented.fetch_add(1, std::memory_order_relaxed);
+                if (firstFrame)
+                {
+                    stats.firstVideoUs.store(ffmpegUtil::PlayerClock::get().nowUs());
+                }
+                stats.videoPtsMs.store(vProcessor.getPts(), std::memory_order_relaxed);
+                if (review != nullptr)
+                {
+                    review->onLivePresented(vProcessor.getPts());
                 }
             }
             else
             {
                 failCount++;
-                cout << "WARNING: getFrame fail. failCount = " << failCount << endl;
+                stats.framesNotReady.fetch_add(1, std::memory_order_relaxed);
+                logWarn("getFrame fail. failCount = %d", failCount);
+            }
+        }
+        else if (event.type == SDL_KEYDOWN && audio != nullptr &&
+                 (event.key.keysym.sym == SDLK_UP || event.key.keysym.sym == SDLK_DOWN))
+        {
+            float step = event.key.keysym.sym == SDLK_UP ? 0.1f : -0.1f;
+            audio->setVolume(std::min(2.0f, std::max(0.0f, audio->getVolume() + step)));
+            logInfo("volume: %d%%", (int)(audio->getVolume() * 100 + 0.5f));
+        }
+        else if (event.type == SDL_KEYDOWN && overlay != nullptr && event.key.keysym.sym == SDLK_o)
+        {
+            overlay->setVisible(!overlay->isVisible());
+        }
+        else if (event.type == SDL_KEYDOWN && review != nullptr)
+        {
+            if (review->onKey(event.key.keysym.sym))
+            {
+                requestSdlRefresh();
             }
         }
         else if (event.type == SDL_QUIT) // close window.
         {
-            cout << "SDL screen got a SDL_QUIT." << endl;
+            logInfo("SDL screen got a SDL_QUIT.");
             exitRefresh = true;
             break;
         }
+        else if (event.type == CACHE_EVENT && review != nullptr)
+        {
+            if (review->onCacheDecoded())
+            {
+                requestSdlRefresh();
+            }
+        }
         else if (event.type == BREAK_EVENT)
         {
             break;
         }
     }
 
-    refreshThread.join();
-    cout << "[THREAD] Sdl video thread finish: failCount = " << failCount << ", fastCount = " << fastCount
-         << ", slowCount = " << slowCount << endl;
+    exitRefresh = true;
+    if (refreshThread.joinable())
+    {
+        refreshThread.join();
+    }
+    if (opts.latencyProbe)
+    {
+        printLatency(latencyUs);
+    }
+    logInfo("[THREAD] Sdl video thread finish: failCount = %d, fastCount = %d, slowCount = %d", failCount, fastCount,
+            slowCount);
 }
\ No newline at end of file